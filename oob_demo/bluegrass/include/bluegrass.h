@@ -24,6 +24,12 @@ extern "C" {
 /******************************************************************************/
 /* Global Constants, Macros and Type Definitions                              */
 /******************************************************************************/
+/* Time from when a sensor message is queued until it has been sent to AWS. */
+typedef struct BluegrassLatency {
+	uint32_t count;
+	uint32_t maxMs;
+	uint64_t totalMs;
+} BluegrassLatency_t;
 
 /******************************************************************************/
 /* Global Data Definitions                                                    */
@@ -63,6 +69,21 @@ void Bluegrass_ConnectedCallback(void);
  */
 void Bluegrass_DisconnectedCallback(void);
 
+/**
+ * @brief Get the publish latency statistics for a priority class.
+ *
+ * @param Priority is a JSON_MSG_PRIORITY
+ *
+ * @retval pointer to statistics, NULL if priority is invalid
+ */
+const BluegrassLatency_t *Bluegrass_GetLatency(uint8_t Priority);
+
+/**
+ * @retval uptime (ms) of the first sensor event publish, 0 if there hasn't
+ * been one
+ */
+uint32_t Bluegrass_GetFirstPublishTime(void);
+
 #ifdef __cplusplus
 }
 #endif
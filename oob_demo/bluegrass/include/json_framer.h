@@ -0,0 +1,67 @@
+/**
+ * @file json_framer.h
+ * @brief Frames a JSON object that arrives in chunks (notifications).
+ * The object is copied into a buffer provided by the caller so that the
+ * buffer can be sent as a message without another copy.  Braces inside
+ * of strings are ignored.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __JSON_FRAMER_H__
+#define __JSON_FRAMER_H__
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************/
+/* Global Constants, Macros and Type Definitions                              */
+/******************************************************************************/
+typedef struct JsonFramer {
+	char *pBuffer;
+	size_t size;
+	size_t length;
+	uint16_t depth;
+	bool inString;
+	bool escape;
+	bool discard; /* the rest of an object that was too large */
+} JsonFramer_t;
+
+/******************************************************************************/
+/* Global Function Prototypes                                                 */
+/******************************************************************************/
+/**
+ * @brief Start a new object.
+ *
+ * @param pBuffer where the object is copied (it isn't NUL terminated)
+ * @param Size of the buffer
+ */
+void JsonFramer_Reset(JsonFramer_t *p, char *pBuffer, size_t Size);
+
+/**
+ * @brief Process a chunk of data.  Data before the start of an object is
+ * discarded.  Processing stops at the end of an object so that data that
+ * follows it can be framed into a new buffer.
+ *
+ * @param pUsed is the number of bytes of pData that were processed.
+ *
+ * @retval 1 if the object is complete, 0 if more data is required,
+ * -ENOMEM if the object is too large (the rest of it is discarded)
+ */
+int JsonFramer_Compute(JsonFramer_t *p, const char *pData, size_t Length,
+		       size_t *pUsed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __JSON_FRAMER_H__ */
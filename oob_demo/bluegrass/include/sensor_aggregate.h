@@ -0,0 +1,57 @@
+/**
+ * @file sensor_aggregate.h
+ * @brief Minimum, maximum, and mean of the readings of a sensor over a
+ * period of time (fixed-point).
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __SENSOR_AGGREGATE_H__
+#define __SENSOR_AGGREGATE_H__
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************/
+/* Global Constants, Macros and Type Definitions                              */
+/******************************************************************************/
+/* A count of zero means that the aggregate is empty. */
+typedef struct SensorAggregate {
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+	uint32_t count;
+} SensorAggregate_t;
+
+/******************************************************************************/
+/* Global Function Prototypes                                                 */
+/******************************************************************************/
+/**
+ * @brief Add a reading to the aggregate.
+ */
+void SensorAggregate_Add(SensorAggregate_t *p, int32_t Value);
+
+/**
+ * @retval mean of the readings (rounded to nearest), 0 if empty
+ */
+int32_t SensorAggregate_Mean(const SensorAggregate_t *p);
+
+/**
+ * @brief Remove all readings.
+ */
+void SensorAggregate_Clear(SensorAggregate_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SENSOR_AGGREGATE_H__ */
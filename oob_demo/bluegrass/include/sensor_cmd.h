@@ -45,6 +45,18 @@ extern const char SENSOR_CMD_SET_EPOCH_FMT_STR[];
  */
 bool SensorCmd_RequiresReset(char *pCmd);
 
+/**
+ * @brief Merge the parameters of two set commands into one set command.
+ * Parameters in the newer command replace the same parameters in the older
+ * command.
+ *
+ * @param pOut is the merged command (it can be the size of both commands)
+ *
+ * @retval length of merged command, 0 if the commands couldn't be merged
+ */
+size_t SensorCmd_MergeSet(const char *pOlder, const char *pNewer, char *pOut,
+			  size_t Size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,82 @@
+/**
+ * @file sensor_deadline.h
+ * @brief Deadline queue (indexed min-heap) used to schedule sensor table
+ * work.  Each key can have at most one deadline.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __SENSOR_DEADLINE_H__
+#define __SENSOR_DEADLINE_H__
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************/
+/* Global Constants, Macros and Type Definitions                              */
+/******************************************************************************/
+typedef struct SensorDeadline SensorDeadline_t;
+
+/* Returned when nothing is scheduled */
+#define SENSOR_DEADLINE_NONE INT64_MAX
+
+/******************************************************************************/
+/* Global Function Prototypes                                                 */
+/******************************************************************************/
+/**
+ * @brief Allocates a deadline queue object from the heap.
+ *
+ * @param Size is the number of keys (0 to Size - 1).
+ *
+ * @retval pointer to object, NULL if memory isn't available
+ */
+SensorDeadline_t *SensorDeadline_Allocate(size_t Size);
+
+/**
+ * @brief Free object (return memory to system heap).
+ */
+void SensorDeadline_Free(SensorDeadline_t *p);
+
+/**
+ * @brief Set the deadline (uptime in ms) of a key.  If the key is already
+ * scheduled, then its deadline is replaced.
+ */
+void SensorDeadline_Schedule(SensorDeadline_t *p, size_t Key, int64_t Time);
+
+/**
+ * @brief Remove the deadline of a key (if it is scheduled).
+ */
+void SensorDeadline_Cancel(SensorDeadline_t *p, size_t Key);
+
+/**
+ * @retval true if key has a deadline
+ */
+bool SensorDeadline_IsPending(SensorDeadline_t *p, size_t Key);
+
+/**
+ * @retval earliest deadline, SENSOR_DEADLINE_NONE if the queue is empty
+ */
+int64_t SensorDeadline_Next(SensorDeadline_t *p);
+
+/**
+ * @brief Remove the key with the earliest deadline if it has expired.
+ *
+ * @retval true if pKey was populated with an expired key
+ */
+bool SensorDeadline_PopExpired(SensorDeadline_t *p, int64_t Now,
+			       size_t *pKey);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SENSOR_DEADLINE_H__ */
@@ -0,0 +1,65 @@
+/**
+ * @file sensor_gatt_cache.h
+ * @brief The VSP handles of recently configured sensors are cached so that
+ * discovery can be skipped when a sensor is reconnected.  An entry is only
+ * valid for the firmware version that it was discovered with.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __SENSOR_GATT_CACHE_H__
+#define __SENSOR_GATT_CACHE_H__
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <bluetooth/bluetooth.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************/
+/* Global Constants, Macros and Type Definitions                              */
+/******************************************************************************/
+typedef struct SensorGattHandles {
+	uint16_t write; /* VSP RX value */
+	uint16_t value; /* VSP TX value */
+	uint16_t ccc; /* VSP TX CCC descriptor */
+} SensorGattHandles_t;
+
+/******************************************************************************/
+/* Global Function Prototypes                                                 */
+/******************************************************************************/
+/**
+ * @brief Look up the handles of a sensor.
+ *
+ * @param FirmwareVersion of the sensor (0 if unknown).
+ *
+ * @retval true if pHandles was populated
+ */
+bool SensorGattCache_Find(const bt_addr_le_t *pAddr, uint32_t FirmwareVersion,
+			  SensorGattHandles_t *pHandles);
+
+/**
+ * @brief Add (or update) the handles of a sensor.  The least recently used
+ * entry is replaced when the cache is full.  Nothing is cached if the
+ * firmware version is unknown.
+ */
+void SensorGattCache_Add(const bt_addr_le_t *pAddr, uint32_t FirmwareVersion,
+			 const SensorGattHandles_t *pHandles);
+
+/**
+ * @brief Remove the handles of a sensor (for example, when they didn't work).
+ */
+void SensorGattCache_Remove(const bt_addr_le_t *pAddr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SENSOR_GATT_CACHE_H__ */
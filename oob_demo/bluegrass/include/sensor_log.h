@@ -28,7 +28,6 @@ typedef struct SensorLogEvent {
 	uint32_t epoch;
 	uint16_t data;
 	uint8_t recordType;
-	uint8_t idLsb;
 } SensorLogEvent_t;
 
 typedef struct SensorLog SensorLog_t;
@@ -44,34 +43,80 @@ typedef struct SensorLog SensorLog_t;
 /* Global Function Prototypes                                                 */
 /******************************************************************************/
 /**
- * @brief Allocates a sensor log object from the heap.
+ * @brief Allocates a sensor log object from a dedicated memory slab
+ * (one block for each sensor in the largest table).
  *
- * @retval pointer to object
+ * @param Size is the number of events (limited to CONFIG_SENSOR_LOG_MAX_SIZE)
+ *
+ * @retval pointer to object, NULL if a block isn't available.
+ * A NULL log can be passed to the other functions (they do nothing).
  */
 SensorLog_t *SensorLog_Allocate(size_t Size);
 
 /**
- * @brief Free object (return memory to system heap).
- * @note Sensor log contains a pointer to an allocated buffer.
+ * @brief Free object (return block to slab).  NULL is ignored.
  */
 void SensorLog_Free(SensorLog_t *pLog);
 
 /**
- * @brief Add element to sensor log.  If log is full, then first element
- * is overwritten.
+ * @brief Add element to sensor log.  Events are packed (delta encoded).
+ * If log is full, then the oldest elements are removed.
  */
 void SensorLog_Add(SensorLog_t *pLog, SensorLogEvent_t *pEvent);
 
 /**
- * @brief Add sensor log to JSON message.
+ * @brief Add sensor log to JSON message (the newest events up to the
+ * size of the log).
  */
 void SensorLog_GenerateJson(SensorLog_t *pLog, JsonMsg_t *pMsg);
 
 /**
- * @brief Get the maximum number of entries in the log.
+ * @brief Add the newest events in the sensor log to JSON message
+ * (as eventLogAppend).
+ *
+ * @param Count is the number of newest events.  It is limited to the
+ * number of entries in the log.  The oldest of these are added
+ * (up to the size of the log).
+ *
+ * @retval number of events added
+ */
+size_t SensorLog_GenerateAppendJson(SensorLog_t *pLog, JsonMsg_t *pMsg,
+				    size_t Count);
+
+/**
+ * @brief Get an event from the log.  Events other than the newest are
+ * decoded starting from the oldest event.
+ *
+ * @param Age is 0 for the newest event, 1 for the one before it, ...
+ * @param pEvent is filled in with the decoded event
+ *
+ * @retval false if the log doesn't contain that many events
+ */
+bool SensorLog_GetRecent(SensorLog_t *pLog, size_t Age,
+			 SensorLogEvent_t *pEvent);
+
+/**
+ * @brief Get the newest events from the log (decoded in a single pass).
+ *
+ * @param Count is the maximum number of events
+ * @param pEvents is filled in newest first (must hold Count events)
+ *
+ * @retval number of events copied (limited to the number in the log)
+ */
+size_t SensorLog_GetRecentEvents(SensorLog_t *pLog, size_t Count,
+				 SensorLogEvent_t *pEvents);
+
+/**
+ * @brief Get the maximum number of entries in JSON generated from the log.
  */
 size_t SensorLog_GetSize(SensorLog_t *pLog);
 
+/**
+ * @brief Get the number of events in the log.  This can be larger than
+ * the size because events are packed.
+ */
+size_t SensorLog_GetNumberOfEntries(SensorLog_t *pLog);
+
 #ifdef __cplusplus
 }
 #endif
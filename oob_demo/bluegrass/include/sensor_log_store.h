@@ -0,0 +1,90 @@
+/**
+ * @file sensor_log_store.h
+ * @brief Sensor event logs are appended to files so that they can be
+ * restored after a reset.  Events are staged in RAM and written in batches
+ * to limit flash wear.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __SENSOR_LOG_STORE_H__
+#define __SENSOR_LOG_STORE_H__
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "sensor_log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************/
+/* Global Function Prototypes                                                 */
+/******************************************************************************/
+/**
+ * @brief Mount the file system and create the log directory.
+ *
+ * @retval negative error code, 0 on success
+ */
+int SensorLogStore_Initialize(void);
+
+/**
+ * @retval true if the file system is mounted and events can be stored
+ */
+bool SensorLogStore_IsAvailable(void);
+
+/**
+ * @brief Stage an event.  It is written to flash by SensorLogStore_Flush.
+ *
+ * @param Sequence is the sequence number of the event in the sensor log
+ *
+ * @retval false if the event was discarded (staging area full and
+ * the write rate limit hasn't elapsed).
+ */
+bool SensorLogStore_Add(const char *pAddrString, uint32_t Sequence,
+			const SensorLogEvent_t *pEvent);
+
+/**
+ * @brief Get the time that staged events should be written.
+ *
+ * @retval uptime in milliseconds, SENSOR_DEADLINE_NONE if nothing is staged
+ */
+int64_t SensorLogStore_GetFlushTime(void);
+
+/**
+ * @brief Write staged events (one append per sensor).
+ */
+void SensorLogStore_Flush(void);
+
+/**
+ * @brief Add the stored events (oldest first) that have a sequence number
+ * after *pSequence to a sensor log.
+ *
+ * @param pSequence is updated to the sequence number of the newest event
+ *
+ * @retval number of events added
+ */
+size_t SensorLogStore_Replay(const char *pAddrString, SensorLog_t *pLog,
+			     uint32_t *pSequence);
+
+/**
+ * @brief Delete the stored (and staged) events for a sensor.
+ */
+void SensorLogStore_Delete(const char *pAddrString);
+
+/**
+ * @brief Delete the stored (and staged) events for all sensors.
+ */
+void SensorLogStore_DeleteAll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SENSOR_LOG_STORE_H__ */
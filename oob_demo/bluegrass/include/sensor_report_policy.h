@@ -0,0 +1,66 @@
+/**
+ * @file sensor_report_policy.h
+ * @brief Decides when a sensor value (temperature) is published.  A value
+ * that is within the deadband of the last reported value is held until the
+ * heartbeat (maximum silence) expires.  A value outside the deadband is
+ * published after the minimum interval.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __SENSOR_REPORT_POLICY_H__
+#define __SENSOR_REPORT_POLICY_H__
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************/
+/* Global Constants, Macros and Type Definitions                              */
+/******************************************************************************/
+/* A zero value disables that part of the policy. */
+typedef struct SensorReportPolicy {
+	uint16_t deadbandCc; /* hundredths of a degree C */
+	uint8_t deadbandPercent; /* of the last reported value */
+	uint32_t minIntervalSeconds;
+	uint32_t heartbeatSeconds;
+} SensorReportPolicy_t;
+
+/* The value is held until a newer value is reported. */
+#define SENSOR_REPORT_POLICY_HOLD INT64_MAX
+
+/******************************************************************************/
+/* Global Function Prototypes                                                 */
+/******************************************************************************/
+/**
+ * @brief Get the policy defined by the project configuration.
+ */
+void SensorReportPolicy_GetDefault(SensorReportPolicy_t *p);
+
+/**
+ * @brief Determine when a value should be reported.
+ *
+ * @param Reported is the last value that was reported.
+ * @param Value is the newest value.
+ * @param ElapsedMs is the time since the last value was reported.
+ *
+ * @retval 0 if the value should be reported now, the number of
+ * milliseconds to wait, or SENSOR_REPORT_POLICY_HOLD
+ */
+int64_t SensorReportPolicy_Delay(const SensorReportPolicy_t *p,
+				 int32_t Reported, int32_t Value,
+				 int64_t ElapsedMs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SENSOR_REPORT_POLICY_H__ */
@@ -20,6 +20,8 @@
 
 #include "sensor_adv_format.h"
 #include "sensor_log.h"
+#include "sensor_deadline.h"
+#include "sensor_report_policy.h"
 #include "FrameworkIncludes.h"
 
 #ifdef __cplusplus
@@ -36,28 +38,76 @@ typedef struct SensorWhitelist {
 
 typedef struct SensorWhitelistMsg {
 	FwkMsgHeader_t header;
-	SensorWhitelist_t sensors[CONFIG_SENSOR_TABLE_SIZE];
+	SensorWhitelist_t sensors[CONFIG_SENSOR_TABLE_MAX_SIZE];
 	size_t sensorCount;
 } SensorWhitelistMsg_t;
 CHECK_FWK_MSG_SIZE(SensorWhitelistMsg_t);
 
+typedef struct SensorReportPolicyEntry {
+	char addrString[SENSOR_ADDR_STR_SIZE];
+	SensorReportPolicy_t policy;
+} SensorReportPolicyEntry_t;
+
+/* The complete set of policies (AWS replaces arrays). */
+typedef struct SensorReportPolicyMsg {
+	FwkMsgHeader_t header;
+	bool defaultFound; /** configured default is used if not found */
+	SensorReportPolicy_t defaultPolicy;
+	SensorReportPolicyEntry_t sensors[CONFIG_SENSOR_REPORT_POLICY_MAX_COUNT];
+	size_t sensorCount;
+} SensorReportPolicyMsg_t;
+CHECK_FWK_MSG_SIZE(SensorReportPolicyMsg_t);
+
+/* The gateway ID is the IMEI */
+#define SENSOR_LEASE_OWNER_SIZE 16
+#define SENSOR_LEASE_OWNER_LEN (SENSOR_LEASE_OWNER_SIZE - 1)
+
+/* The gateway that owns a sensor (from the sensor shadow). */
+typedef struct SensorLeaseMsg {
+	FwkMsgHeader_t header;
+	char addrString[SENSOR_ADDR_STR_SIZE];
+	char owner[SENSOR_LEASE_OWNER_SIZE];
+	int32_t rssi; /** of the owner when the lease was claimed */
+	uint32_t expires; /** epoch */
+} SensorLeaseMsg_t;
+CHECK_FWK_MSG_SIZE(SensorLeaseMsg_t);
+
 typedef struct SensorShadowInitMsg {
 	FwkMsgHeader_t header;
 	char addrString[SENSOR_ADDR_STR_SIZE];
 	SensorLogEvent_t events[CONFIG_SENSOR_LOG_MAX_SIZE];
 	size_t eventCount;
+	uint32_t sequence; /** eventLogSequence (0 if not in shadow) */
 } SensorShadowInitMsg_t;
 CHECK_FWK_MSG_SIZE(SensorShadowInitMsg_t);
 
-/* The same message is used for subscription request and acknowledgement */
+typedef struct SubscribeTopic {
+	size_t tableIndex;
+	bool success; /* used for ack only */
+	char topic[CONFIG_AWS_TOPIC_MAX_SIZE];
+} SubscribeTopic_t;
+
+/* The same message is used for subscription request and acknowledgement.
+ * All of the topics are sent to AWS in a single packet.
+ */
 typedef struct SubscribeMsg {
 	FwkMsgHeader_t header;
 	bool subscribe;
-	bool success; /* used for ack only */
-	size_t tableIndex;
-	size_t length;
-	char topic[CONFIG_AWS_TOPIC_MAX_SIZE];
+	size_t count;
+	SubscribeTopic_t topics[CONFIG_SENSOR_SUBSCRIBE_BATCH_MAX_SIZE];
 } SubscribeMsg_t;
+CHECK_FWK_MSG_SIZE(SubscribeMsg_t);
+
+/* Sent by the cloud task after a sensor shadow containing events
+ * has been published or after any sensor shadow publish fails.
+ */
+typedef struct SensorPublishAckMsg {
+	FwkMsgHeader_t header;
+	uint32_t sequence;
+	bool success;
+	char topic[CONFIG_AWS_TOPIC_MAX_SIZE];
+} SensorPublishAckMsg_t;
+CHECK_FWK_MSG_SIZE(SensorPublishAckMsg_t);
 
 typedef struct SensorCmdMsg {
 	FwkMsgHeader_t header;
@@ -67,8 +117,10 @@ typedef struct SensorCmdMsg {
 	bool dumpRequest;
 	bool resetRequest;
 	bool setEpochRequest;
+	bool readbackComplete; /** state was read after the command */
 	uint32_t configVersion;
 	uint32_t passkey;
+	uint32_t firmwareVersion; /** 0 if unknown */
 	char name[SENSOR_NAME_MAX_SIZE];
 	char addrString[SENSOR_ADDR_STR_SIZE];
 	size_t tableIndex;
@@ -85,7 +137,8 @@ typedef struct SensorCmdMsg {
  */
 
 /**
- * @brief Initializes sensor table.
+ * @brief Allocates and initializes sensor table.
+ * The capacity is read from non-volatile memory.
  */
 void SensorTable_Initialize(void);
 
@@ -106,14 +159,12 @@ void SensorTable_AdvertisementHandler(const bt_addr_le_t *pAddr, int8_t rssi,
 void SensorTable_ProcessWhitelistRequest(SensorWhitelistMsg_t *pMsg);
 
 /**
- * @brief Whitlisted sensors can subscribe to receive config data from AWs.
- *
- * @note This also handles un-subscription.
+ * @brief Set the policy used to decide when temperature events are published.
  */
-void SensorTable_SubscriptionHandler(void);
+void SensorTable_ProcessReportPolicyMsg(SensorReportPolicyMsg_t *pMsg);
 
 /**
- * @brief Update subscription status in sensor table,
+ * @brief Update subscription status in sensor table (for each topic),
  * If sensor has been seen, then update shadow.
  */
 void SensorTable_SubscriptionAckHandler(SubscribeMsg_t *pMsg);
@@ -139,14 +190,21 @@ DispatchResult_t SensorTable_RetryConfigRequest(SensorCmdMsg_t *pMsg);
 
 /**
  * @brief Inform the sensor table that a config request has completed.  It
- * will generate a dump request if the previous request came from AWS.
+ * will generate a dump request if the previous request came from AWS
+ * (unless the state was read back on the same connection).
  */
 void SensorTable_AckConfigRequest(SensorCmdMsg_t *pMsg);
 
+/**
+ * @retval command used to read the state of a sensor
+ */
+const char *SensorTable_GetQueryCmd(void);
+
 /**
  * @brief Format and forward dump response to AWS.
  */
-void SensorTable_CreateShadowFromDumpResponse(FwkBufMsg_t *pRsp,
+void SensorTable_CreateShadowFromDumpResponse(const char *pRsp,
+					      size_t Length,
 					      const char *pAddrStr);
 
 /**
@@ -160,11 +218,23 @@ void SensorTable_EnableGatewayShadowGeneration(void);
 void SensorTable_DisableGatewayShadowGeneration(void);
 
 /**
- * @brief If a sensor hasn't been seen (its ttl count is zero),
- * then remove it from the table.  Don't remove sensor
- * if it has been whitelisted by AWS.
+ * @brief Process the work whose deadline has expired.
+ *
+ * If a sensor hasn't been seen (for the ttl), then it is removed from the
+ * table.  Sensors that have been whitelisted by AWS aren't removed.
+ * Whitelisted sensors subscribe to receive config data from AWS
+ * (this also handles un-subscription).  After reset or disconnect
+ * the sensor shadow is requested (until it is received) to re-populate
+ * the event log.  The gateway shadow is sent if any sensor has been added,
+ * removed, or has a new event (at most once per interval).
  */
-void SensorTable_TimeToLiveHandler(void);
+void SensorTable_DeadlineHandler(void);
+
+/**
+ * @retval uptime (ms) of the next deadline, SENSOR_DEADLINE_NONE if nothing
+ * is scheduled.
+ */
+int64_t SensorTable_NextDeadline(void);
 
 /**
  * @brief When decommissioned from AWS all sensors must be disabled
@@ -179,22 +249,35 @@ void SensorTable_DecomissionHandler(void);
 void SensorTable_UnsubscribeAll(void);
 
 /**
- * @brief After reset or disconnect read shadow to re-populate event log.
- *
- * @note This also handles un-subscription.
+ * @brief After publishing a message to get accepted, then sensor table
+ * can be repopulated with what is in the shadow.
  */
-void SensorTable_GetAcceptedSubscriptionHandler(void);
+void SensorTable_ProcessShadowInitMsg(SensorShadowInitMsg_t *pMsg);
 
 /**
- * @brief Request sensor shadow until it is received.
+ * @brief Update the owner of a sensor.  Only the owner publishes
+ * the sensor shadow and configures the sensor.
  */
-void SensorTable_InitShadowHandler(void);
+void SensorTable_ProcessLeaseMsg(SensorLeaseMsg_t *pMsg);
 
 /**
- * @brief After publishing a message to get accepted, then sensor table
- * can be repopulated with what is in the shadow.
+ * @brief Events that have been published are no longer sent
+ * in the eventLogAppend array.
  */
-void SensorTable_ProcessShadowInitMsg(SensorShadowInitMsg_t *pMsg);
+void SensorTable_PublishAckHandler(SensorPublishAckMsg_t *pMsg);
+
+/**
+ * @brief The entire event log is sent the next time each sensor
+ * publishes its shadow.
+ */
+void SensorTable_RequestFullEventLog(void);
+
+/**
+ * @brief Queued sensor shadow updates were thrown away.  Every field is
+ * sent the next time each sensor publishes its shadow (and every config
+ * value the next time its config is read).
+ */
+void SensorTable_PublishDroppedHandler(void);
 
 #ifdef __cplusplus
 }
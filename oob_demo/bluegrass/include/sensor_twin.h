@@ -0,0 +1,72 @@
+/**
+ * @file sensor_twin.h
+ * @brief Cache of the configuration that a sensor reported in its last
+ * dump (query) response.  A hash of each value is kept (not the value).
+ * It is used to publish only the values that changed and to recognize
+ * set commands that wouldn't change anything.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __SENSOR_TWIN_H__
+#define __SENSOR_TWIN_H__
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************/
+/* Global Constants, Macros and Type Definitions                              */
+/******************************************************************************/
+typedef struct SensorTwin SensorTwin_t;
+
+/******************************************************************************/
+/* Global Function Prototypes                                                 */
+/******************************************************************************/
+/**
+ * @brief Allocates an (empty) twin from the heap.
+ *
+ * @retval pointer to object, NULL if memory isn't available or the twin
+ * is disabled
+ */
+SensorTwin_t *SensorTwin_Allocate(void);
+
+/**
+ * @brief Free object (return memory to system heap).
+ */
+void SensorTwin_Free(SensorTwin_t *p);
+
+/**
+ * @brief Forget all values (the next update reports everything).
+ */
+void SensorTwin_Clear(SensorTwin_t *p);
+
+/**
+ * @brief Update the twin with a dump response.  The pairs that changed
+ * are copied to pOut ("key":value separated by commas).  The jsonrpc, id,
+ * and result fields are not included.
+ *
+ * @retval length of pOut, 0 if nothing changed, negative error code if
+ * the response couldn't be parsed or pOut is too small
+ */
+int SensorTwin_Update(SensorTwin_t *p, const char *pRsp, char *pOut,
+		      size_t Size);
+
+/**
+ * @retval true if every parameter of a set command matches the twin
+ */
+bool SensorTwin_Matches(SensorTwin_t *p, const char *pCmd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SENSOR_TWIN_H__ */
@@ -19,6 +19,8 @@ extern "C" {
 #include "FrameworkIncludes.h"
 
 #include "sensor_log.h"
+#include "sensor_report_policy.h"
+#include "sensor_aggregate.h"
 
 /******************************************************************************/
 /* Global Constants, Macros and Type Definitions                              */
@@ -65,6 +67,13 @@ void ShadowBuilder_AddSigned32(JsonMsg_t *pJsonMsg, const char *restrict pKey,
 void ShadowBuilder_AddPair(JsonMsg_t *pJsonMsg, const char *restrict pKey,
 			   const char *restrict pValue, bool IsNotString);
 
+/**
+ * @brief Adds "pKey": ["owner", rssi, expires],
+ */
+void ShadowBuilder_AddLease(JsonMsg_t *pJsonMsg, const char *restrict pKey,
+			    const char *restrict pOwner, int32_t Rssi,
+			    uint32_t Expires);
+
 /**
  * @brief Adds a JSON version x.x.x
  *
@@ -101,6 +110,21 @@ void ShadowBuilder_AddSensorTableArrayEntry(JsonMsg_t *pJsonMsg,
 					    const char *restrict pAddrStr,
 					    uint32_t Epoch, bool Whitelisted);
 
+/**
+ * @brief Adds ["addr", deadbandCc, deadbandPercent, minIntervalSeconds,
+ * heartbeatSeconds], to JSON buffer
+ */
+void ShadowBuilder_AddReportPolicyArrayEntry(JsonMsg_t *pJsonMsg,
+					     const char *restrict pAddrStr,
+					     const SensorReportPolicy_t *p);
+
+/**
+ * @brief Adds ["addr", count, min, max, mean], to JSON buffer
+ */
+void ShadowBuilder_AddAggregateArrayEntry(JsonMsg_t *pJsonMsg,
+					  const char *restrict pAddrStr,
+					  const SensorAggregate_t *p);
+
 /**
  * @brief Adds "pKey": {
  *
@@ -27,6 +27,10 @@ LOG_MODULE_REGISTER(bluegrass);
 #define CONFIG_USE_SINGLE_AWS_TOPIC 0
 #endif
 
+BUILD_ASSERT(CONFIG_SENSOR_SUBSCRIBE_BATCH_MAX_SIZE <=
+		     AWS_SUBSCRIBE_LIST_MAX_SIZE,
+	     "Subscription batch too large");
+
 /******************************************************************************/
 /* Local Data Definitions                                                     */
 /******************************************************************************/
@@ -35,6 +39,8 @@ static bool subscribedToGetAccepted;
 static bool getShadowProcessed;
 static struct k_timer gatewayInitTimer;
 static FwkQueue_t *pMsgQueue;
+static BluegrassLatency_t latency[JSON_MSG_PRIORITY_COUNT];
+static uint32_t firstPublishMs;
 
 /******************************************************************************/
 /* Local Function Prototypes                                                  */
@@ -42,6 +48,9 @@ static FwkQueue_t *pMsgQueue;
 static void StartGatewayInitTimer(void);
 static void GatewayInitTimerCallbackIsr(struct k_timer *timer_id);
 static int GatewaySubscriptionHandler(void);
+static int SubscriptionHandler(SubscribeMsg_t *pMsg);
+static void SensorPublishAck(JsonMsg_t *pMsg, int Status);
+static void UpdateLatency(JsonMsg_t *pMsg);
 
 /******************************************************************************/
 /* Global Function Definitions                                                */
@@ -66,6 +75,17 @@ int Bluegrass_MsgHandler(FwkMsg_t *pMsg, bool *pFreeMsg)
 		rc = awsSendData(pJsonMsg->buffer, CONFIG_USE_SINGLE_AWS_TOPIC ?
 							   GATEWAY_TOPIC :
 							   pJsonMsg->topic);
+		if (pJsonMsg->sequence != 0 || rc != 0) {
+			SensorPublishAck(pJsonMsg, rc);
+		}
+		if (rc == 0) {
+			UpdateLatency(pJsonMsg);
+			if (firstPublishMs == 0 && pJsonMsg->sequence != 0) {
+				firstPublishMs = k_uptime_get_32();
+				LOG_INF("First sensor publish %u ms after boot",
+					firstPublishMs);
+			}
+		}
 	} break;
 
 	case FMC_GATEWAY_OUT: {
@@ -75,8 +95,7 @@ int Bluegrass_MsgHandler(FwkMsg_t *pMsg, bool *pFreeMsg)
 
 	case FMC_SUBSCRIBE: {
 		SubscribeMsg_t *pSubMsg = (SubscribeMsg_t *)pMsg;
-		rc = awsSubscribe(pSubMsg->topic, pSubMsg->subscribe);
-		pSubMsg->success = (rc == 0);
+		rc = SubscriptionHandler(pSubMsg);
 		FRAMEWORK_MSG_REPLY(pSubMsg, FMC_SUBSCRIBE_ACK);
 		*pFreeMsg = false;
 	} break;
@@ -112,6 +131,19 @@ void Bluegrass_DisconnectedCallback(void)
 					   FMC_AWS_DISCONNECTED);
 }
 
+const BluegrassLatency_t *Bluegrass_GetLatency(uint8_t Priority)
+{
+	if (Priority >= JSON_MSG_PRIORITY_COUNT) {
+		return NULL;
+	}
+	return &latency[Priority];
+}
+
+uint32_t Bluegrass_GetFirstPublishTime(void)
+{
+	return firstPublishMs;
+}
+
 /******************************************************************************/
 /* Local Function Definitions                                                 */
 /******************************************************************************/
@@ -151,6 +183,64 @@ static int GatewaySubscriptionHandler(void)
 	return rc;
 }
 
+static int SubscriptionHandler(SubscribeMsg_t *pMsg)
+{
+	uint8_t *topicList[CONFIG_SENSOR_SUBSCRIBE_BATCH_MAX_SIZE];
+	bool success[CONFIG_SENSOR_SUBSCRIBE_BATCH_MAX_SIZE];
+	size_t i;
+
+	if (pMsg->count > CONFIG_SENSOR_SUBSCRIBE_BATCH_MAX_SIZE) {
+		pMsg->count = CONFIG_SENSOR_SUBSCRIBE_BATCH_MAX_SIZE;
+	}
+
+	for (i = 0; i < pMsg->count; i++) {
+		topicList[i] = (uint8_t *)pMsg->topics[i].topic;
+	}
+
+	int rc = awsSubscribeList(topicList, pMsg->count, pMsg->subscribe,
+				  success);
+
+	for (i = 0; i < pMsg->count; i++) {
+		pMsg->topics[i].success = (rc == 0) && success[i];
+	}
+	return rc;
+}
+
+/* If the ack can't be sent, then the events will be sent again.
+ * Failures are always acked because the sensor table assumes that every
+ * field it publishes reaches AWS.
+ */
+static void SensorPublishAck(JsonMsg_t *pMsg, int Status)
+{
+	SensorPublishAckMsg_t *pAck =
+		BufferPool_Take(sizeof(SensorPublishAckMsg_t));
+	if (pAck == NULL) {
+		return;
+	}
+
+	pAck->header.msgCode = FMC_SENSOR_PUBLISH_ACK;
+	pAck->header.rxId = FWK_ID_SENSOR_TASK;
+	pAck->header.txId = FWK_ID_CLOUD;
+	pAck->sequence = pMsg->sequence;
+	pAck->success = (Status == 0);
+	memcpy(pAck->topic, pMsg->topic, CONFIG_AWS_TOPIC_MAX_SIZE);
+	FRAMEWORK_MSG_SEND(pAck);
+}
+
+static void UpdateLatency(JsonMsg_t *pMsg)
+{
+	if (pMsg->priority >= JSON_MSG_PRIORITY_COUNT) {
+		return;
+	}
+
+	BluegrassLatency_t *p = &latency[pMsg->priority];
+	uint32_t ms = k_uptime_get_32() - pMsg->timestamp;
+	p->count += 1;
+	p->totalMs += ms;
+	p->maxMs = MAX(p->maxMs, ms);
+	LOG_DBG("Priority %u publish latency %u ms", pMsg->priority, ms);
+}
+
 static void StartGatewayInitTimer(void)
 {
 	k_timer_start(&gatewayInitTimer, K_SECONDS(1), K_NO_WAIT);
@@ -0,0 +1,144 @@
+/**
+ * @file json_framer.c
+ * @brief
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <string.h>
+#include <errno.h>
+
+#include "json_framer.h"
+
+/******************************************************************************/
+/* Local Function Prototypes                                                  */
+/******************************************************************************/
+static void ResetState(JsonFramer_t *p);
+static const char *Scan(JsonFramer_t *p, const char *s, const char *pEnd);
+static const char *SkipString(JsonFramer_t *p, const char *s,
+			      const char *pEnd);
+
+/******************************************************************************/
+/* Global Function Definitions                                                */
+/******************************************************************************/
+void JsonFramer_Reset(JsonFramer_t *p, char *pBuffer, size_t Size)
+{
+	p->pBuffer = pBuffer;
+	p->size = Size;
+	ResetState(p);
+}
+
+int JsonFramer_Compute(JsonFramer_t *p, const char *pData, size_t Length,
+		       size_t *pUsed)
+{
+	const char *pEnd = pData + Length;
+	const char *s = pData;
+
+	/* The rest of an object that was too large is skipped so that none
+	 * of its inner objects are framed.
+	 */
+	if (p->discard) {
+		s = Scan(p, s, pEnd);
+		if (p->depth != 0) {
+			*pUsed = Length;
+			return 0;
+		}
+		p->discard = false;
+	}
+
+	if (p->depth == 0) {
+		s = memchr(s, '{', pEnd - s);
+		if (s == NULL) {
+			*pUsed = Length;
+			return 0;
+		}
+	}
+
+	/* The chunk is copied once it has been scanned. */
+	const char *pStart = s;
+	s = Scan(p, s, pEnd);
+	int result = (p->depth == 0) ? 1 : 0;
+
+	*pUsed = s - pData;
+	size_t n = s - pStart;
+	if ((p->length + n) > p->size) {
+		if (result == 1) {
+			ResetState(p);
+		} else {
+			p->length = 0;
+			p->discard = true;
+		}
+		return -ENOMEM;
+	}
+
+	memcpy(&p->pBuffer[p->length], pStart, n);
+	p->length += n;
+	return result;
+}
+
+/******************************************************************************/
+/* Local Function Definitions                                                 */
+/******************************************************************************/
+/* Only the structure of the object is tracked (values aren't parsed).
+ * Scanning stops at the end of the object.
+ */
+static const char *Scan(JsonFramer_t *p, const char *s, const char *pEnd)
+{
+	while (s < pEnd) {
+		if (p->inString) {
+			s = SkipString(p, s, pEnd);
+			continue;
+		}
+		char c = *s++;
+		if (c == '"') {
+			p->inString = true;
+		} else if (c == '{' || c == '[') {
+			p->depth += 1;
+		} else if (c == '}' || c == ']') {
+			p->depth -= 1;
+			if (p->depth == 0) {
+				break;
+			}
+		}
+	}
+	return s;
+}
+
+/* Strings are searched for their end (or an escape) instead of being
+ * processed a character at a time.
+ */
+static const char *SkipString(JsonFramer_t *p, const char *s,
+			      const char *pEnd)
+{
+	if (p->escape) {
+		p->escape = false;
+		return s + 1;
+	}
+
+	const char *pQuote = memchr(s, '"', pEnd - s);
+	const char *pLimit = (pQuote != NULL) ? pQuote : pEnd;
+	const char *pEscape = memchr(s, '\\', pLimit - s);
+	if (pEscape != NULL) {
+		p->escape = true;
+		return pEscape + 1;
+	}
+	if (pQuote != NULL) {
+		p->inString = false;
+		return pQuote + 1;
+	}
+	return pEnd;
+}
+
+static void ResetState(JsonFramer_t *p)
+{
+	p->length = 0;
+	p->depth = 0;
+	p->inString = false;
+	p->escape = false;
+	p->discard = false;
+}
@@ -0,0 +1,50 @@
+/**
+ * @file sensor_aggregate.c
+ * @brief
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr.h>
+#include <string.h>
+
+#include "sensor_aggregate.h"
+
+/******************************************************************************/
+/* Global Function Definitions                                                */
+/******************************************************************************/
+void SensorAggregate_Add(SensorAggregate_t *p, int32_t Value)
+{
+	if (p->count == 0) {
+		p->min = Value;
+		p->max = Value;
+	} else {
+		p->min = MIN(p->min, Value);
+		p->max = MAX(p->max, Value);
+	}
+	p->sum += Value;
+	p->count += 1;
+}
+
+int32_t SensorAggregate_Mean(const SensorAggregate_t *p)
+{
+	if (p->count == 0) {
+		return 0;
+	}
+	int64_t half = p->count / 2;
+	if (p->sum < 0) {
+		return (int32_t)((p->sum - half) / p->count);
+	} else {
+		return (int32_t)((p->sum + half) / p->count);
+	}
+}
+
+void SensorAggregate_Clear(SensorAggregate_t *p)
+{
+	memset(p, 0, sizeof(SensorAggregate_t));
+}
@@ -12,6 +12,10 @@
 /******************************************************************************/
 #include <string.h>
 
+#define JSMN_PARENT_LINKS
+#define JSMN_HEADER
+#include "jsmn.h"
+
 #include "sensor_cmd.h"
 
 /******************************************************************************/
@@ -22,6 +26,27 @@ static const char *ATTRIBUTES_THAT_REQUIRE_RESET[] = {
 	"passkey",    "activeMode",	     "useCodedPhy"
 };
 
+/* Each command is parsed into half of the shared token array. */
+#define MERGE_TOKENS (CONFIG_JSMN_NUMBER_OF_TOKENS / 2)
+
+#define PARAMS_LENGTH (sizeof("params") - 1)
+
+/******************************************************************************/
+/* Global                                                                     */
+/******************************************************************************/
+extern struct k_mutex jsmn_mutex;
+extern jsmn_parser jsmn;
+extern jsmntok_t tokens[CONFIG_JSMN_NUMBER_OF_TOKENS];
+
+/******************************************************************************/
+/* Local Function Prototypes                                                  */
+/******************************************************************************/
+static int FindParams(const char *pCmd, jsmntok_t *pTokens, int *pCount);
+static bool HasKey(const char *pCmd, jsmntok_t *pTokens, int Params,
+		   int Count, const char *pKey, int Length);
+static size_t Append(char *pOut, size_t Size, size_t Index, const char *pIn,
+		     size_t Length);
+
 /******************************************************************************/
 /* Global Data Definitions                                                    */
 /******************************************************************************/
@@ -61,3 +86,114 @@ bool SensorCmd_RequiresReset(char *pCmd)
 	}
 	return false;
 }
+
+size_t SensorCmd_MergeSet(const char *pOlder, const char *pNewer, char *pOut,
+			  size_t Size)
+{
+	size_t n = 0;
+	k_mutex_lock(&jsmn_mutex, K_FOREVER);
+
+	jsmntok_t *pOld = &tokens[0];
+	jsmntok_t *pNew = &tokens[MERGE_TOKENS];
+	int oldCount;
+	int newCount;
+	int oldParams = FindParams(pOlder, pOld, &oldCount);
+	int newParams = FindParams(pNewer, pNew, &newCount);
+	if (oldParams > 0 && newParams > 0) {
+		n = Append(pOut, Size, n, SENSOR_CMD_SET_PREFIX,
+			   strlen(SENSOR_CMD_SET_PREFIX));
+		n = Append(pOut, Size, n, "{", 1);
+
+		/* Keys are strings (the quotes aren't part of the token).
+		 * The value token follows the key.
+		 */
+		bool first = true;
+		int i;
+		for (i = oldParams + 1; i < oldCount; i++) {
+			if (pOld[i].start >= pOld[oldParams].end) {
+				break;
+			}
+			if (pOld[i].parent != oldParams ||
+			    HasKey(pNewer, pNew, newParams, newCount,
+				   &pOlder[pOld[i].start],
+				   pOld[i].end - pOld[i].start)) {
+				continue;
+			}
+			jsmntok_t *pValue = &pOld[i + 1];
+			int start = pOld[i].start - 1;
+			int end = pValue->end +
+				  ((pValue->type == JSMN_STRING) ? 1 : 0);
+			if (!first) {
+				n = Append(pOut, Size, n, ",", 1);
+			}
+			n = Append(pOut, Size, n, &pOlder[start], end - start);
+			first = false;
+		}
+
+		/* The newer object is copied without its opening brace. */
+		if (!first && pNew[newParams].size > 0) {
+			n = Append(pOut, Size, n, ",", 1);
+		}
+		n = Append(pOut, Size, n, &pNewer[pNew[newParams].start + 1],
+			   pNew[newParams].end - pNew[newParams].start - 1);
+		n = Append(pOut, Size, n, SENSOR_CMD_SUFFIX,
+			   strlen(SENSOR_CMD_SUFFIX));
+	}
+
+	k_mutex_unlock(&jsmn_mutex);
+	return (n < Size) ? n : 0;
+}
+
+/******************************************************************************/
+/* Local Function Definitions                                                 */
+/******************************************************************************/
+/* Returns the index of the params object of a set command (0 if not found). */
+static int FindParams(const char *pCmd, jsmntok_t *pTokens, int *pCount)
+{
+	jsmn_init(&jsmn);
+	*pCount = jsmn_parse(&jsmn, pCmd, strlen(pCmd), pTokens, MERGE_TOKENS);
+	if (*pCount < 1 || pTokens[0].type != JSMN_OBJECT) {
+		return 0;
+	}
+
+	int i;
+	for (i = 1; (i + 1) < *pCount; i++) {
+		if (pTokens[i].type == JSMN_STRING && pTokens[i].parent == 0 &&
+		    (pTokens[i].end - pTokens[i].start) == PARAMS_LENGTH &&
+		    strncmp(&pCmd[pTokens[i].start], "params",
+			    PARAMS_LENGTH) == 0) {
+			if (pTokens[i + 1].type != JSMN_OBJECT) {
+				return 0;
+			}
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+static bool HasKey(const char *pCmd, jsmntok_t *pTokens, int Params,
+		   int Count, const char *pKey, int Length)
+{
+	int i;
+	for (i = Params + 1; i < Count; i++) {
+		if (pTokens[i].start >= pTokens[Params].end) {
+			break;
+		}
+		if (pTokens[i].parent == Params &&
+		    (pTokens[i].end - pTokens[i].start) == Length &&
+		    strncmp(&pCmd[pTokens[i].start], pKey, Length) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t Append(char *pOut, size_t Size, size_t Index, const char *pIn,
+		     size_t Length)
+{
+	if ((Index + Length) < Size) {
+		memcpy(&pOut[Index], pIn, Length);
+		pOut[Index + Length] = 0;
+	}
+	return Index + Length;
+}
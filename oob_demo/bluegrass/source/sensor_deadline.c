@@ -0,0 +1,195 @@
+/**
+ * @file sensor_deadline.c
+ * @brief
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(sensor_deadline);
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr.h>
+
+#include "FrameworkIncludes.h"
+#include "sensor_deadline.h"
+
+/******************************************************************************/
+/* Local Constant, Macro and Type Definitions                                 */
+/******************************************************************************/
+#define NOT_QUEUED UINT16_MAX
+
+/* The heap contains keys ordered by deadline.  The position of each key
+ * in the heap is tracked so that deadlines can be changed (or cancelled)
+ * without searching.
+ */
+struct SensorDeadline {
+	size_t size;
+	size_t count;
+	uint16_t *pHeap;
+	uint16_t *pPosition;
+	int64_t *pTime;
+};
+
+/******************************************************************************/
+/* Local Function Prototypes                                                  */
+/******************************************************************************/
+static void Swap(SensorDeadline_t *p, size_t A, size_t B);
+static bool Earlier(SensorDeadline_t *p, size_t A, size_t B);
+static void SiftUp(SensorDeadline_t *p, size_t Index);
+static void SiftDown(SensorDeadline_t *p, size_t Index);
+
+/******************************************************************************/
+/* Global Function Definitions                                                */
+/******************************************************************************/
+SensorDeadline_t *SensorDeadline_Allocate(size_t Size)
+{
+	FRAMEWORK_ASSERT(Size < NOT_QUEUED);
+	if (Size == 0 || Size >= NOT_QUEUED) {
+		return NULL;
+	}
+
+	SensorDeadline_t *p = k_calloc(1, sizeof(SensorDeadline_t));
+	if (p == NULL) {
+		return NULL;
+	}
+	p->size = Size;
+	p->pTime = k_calloc(Size, sizeof(int64_t));
+	p->pHeap = k_calloc(Size, sizeof(uint16_t));
+	p->pPosition = k_malloc(Size * sizeof(uint16_t));
+	if (p->pTime == NULL || p->pHeap == NULL || p->pPosition == NULL) {
+		LOG_ERR("Unable to allocate deadline queue");
+		SensorDeadline_Free(p);
+		return NULL;
+	}
+	memset(p->pPosition, 0xFF, Size * sizeof(uint16_t));
+	return p;
+}
+
+void SensorDeadline_Free(SensorDeadline_t *p)
+{
+	if (p == NULL) {
+		return;
+	}
+	k_free(p->pTime);
+	k_free(p->pHeap);
+	k_free(p->pPosition);
+	k_free(p);
+}
+
+void SensorDeadline_Schedule(SensorDeadline_t *p, size_t Key, int64_t Time)
+{
+	if (p == NULL || Key >= p->size) {
+		return;
+	}
+
+	p->pTime[Key] = Time;
+	size_t i = p->pPosition[Key];
+	if (i == NOT_QUEUED) {
+		i = p->count;
+		p->pHeap[i] = Key;
+		p->pPosition[Key] = i;
+		p->count += 1;
+	}
+	SiftUp(p, i);
+	SiftDown(p, p->pPosition[Key]);
+}
+
+void SensorDeadline_Cancel(SensorDeadline_t *p, size_t Key)
+{
+	if (!SensorDeadline_IsPending(p, Key)) {
+		return;
+	}
+
+	size_t i = p->pPosition[Key];
+	size_t last = p->count - 1;
+	Swap(p, i, last);
+	p->count -= 1;
+	p->pPosition[Key] = NOT_QUEUED;
+	if (i < p->count) {
+		uint16_t moved = p->pHeap[i];
+		SiftUp(p, i);
+		SiftDown(p, p->pPosition[moved]);
+	}
+}
+
+bool SensorDeadline_IsPending(SensorDeadline_t *p, size_t Key)
+{
+	if (p == NULL || Key >= p->size) {
+		return false;
+	}
+	return (p->pPosition[Key] != NOT_QUEUED);
+}
+
+int64_t SensorDeadline_Next(SensorDeadline_t *p)
+{
+	if (p == NULL || p->count == 0) {
+		return SENSOR_DEADLINE_NONE;
+	}
+	return p->pTime[p->pHeap[0]];
+}
+
+bool SensorDeadline_PopExpired(SensorDeadline_t *p, int64_t Now,
+			       size_t *pKey)
+{
+	if (SensorDeadline_Next(p) > Now) {
+		return false;
+	}
+	*pKey = p->pHeap[0];
+	SensorDeadline_Cancel(p, *pKey);
+	return true;
+}
+
+/******************************************************************************/
+/* Local Function Definitions                                                 */
+/******************************************************************************/
+static void Swap(SensorDeadline_t *p, size_t A, size_t B)
+{
+	uint16_t key = p->pHeap[A];
+	p->pHeap[A] = p->pHeap[B];
+	p->pHeap[B] = key;
+	p->pPosition[p->pHeap[A]] = A;
+	p->pPosition[p->pHeap[B]] = B;
+}
+
+static bool Earlier(SensorDeadline_t *p, size_t A, size_t B)
+{
+	return (p->pTime[p->pHeap[A]] < p->pTime[p->pHeap[B]]);
+}
+
+static void SiftUp(SensorDeadline_t *p, size_t Index)
+{
+	while (Index > 0) {
+		size_t parent = (Index - 1) / 2;
+		if (!Earlier(p, Index, parent)) {
+			break;
+		}
+		Swap(p, Index, parent);
+		Index = parent;
+	}
+}
+
+static void SiftDown(SensorDeadline_t *p, size_t Index)
+{
+	while (true) {
+		size_t left = (2 * Index) + 1;
+		size_t right = left + 1;
+		size_t earliest = Index;
+		if (left < p->count && Earlier(p, left, earliest)) {
+			earliest = left;
+		}
+		if (right < p->count && Earlier(p, right, earliest)) {
+			earliest = right;
+		}
+		if (earliest == Index) {
+			break;
+		}
+		Swap(p, Index, earliest);
+		Index = earliest;
+	}
+}
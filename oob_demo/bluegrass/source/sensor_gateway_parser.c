@@ -43,8 +43,26 @@ LOG_MODULE_REGISTER(sensor_gateway_parser);
 #define RECORD_TYPE_INDEX 1
 #define EVENT_DATA_INDEX 3
 
+/* ["*" or "addrString", deadbandCc, deadbandPercent, minInterval, heartbeat] */
+#define POLICY_ARRAY_SIZE 5
+#define POLICY_NAME_INDEX 1
+#define POLICY_DEADBAND_INDEX 2
+#define POLICY_PERCENT_INDEX 3
+#define POLICY_INTERVAL_INDEX 4
+#define POLICY_HEARTBEAT_INDEX 5
+#define POLICY_DEFAULT_NAME "*"
+
+/* "lease": ["gatewayId", rssi, expiration epoch] */
+#define LEASE_ARRAY_SIZE 3
+#define LEASE_OWNER_INDEX 1
+#define LEASE_RSSI_INDEX 2
+#define LEASE_EXPIRES_INDEX 3
+
 #define GATEWAY_TOPIC_SUB_STR "deviceId-"
 #define GET_ACCEPTED_SUB_STR "/get/accepted"
+#define LEASE_SUB_STR "/name/lease/"
+#define GET_REJECTED_SUB_STR "/get/rejected"
+#define SHADOW_NOT_FOUND 404
 #define SENSOR_SHADOW_PREFIX "$aws/things/"
 
 #define MAX_CONVERSION_STR_SIZE 11
@@ -65,6 +83,7 @@ static int nextParent;
 static int jsonIndex;
 
 static bool getAcceptedTopic;
+static bool leaseTopic;
 
 /******************************************************************************/
 /* Local Function Prototypes                                                  */
@@ -72,10 +91,14 @@ static bool getAcceptedTopic;
 static void JsonParse(const char *pJson);
 static bool JsonValid(void);
 static void GatewayParser(const char *pTopic, const char *pJson);
+static void ReportPolicyParser(const char *pTopic, const char *pJson);
 static void SensorParser(const char *pTopic, const char *pJson);
 static void SensorDeltaParser(const char *pTopic, const char *pJson);
+static void SensorLeaseParser(const char *pTopic, const char *pJson);
 static void SensorEventLogParser(const char *pTopic, const char *pJson);
-static void ParseEventArray(const char *pTopic, const char *pJson);
+static void ParseEventArray(SensorShadowInitMsg_t *pMsg, const char *pJson);
+static void AddShadowEvent(SensorShadowInitMsg_t *pMsg,
+			   const SensorLogEvent_t *pEvent);
 static void FotaParser(const char *pTopic, const char *pJson,
 		       enum fota_image_type Type);
 static void FotaHostParser(const char *pTopic, const char *pJson);
@@ -86,10 +109,13 @@ static int FindType(const char *pJson, const char *s, jsmntype_t Type,
 		    int Parent);
 
 static void ParseArray(const char *pJson, int ExpectedSensors);
+static void ParsePolicyArray(const char *pJson, int ExpectedPolicies);
+static bool PolicyEntryValid(size_t Index);
 
 static jsmntok_t *FindState(const char *pJson);
 static bool FindConfigVersion(const char *pJson, uint32_t *pVersion);
 static uint32_t ConvertUint(const char *pJson, int Index);
+static int32_t ConvertInt(const char *pJson, int Index);
 static uint32_t ConvertHex(const char *pJson, int Index);
 
 /******************************************************************************/
@@ -106,8 +132,10 @@ void SensorGatewayParser(const char *pTopic, const char *pJson)
 	}
 
 	getAcceptedTopic = strstr(pTopic, GET_ACCEPTED_SUB_STR) != NULL;
+	leaseTopic = strstr(pTopic, LEASE_SUB_STR) != NULL;
 	if (strstr(pTopic, GATEWAY_TOPIC_SUB_STR) != NULL) {
 		GatewayParser(pTopic, pJson);
+		ReportPolicyParser(pTopic, pJson);
 		FotaParser(pTopic, pJson, APP_IMAGE_TYPE);
 		FotaParser(pTopic, pJson, MODEM_IMAGE_TYPE);
 		FotaHostParser(pTopic, pJson);
@@ -186,6 +214,26 @@ static void GatewayParser(const char *pTopic, const char *pJson)
 	}
 }
 
+/**
+ * @brief Find {"state": {"bt510": {"reportPolicy": in the same locations
+ * as the sensor list.  The policy isn't changed if the array isn't present.
+ */
+static void ReportPolicyParser(const char *pTopic, const char *pJson)
+{
+	jsonIndex = 1;
+	nextParent = 0;
+	FindType(pJson, "state", JSMN_OBJECT, nextParent);
+	if (getAcceptedTopic) {
+		FindType(pJson, "reported", JSMN_OBJECT, nextParent);
+	}
+	FindType(pJson, "bt510", JSMN_OBJECT, nextParent);
+	FindType(pJson, "reportPolicy", JSMN_ARRAY, nextParent);
+
+	if (jsonIndex != 0) {
+		ParsePolicyArray(pJson, tokens[jsonIndex - 1].size);
+	}
+}
+
 static void UnsubscribeToGetAcceptedHandler(void)
 {
 	/* Once this has been processed (after reset) we can unsubscribe. */
@@ -298,9 +346,12 @@ static void FotaBlockSizeParser(const char *pTopic, const char *pJson)
 	}
 }
 
+/* The lease is in a named shadow that only the gateways write. */
 static void SensorParser(const char *pTopic, const char *pJson)
 {
-	if (getAcceptedTopic) {
+	if (leaseTopic) {
+		SensorLeaseParser(pTopic, pJson);
+	} else if (getAcceptedTopic) {
 		SensorEventLogParser(pTopic, pJson);
 	} else {
 		SensorDeltaParser(pTopic, pJson);
@@ -346,18 +397,115 @@ static void SensorDeltaParser(const char *pTopic, const char *pJson)
 	}
 }
 
+/**
+ * @brief The gateway that owns (publishes) a sensor is chosen using a lease
+ * in the reported section of the lease shadow of the sensor
+ * ($aws/things/addr/shadow/name/lease).  It is read after a reset (get
+ * accepted) and received when any gateway claims it (update accepted).
+ * The get is rejected (not found) when no gateway has claimed the sensor;
+ * the lease is then empty.
+ * {"state":{"reported":{"lease":
+ */
+static void SensorLeaseParser(const char *pTopic, const char *pJson)
+{
+	int i = 0;
+	jsonIndex = 1;
+	nextParent = 0;
+	if (strstr(pTopic, GET_REJECTED_SUB_STR) != NULL) {
+		int location = FindType(pJson, "code", JSMN_PRIMITIVE,
+					nextParent);
+		if (location <= 0 ||
+		    ConvertUint(pJson, location + 1) != SHADOW_NOT_FOUND) {
+			return;
+		}
+	} else {
+		FindType(pJson, "state", JSMN_OBJECT, nextParent);
+		FindType(pJson, "reported", JSMN_OBJECT, nextParent);
+		FindType(pJson, "lease", JSMN_ARRAY, nextParent);
+		if (jsonIndex == 0) {
+			return;
+		}
+
+		i = jsonIndex - 1;
+		if ((tokens[i].size != LEASE_ARRAY_SIZE) ||
+		    ((i + LEASE_ARRAY_SIZE) >= tokensFound) ||
+		    (tokens[i + LEASE_OWNER_INDEX].type != JSMN_STRING) ||
+		    (tokens[i + LEASE_RSSI_INDEX].type != JSMN_PRIMITIVE) ||
+		    (tokens[i + LEASE_EXPIRES_INDEX].type != JSMN_PRIMITIVE)) {
+			LOG_ERR("Lease parsing error");
+			return;
+		}
+	}
+
+	SensorLeaseMsg_t *pMsg = BufferPool_Take(sizeof(SensorLeaseMsg_t));
+	if (pMsg == NULL) {
+		return;
+	}
+
+	pMsg->header.msgCode = FMC_SENSOR_LEASE;
+	pMsg->header.rxId = FWK_ID_SENSOR_TASK;
+	memcpy(pMsg->addrString, pTopic + strlen(SENSOR_SHADOW_PREFIX),
+	       SENSOR_ADDR_STR_LEN);
+	if (i != 0) {
+		const jsmntok_t *pOwner = &tokens[i + LEASE_OWNER_INDEX];
+		strncpy(pMsg->owner, &pJson[pOwner->start],
+			MIN(pOwner->end - pOwner->start,
+			    SENSOR_LEASE_OWNER_LEN));
+		pMsg->rssi = ConvertInt(pJson, i + LEASE_RSSI_INDEX);
+		pMsg->expires = ConvertUint(pJson, i + LEASE_EXPIRES_INDEX);
+	} else {
+		pMsg->owner[0] = 0;
+		pMsg->rssi = 0;
+		pMsg->expires = 0;
+	}
+	FRAMEWORK_MSG_SEND(pMsg);
+}
+
+/* If the event log isn't found a message still needs to be sent. */
 static void SensorEventLogParser(const char *pTopic, const char *pJson)
 {
+	SensorShadowInitMsg_t *pMsg =
+		BufferPool_Take(sizeof(SensorShadowInitMsg_t));
+	if (pMsg == NULL) {
+		return;
+	}
+
 	jsonIndex = 1;
 	nextParent = 0;
 	/* Now try to find {"state":{"reported": ... "eventLog":
 	 * Parents are required because shadow contains timestamps
-	 * ("eventLog" wont be unique). */
+	 * ("eventLog" wont be unique).
+	 * Events published since the last full log are in eventLogAppend.
+	 * The keys can be in any order so each search starts at reported.
+	 */
 	FindType(pJson, "state", JSMN_OBJECT, nextParent);
 	FindType(pJson, "reported", JSMN_OBJECT, nextParent);
-	FindType(pJson, "eventLog", JSMN_ARRAY, nextParent);
+	int reported = (jsonIndex == 0) ? 0 : nextParent;
+	if (reported > 0) {
+		FindType(pJson, "eventLog", JSMN_ARRAY, reported);
+		ParseEventArray(pMsg, pJson);
+
+		jsonIndex = reported + 1;
+		FindType(pJson, "eventLogAppend", JSMN_ARRAY, reported);
+		ParseEventArray(pMsg, pJson);
+
+		jsonIndex = reported + 1;
+		int location = FindType(pJson, "eventLogSequence",
+					JSMN_PRIMITIVE, reported);
+		if (location > 0) {
+			pMsg->sequence = ConvertUint(pJson, location + 1);
+		}
+	} else {
+		LOG_DBG("Could not find event log");
+	}
 
-	ParseEventArray(pTopic, pJson);
+	memcpy(pMsg->addrString, pTopic + strlen(SENSOR_SHADOW_PREFIX),
+	       SENSOR_ADDR_STR_LEN);
+	pMsg->header.msgCode = FMC_SENSOR_SHADOW_INIT;
+	pMsg->header.rxId = FWK_ID_SENSOR_TASK;
+	LOG_INF("Processed %d sensor events in shadow (sequence %u)",
+		pMsg->eventCount, pMsg->sequence);
+	FRAMEWORK_MSG_SEND(pMsg);
 }
 
 /**
@@ -412,7 +560,7 @@ static void ParseArray(const char *pJson, int ExpectedSensors)
 		return;
 	}
 
-	size_t maxSensors = MIN(ExpectedSensors, CONFIG_SENSOR_TABLE_SIZE);
+	size_t maxSensors = MIN(ExpectedSensors, CONFIG_SENSOR_TABLE_MAX_SIZE);
 	int sensorsFound = 0;
 	size_t i = jsonIndex;
 	while (((i + CHILD_ARRAY_SIZE) < tokensFound) &&
@@ -453,27 +601,98 @@ static void ParseArray(const char *pJson, int ExpectedSensors)
 		sensorsFound, ExpectedSensors);
 }
 
-static void ParseEventArray(const char *pTopic, const char *pJson)
+/**
+ * @brief Parse the elements of the anonymous policy array.
+ * ["*" or "addrString", deadbandCc, deadbandPercent, minIntervalSeconds,
+ *  heartbeatSeconds]
+ */
+static void ParsePolicyArray(const char *pJson, int ExpectedPolicies)
 {
-	SensorShadowInitMsg_t *pMsg =
-		BufferPool_Take(sizeof(SensorShadowInitMsg_t));
+	SensorReportPolicyMsg_t *pMsg =
+		BufferPool_Take(sizeof(SensorReportPolicyMsg_t));
 	if (pMsg == NULL) {
 		return;
 	}
 
-	/* If the event log isn't found a message still needs to be sent. */
-	int expectedLogs = tokens[jsonIndex - 1].size;
-	int maxLogs = 0;
+	int policiesFound = 0;
+	size_t i = jsonIndex;
+	while (((i + POLICY_ARRAY_SIZE) < tokensFound) &&
+	       (policiesFound < ExpectedPolicies)) {
+		if (!PolicyEntryValid(i)) {
+			LOG_ERR("Report policy parsing error");
+			break;
+		}
+		SensorReportPolicy_t policy = {
+			.deadbandCc = MIN(ConvertUint(pJson,
+						      i + POLICY_DEADBAND_INDEX),
+					  UINT16_MAX),
+			.deadbandPercent = MIN(
+				ConvertUint(pJson, i + POLICY_PERCENT_INDEX),
+				100),
+			.minIntervalSeconds =
+				ConvertUint(pJson, i + POLICY_INTERVAL_INDEX),
+			.heartbeatSeconds =
+				ConvertUint(pJson, i + POLICY_HEARTBEAT_INDEX)
+		};
+		const jsmntok_t *pName = &tokens[i + POLICY_NAME_INDEX];
+		int nameLength = pName->end - pName->start;
+		if (nameLength == strlen(POLICY_DEFAULT_NAME) &&
+		    strncmp(&pJson[pName->start], POLICY_DEFAULT_NAME,
+			    nameLength) == 0) {
+			pMsg->defaultFound = true;
+			pMsg->defaultPolicy = policy;
+		} else if (pMsg->sensorCount <
+			   CONFIG_SENSOR_REPORT_POLICY_MAX_COUNT) {
+			SensorReportPolicyEntry_t *p =
+				&pMsg->sensors[pMsg->sensorCount];
+			strncpy(p->addrString, &pJson[pName->start],
+				MIN(nameLength, SENSOR_ADDR_STR_LEN));
+			p->policy = policy;
+			pMsg->sensorCount += 1;
+		} else {
+			LOG_WRN("Too many report policies");
+		}
+		policiesFound += 1;
+		i += POLICY_ARRAY_SIZE + 1;
+	}
+
+	pMsg->header.msgCode = FMC_REPORT_POLICY;
+	pMsg->header.rxId = FWK_ID_SENSOR_TASK;
+	FRAMEWORK_MSG_SEND(pMsg);
+
+	LOG_INF("Processed %d of %d report policies from AWS", policiesFound,
+		ExpectedPolicies);
+}
+
+static bool PolicyEntryValid(size_t Index)
+{
+	size_t i;
+	if ((tokens[Index].type != JSMN_ARRAY) ||
+	    (tokens[Index].size != POLICY_ARRAY_SIZE) ||
+	    (tokens[Index + POLICY_NAME_INDEX].type != JSMN_STRING)) {
+		return false;
+	}
+	for (i = POLICY_DEADBAND_INDEX; i <= POLICY_HEARTBEAT_INDEX; i++) {
+		if ((tokens[Index + i].type != JSMN_PRIMITIVE) ||
+		    (tokens[Index + i].size != JSMN_NO_CHILDREN)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* The array at jsonIndex is added to the events in the message. */
+static void ParseEventArray(SensorShadowInitMsg_t *pMsg, const char *pJson)
+{
 	if (jsonIndex == 0) {
-		LOG_DBG("Could not find event log");
-	} else {
-		maxLogs = MIN(expectedLogs, CONFIG_SENSOR_LOG_MAX_SIZE);
+		return;
 	}
 
 	/* 1st and 3rd items are hex. {"eventLog":[["01",466280,"0899"]] */
+	int expectedLogs = tokens[jsonIndex - 1].size;
 	size_t i = jsonIndex;
 	size_t j = 0;
-	while (((i + CHILD_ARRAY_SIZE) < tokensFound) && (j < maxLogs)) {
+	while (((i + CHILD_ARRAY_SIZE) < tokensFound) && (j < expectedLogs)) {
 		if ((tokens[i + CHILD_ARRAY_INDEX].type == JSMN_ARRAY) &&
 		    (tokens[i + CHILD_ARRAY_INDEX].size == CHILD_ARRAY_SIZE) &&
 		    (tokens[i + RECORD_TYPE_INDEX].type == JSMN_STRING) &&
@@ -483,14 +702,14 @@ static void ParseEventArray(const char *pTopic, const char *pJson)
 		    (tokens[i + EVENT_DATA_INDEX].type == JSMN_STRING) &&
 		    (tokens[i + EVENT_DATA_INDEX].size == JSMN_NO_CHILDREN)) {
 			LOG_DBG("Found array at %d", i);
-			pMsg->events[j].recordType =
+			SensorLogEvent_t event;
+			event.recordType =
 				ConvertHex(pJson, i + RECORD_TYPE_INDEX);
-			pMsg->events[j].epoch =
-				ConvertUint(pJson, i + ARRAY_EPOCH_INDEX);
-			pMsg->events[j].data =
-				ConvertHex(pJson, i + EVENT_DATA_INDEX);
-			LOG_DBG("%u %x,%d,%x", j, pMsg->events[j].recordType,
-				pMsg->events[j].epoch, pMsg->events[j].data);
+			event.epoch = ConvertUint(pJson, i + ARRAY_EPOCH_INDEX);
+			event.data = ConvertHex(pJson, i + EVENT_DATA_INDEX);
+			LOG_DBG("%u %x,%d,%x", j, event.recordType, event.epoch,
+				event.data);
+			AddShadowEvent(pMsg, &event);
 			j += 1;
 			i += CHILD_ARRAY_SIZE + 1;
 		} else {
@@ -498,15 +717,30 @@ static void ParseEventArray(const char *pTopic, const char *pJson)
 			break;
 		}
 	}
+}
 
-	pMsg->eventCount = j;
-	memcpy(pMsg->addrString, pTopic + strlen(SENSOR_SHADOW_PREFIX),
-	       SENSOR_ADDR_STR_LEN);
-	pMsg->header.msgCode = FMC_SENSOR_SHADOW_INIT;
-	pMsg->header.rxId = FWK_ID_SENSOR_TASK;
-	LOG_INF("Processed %d of %d sensor events in shadow", pMsg->eventCount,
-		expectedLogs);
-	FRAMEWORK_MSG_SEND(pMsg);
+/* Events are oldest first.  An append can repeat events in the full log
+ * if an update was lost.  When the message is full the oldest is dropped.
+ */
+static void AddShadowEvent(SensorShadowInitMsg_t *pMsg,
+			   const SensorLogEvent_t *pEvent)
+{
+	size_t i;
+	for (i = 0; i < pMsg->eventCount; i++) {
+		if (pMsg->events[i].epoch == pEvent->epoch &&
+		    pMsg->events[i].data == pEvent->data &&
+		    pMsg->events[i].recordType == pEvent->recordType) {
+			return;
+		}
+	}
+
+	if (pMsg->eventCount == CONFIG_SENSOR_LOG_MAX_SIZE) {
+		memmove(&pMsg->events[0], &pMsg->events[1],
+			sizeof(SensorLogEvent_t) * (pMsg->eventCount - 1));
+		pMsg->eventCount -= 1;
+	}
+	pMsg->events[pMsg->eventCount] = *pEvent;
+	pMsg->eventCount += 1;
 }
 
 /**
@@ -554,6 +788,16 @@ static uint32_t ConvertUint(const char *pJson, int Index)
 	return strtoul(str, NULL, 10);
 }
 
+static int32_t ConvertInt(const char *pJson, int Index)
+{
+	char str[MAX_CONVERSION_STR_SIZE];
+	int length = tokens[Index].end - tokens[Index].start;
+	memset(str, 0, sizeof(str));
+	memcpy(str, &pJson[tokens[Index].start],
+	       MIN(length, MAX_CONVERSION_STR_LEN));
+	return strtol(str, NULL, 10);
+}
+
 static uint32_t ConvertHex(const char *pJson, int Index)
 {
 	char str[MAX_CONVERSION_STR_SIZE];
@@ -0,0 +1,123 @@
+/**
+ * @file sensor_gatt_cache.c
+ * @brief
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(sensor_gatt_cache);
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr.h>
+#include <string.h>
+
+#include "sensor_gatt_cache.h"
+
+/******************************************************************************/
+/* Local Constant, Macro and Type Definitions                                 */
+/******************************************************************************/
+#ifndef CONFIG_SENSOR_GATT_CACHE_SIZE
+#define CONFIG_SENSOR_GATT_CACHE_SIZE 16
+#endif
+
+typedef struct SensorGattCacheEntry {
+	bt_addr_le_t addr;
+	uint32_t firmwareVersion;
+	uint32_t lastUse; /* 0 if entry is empty */
+	SensorGattHandles_t handles;
+} SensorGattCacheEntry_t;
+
+/******************************************************************************/
+/* Local Data Definitions                                                     */
+/******************************************************************************/
+#if CONFIG_SENSOR_GATT_CACHE_SIZE > 0
+static SensorGattCacheEntry_t cache[CONFIG_SENSOR_GATT_CACHE_SIZE];
+#else
+static SensorGattCacheEntry_t cache[1];
+#endif
+static uint32_t useCount;
+
+/******************************************************************************/
+/* Local Function Prototypes                                                  */
+/******************************************************************************/
+static SensorGattCacheEntry_t *FindEntry(const bt_addr_le_t *pAddr);
+
+/******************************************************************************/
+/* Global Function Definitions                                                */
+/******************************************************************************/
+bool SensorGattCache_Find(const bt_addr_le_t *pAddr, uint32_t FirmwareVersion,
+			  SensorGattHandles_t *pHandles)
+{
+	SensorGattCacheEntry_t *p = FindEntry(pAddr);
+	if (p == NULL || FirmwareVersion == 0) {
+		return false;
+	}
+
+	/* The handles can change when the firmware is updated. */
+	if (p->firmwareVersion != FirmwareVersion) {
+		p->lastUse = 0;
+		return false;
+	}
+
+	useCount += 1;
+	p->lastUse = useCount;
+	*pHandles = p->handles;
+	return true;
+}
+
+void SensorGattCache_Add(const bt_addr_le_t *pAddr, uint32_t FirmwareVersion,
+			 const SensorGattHandles_t *pHandles)
+{
+	if (CONFIG_SENSOR_GATT_CACHE_SIZE == 0 || FirmwareVersion == 0) {
+		return;
+	}
+
+	SensorGattCacheEntry_t *p = FindEntry(pAddr);
+	if (p == NULL) {
+		/* Replace the least recently used (or an empty) entry */
+		p = &cache[0];
+		size_t i;
+		for (i = 1; i < CONFIG_SENSOR_GATT_CACHE_SIZE; i++) {
+			if (cache[i].lastUse < p->lastUse) {
+				p = &cache[i];
+			}
+		}
+		bt_addr_le_copy(&p->addr, pAddr);
+	}
+
+	useCount += 1;
+	p->lastUse = useCount;
+	p->firmwareVersion = FirmwareVersion;
+	p->handles = *pHandles;
+	LOG_DBG("write: %u value: %u ccc: %u", pHandles->write,
+		pHandles->value, pHandles->ccc);
+}
+
+void SensorGattCache_Remove(const bt_addr_le_t *pAddr)
+{
+	SensorGattCacheEntry_t *p = FindEntry(pAddr);
+	if (p != NULL) {
+		p->lastUse = 0;
+	}
+}
+
+/******************************************************************************/
+/* Local Function Definitions                                                 */
+/******************************************************************************/
+static SensorGattCacheEntry_t *FindEntry(const bt_addr_le_t *pAddr)
+{
+	size_t i;
+	for (i = 0; i < CONFIG_SENSOR_GATT_CACHE_SIZE; i++) {
+		if (cache[i].lastUse != 0 &&
+		    bt_addr_le_cmp(&cache[i].addr, pAddr) == 0) {
+			return &cache[i];
+		}
+	}
+	return NULL;
+}
@@ -21,11 +21,45 @@ LOG_MODULE_REGISTER(sensor_log);
 /******************************************************************************/
 /* Local Constant, Macro and Type Definitions                                 */
 /******************************************************************************/
+/* Events are packed into a ring of bytes (oldest first).  Each record is
+ * encoded relative to the event before it.
+ *
+ * header: bits 0-2 record type dictionary index (escape = raw type follows)
+ *         bits 3-4 data encoding
+ *         bit 5 epoch interval is the same as the previous record
+ * epoch:  delta as zigzag varint (sensor epoch can go backwards), omitted
+ *         when the interval is the same (a periodic event is 1 or 2 bytes)
+ * data:   0, 1 (signed delta), or 2 bytes (little endian)
+ * type:   raw record type (escape only)
+ */
+#define HEADER_TYPE_MASK 0x07
+#define HEADER_TYPE_ESCAPE HEADER_TYPE_MASK
+#define HEADER_DATA_POSITION 3
+#define HEADER_DATA_MASK 0x03
+#define HEADER_SAME_INTERVAL 0x20
+
+enum DATA_ENCODING { DATA_SAME = 0, DATA_DELTA, DATA_RAW };
+
+#define DICTIONARY_SIZE HEADER_TYPE_ESCAPE
+#define VARINT_MAX_SIZE 5
+#define RECORD_MAX_SIZE (1 + VARINT_MAX_SIZE + sizeof(uint16_t) + 1)
+
+BUILD_ASSERT(CONFIG_SENSOR_LOG_BUFFER_SIZE >= (2 * RECORD_MAX_SIZE),
+	     "Sensor log buffer too small");
+
 struct SensorLog {
-	size_t size;
-	size_t writeIndex;
-	bool wrapped;
-	SensorLogEvent_t *pData;
+	size_t size; /* maximum number of events in JSON */
+	size_t count;
+	size_t used; /* bytes */
+	size_t tail; /* oldest record */
+	size_t head; /* next write */
+	SensorLogEvent_t oldest;
+	SensorLogEvent_t newest;
+	int32_t oldestInterval; /* epoch delta of the oldest record */
+	int32_t newestInterval;
+	uint8_t dictionaryCount;
+	uint8_t dictionary[DICTIONARY_SIZE];
+	uint8_t data[CONFIG_SENSOR_LOG_BUFFER_SIZE];
 };
 
 /******************************************************************************/
@@ -35,13 +69,25 @@ struct SensorLog {
 /******************************************************************************/
 /* Local Data Definitions                                                     */
 /******************************************************************************/
+K_MEM_SLAB_DEFINE(sensorLogSlab, ROUND_UP(sizeof(SensorLog_t), sizeof(void *)),
+		  CONFIG_SENSOR_TABLE_MAX_SIZE, sizeof(void *));
+
+static uint32_t allocationFailures;
 
 /******************************************************************************/
 /* Local Function Prototypes                                                  */
 /******************************************************************************/
-static size_t GetNumberOfEntries(SensorLog_t *pLog);
-static void IncrementIndices(SensorLog_t *pLog);
-static void IncrementIndex(size_t *pIndex, size_t Max);
+static size_t Encode(SensorLog_t *pLog, SensorLogEvent_t *pEvent,
+		     uint8_t *pRecord);
+static void Decode(SensorLog_t *pLog, size_t *pOffset,
+		   SensorLogEvent_t *pEvent, int32_t *pInterval);
+static void Seek(SensorLog_t *pLog, size_t Index, size_t *pOffset,
+		 SensorLogEvent_t *pEvent, int32_t *pInterval);
+static void RemoveOldest(SensorLog_t *pLog);
+static void GenerateJson(SensorLog_t *pLog, JsonMsg_t *pMsg, const char *pKey,
+			 size_t First, size_t Count);
+static uint8_t GetDictionaryIndex(SensorLog_t *pLog, uint8_t RecordType);
+static uint8_t GetByte(SensorLog_t *pLog, size_t *pOffset);
 
 /******************************************************************************/
 /* Global Function Definitions                                                */
@@ -49,23 +95,27 @@ static void IncrementIndex(size_t *pIndex, size_t Max);
 SensorLog_t *SensorLog_Allocate(size_t Size)
 {
 	SensorLog_t *p = NULL;
-	if (Size > 0) {
-		size_t s = sizeof(SensorLog_t);
-		p = k_malloc(s);
-		p->writeIndex = 0;
-		p->wrapped = false;
-		p->size = Size;
-		size_t bytes = Size * sizeof(SensorLogEvent_t);
-		p->pData = k_malloc(bytes);
-		memset(p->pData, 0, bytes);
+	if (Size == 0 || Size > CONFIG_SENSOR_LOG_MAX_SIZE) {
+		return NULL;
+	}
+
+	if (k_mem_slab_alloc(&sensorLogSlab, (void **)&p, K_NO_WAIT) != 0) {
+		allocationFailures += 1;
+		LOG_ERR("Unable to allocate sensor log (%u failures)",
+			allocationFailures);
+		return NULL;
 	}
+
+	memset(p, 0, sizeof(SensorLog_t));
+	p->size = Size;
 	return p;
 }
 
 void SensorLog_Free(SensorLog_t *pLog)
 {
-	k_free(pLog->pData);
-	k_free(pLog);
+	if (pLog != NULL) {
+		k_mem_slab_free(&sensorLogSlab, (void **)&pLog);
+	}
 }
 
 void SensorLog_Add(SensorLog_t *pLog, SensorLogEvent_t *pEvent)
@@ -74,9 +124,26 @@ void SensorLog_Add(SensorLog_t *pLog, SensorLogEvent_t *pEvent)
 		return;
 	}
 
-	memcpy(&pLog->pData[pLog->writeIndex], pEvent,
-	       sizeof(SensorLogEvent_t));
-	IncrementIndices(pLog);
+	uint8_t record[RECORD_MAX_SIZE];
+	int32_t interval = (int32_t)(pEvent->epoch - pLog->newest.epoch);
+	size_t length = Encode(pLog, pEvent, record);
+	while ((CONFIG_SENSOR_LOG_BUFFER_SIZE - pLog->used) < length) {
+		RemoveOldest(pLog);
+	}
+
+	size_t i;
+	for (i = 0; i < length; i++) {
+		pLog->data[pLog->head] = record[i];
+		pLog->head = (pLog->head + 1) % CONFIG_SENSOR_LOG_BUFFER_SIZE;
+	}
+	pLog->used += length;
+	if (pLog->count == 0) {
+		pLog->oldest = *pEvent;
+		pLog->oldestInterval = interval;
+	}
+	pLog->newest = *pEvent;
+	pLog->newestInterval = interval;
+	pLog->count += 1;
 }
 
 void SensorLog_GenerateJson(SensorLog_t *pLog, JsonMsg_t *pMsg)
@@ -85,20 +152,66 @@ void SensorLog_GenerateJson(SensorLog_t *pLog, JsonMsg_t *pMsg)
 		return;
 	}
 
-	size_t entries = GetNumberOfEntries(pLog);
-	LOG_DBG("Sensor Log has %d entries", entries);
-	if (entries == 0) {
-		return;
+	LOG_DBG("Sensor Log has %d entries (%d bytes)", pLog->count,
+		pLog->used);
+	size_t entries = MIN(pLog->count, pLog->size);
+	GenerateJson(pLog, pMsg, "eventLog", pLog->count - entries, entries);
+}
+
+size_t SensorLog_GenerateAppendJson(SensorLog_t *pLog, JsonMsg_t *pMsg,
+				    size_t Count)
+{
+	if (pLog == NULL) {
+		return 0;
 	}
 
-	ShadowBuilder_StartArray(pMsg, "eventLog");
-	size_t readIndex = pLog->wrapped ? pLog->writeIndex : 0;
+	size_t first = pLog->count - MIN(Count, pLog->count);
+	size_t entries = MIN(pLog->count - first, pLog->size);
+	GenerateJson(pLog, pMsg, "eventLogAppend", first, entries);
+	return entries;
+}
+
+bool SensorLog_GetRecent(SensorLog_t *pLog, size_t Age,
+			 SensorLogEvent_t *pEvent)
+{
+	if (pLog == NULL || Age >= pLog->count) {
+		return false;
+	}
+
+	if (Age == 0) {
+		*pEvent = pLog->newest;
+	} else {
+		size_t offset;
+		int32_t interval;
+		Seek(pLog, pLog->count - 1 - Age, &offset, pEvent, &interval);
+	}
+	return true;
+}
+
+size_t SensorLog_GetRecentEvents(SensorLog_t *pLog, size_t Count,
+				 SensorLogEvent_t *pEvents)
+{
+	if (pLog == NULL) {
+		return 0;
+	}
+
+	size_t n = MIN(Count, pLog->count);
+	if (n == 0) {
+		return 0;
+	}
+
+	size_t offset;
+	SensorLogEvent_t event;
+	int32_t interval;
+	Seek(pLog, pLog->count - n, &offset, &event, &interval);
 	size_t i;
-	for (i = 0; i < entries; i++) {
-		ShadowBuilder_AddEventLogEntry(pMsg, &pLog->pData[readIndex]);
-		IncrementIndex(&readIndex, pLog->size);
+	for (i = 0; i < n; i++) {
+		if (i > 0) {
+			Decode(pLog, &offset, &event, &interval);
+		}
+		pEvents[n - 1 - i] = event;
 	}
-	ShadowBuilder_EndArray(pMsg);
+	return n;
 }
 
 size_t SensorLog_GetSize(SensorLog_t *pLog)
@@ -106,26 +219,185 @@ size_t SensorLog_GetSize(SensorLog_t *pLog)
 	return (pLog == NULL) ? 0 : pLog->size;
 }
 
+size_t SensorLog_GetNumberOfEntries(SensorLog_t *pLog)
+{
+	return (pLog == NULL) ? 0 : pLog->count;
+}
+
 /******************************************************************************/
 /* Local Function Definitions                                                 */
 /******************************************************************************/
-static size_t GetNumberOfEntries(SensorLog_t *pLog)
+static size_t Encode(SensorLog_t *pLog, SensorLogEvent_t *pEvent,
+		     uint8_t *pRecord)
+{
+	size_t i = 1;
+	uint8_t header = GetDictionaryIndex(pLog, pEvent->recordType);
+
+	int32_t delta = (int32_t)(pEvent->epoch - pLog->newest.epoch);
+	if (delta == pLog->newestInterval) {
+		header |= HEADER_SAME_INTERVAL;
+	} else {
+		uint32_t zigzag =
+			((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+		do {
+			pRecord[i] = zigzag & 0x7F;
+			zigzag >>= 7;
+			if (zigzag != 0) {
+				pRecord[i] |= 0x80;
+			}
+			i += 1;
+		} while (zigzag != 0);
+	}
+
+	int32_t dataDelta = (int32_t)pEvent->data - pLog->newest.data;
+	if (pLog->count > 0 && dataDelta == 0) {
+		header |= (DATA_SAME << HEADER_DATA_POSITION);
+	} else if (pLog->count > 0 && dataDelta >= INT8_MIN &&
+		   dataDelta <= INT8_MAX) {
+		header |= (DATA_DELTA << HEADER_DATA_POSITION);
+		pRecord[i++] = (uint8_t)(int8_t)dataDelta;
+	} else {
+		header |= (DATA_RAW << HEADER_DATA_POSITION);
+		pRecord[i++] = (uint8_t)pEvent->data;
+		pRecord[i++] = (uint8_t)(pEvent->data >> 8);
+	}
+
+	if ((header & HEADER_TYPE_MASK) == HEADER_TYPE_ESCAPE) {
+		pRecord[i++] = pEvent->recordType;
+	}
+
+	pRecord[0] = header;
+	return i;
+}
+
+/* Apply the record at offset to the previous event (and its interval).
+ * The length of a record doesn't depend on the previous event, so a record
+ * can be skipped without knowing it.
+ */
+static void Decode(SensorLog_t *pLog, size_t *pOffset,
+		   SensorLogEvent_t *pEvent, int32_t *pInterval)
 {
-	return pLog->wrapped ? pLog->size : pLog->writeIndex;
+	uint8_t header = GetByte(pLog, pOffset);
+
+	if ((header & HEADER_SAME_INTERVAL) == 0) {
+		uint32_t zigzag = 0;
+		uint8_t shift = 0;
+		uint8_t b;
+		do {
+			b = GetByte(pLog, pOffset);
+			zigzag |= (uint32_t)(b & 0x7F) << shift;
+			shift += 7;
+		} while ((b & 0x80) != 0 && shift < (7 * VARINT_MAX_SIZE));
+		*pInterval = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+	}
+	pEvent->epoch += (uint32_t)*pInterval;
+
+	switch ((header >> HEADER_DATA_POSITION) & HEADER_DATA_MASK) {
+	case DATA_DELTA:
+		pEvent->data += (int8_t)GetByte(pLog, pOffset);
+		break;
+	case DATA_RAW:
+		pEvent->data = GetByte(pLog, pOffset);
+		pEvent->data |= (uint16_t)GetByte(pLog, pOffset) << 8;
+		break;
+	default:
+		break;
+	}
+
+	uint8_t index = header & HEADER_TYPE_MASK;
+	if (index == HEADER_TYPE_ESCAPE) {
+		pEvent->recordType = GetByte(pLog, pOffset);
+	} else {
+		pEvent->recordType = pLog->dictionary[index];
+	}
 }
 
-static void IncrementIndices(SensorLog_t *pLog)
+/* The absolute value of the oldest event is stored.  The values of the
+ * other events are found by applying each record in order.
+ */
+static void Seek(SensorLog_t *pLog, size_t Index, size_t *pOffset,
+		 SensorLogEvent_t *pEvent, int32_t *pInterval)
 {
-	if (pLog->writeIndex == (pLog->size - 1)) {
-		pLog->wrapped = true;
+	SensorLogEvent_t skip = pLog->oldest;
+	int32_t skipInterval = 0;
+	*pOffset = pLog->tail;
+	Decode(pLog, pOffset, &skip, &skipInterval);
+
+	*pEvent = pLog->oldest;
+	*pInterval = pLog->oldestInterval;
+	size_t i;
+	for (i = 0; i < Index; i++) {
+		Decode(pLog, pOffset, pEvent, pInterval);
 	}
-	IncrementIndex(&pLog->writeIndex, pLog->size);
 }
 
-static void IncrementIndex(size_t *pIndex, size_t Max)
+/* The second record becomes the oldest. */
+static void RemoveOldest(SensorLog_t *pLog)
 {
-	(*pIndex)++;
-	if (*pIndex >= Max) {
-		*pIndex = 0;
+	if (pLog->count <= 1) {
+		pLog->count = 0;
+		pLog->used = 0;
+		pLog->tail = pLog->head;
+		return;
 	}
+
+	size_t offset = pLog->tail;
+	SensorLogEvent_t skip = pLog->oldest;
+	int32_t skipInterval = 0;
+	Decode(pLog, &offset, &skip, &skipInterval);
+	size_t length = (offset + CONFIG_SENSOR_LOG_BUFFER_SIZE - pLog->tail) %
+			CONFIG_SENSOR_LOG_BUFFER_SIZE;
+	Decode(pLog, &offset, &pLog->oldest, &pLog->oldestInterval);
+
+	pLog->count -= 1;
+	pLog->used -= length;
+	pLog->tail = (pLog->tail + length) % CONFIG_SENSOR_LOG_BUFFER_SIZE;
+}
+
+static void GenerateJson(SensorLog_t *pLog, JsonMsg_t *pMsg, const char *pKey,
+			 size_t First, size_t Count)
+{
+	if (Count == 0) {
+		return;
+	}
+
+	size_t offset;
+	SensorLogEvent_t event;
+	int32_t interval;
+	Seek(pLog, First, &offset, &event, &interval);
+
+	ShadowBuilder_StartArray(pMsg, pKey);
+	size_t i;
+	for (i = 0; i < Count; i++) {
+		if (i > 0) {
+			Decode(pLog, &offset, &event, &interval);
+		}
+		ShadowBuilder_AddEventLogEntry(pMsg, &event);
+	}
+	ShadowBuilder_EndArray(pMsg);
+}
+
+/* Types are added to the dictionary the first time they are logged. */
+static uint8_t GetDictionaryIndex(SensorLog_t *pLog, uint8_t RecordType)
+{
+	uint8_t i;
+	for (i = 0; i < pLog->dictionaryCount; i++) {
+		if (pLog->dictionary[i] == RecordType) {
+			return i;
+		}
+	}
+
+	if (pLog->dictionaryCount < DICTIONARY_SIZE) {
+		pLog->dictionary[pLog->dictionaryCount] = RecordType;
+		return pLog->dictionaryCount++;
+	}
+
+	return HEADER_TYPE_ESCAPE;
+}
+
+static uint8_t GetByte(SensorLog_t *pLog, size_t *pOffset)
+{
+	uint8_t b = pLog->data[*pOffset];
+	*pOffset = (*pOffset + 1) % CONFIG_SENSOR_LOG_BUFFER_SIZE;
+	return b;
 }
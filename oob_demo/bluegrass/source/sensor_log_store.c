@@ -0,0 +1,451 @@
+/**
+ * @file sensor_log_store.c
+ * @brief
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(sensor_log_store);
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr.h>
+#include <fs/fs.h>
+
+#include "FrameworkIncludes.h"
+#include "file_system_utilities.h"
+#include "sensor_adv_format.h"
+#include "sensor_deadline.h"
+#include "sensor_log_store.h"
+
+/******************************************************************************/
+/* Local Constant, Macro and Type Definitions                                 */
+/******************************************************************************/
+#ifndef CONFIG_SENSOR_LOG_STORE
+#define CONFIG_SENSOR_LOG_STORE 0
+#endif
+
+#ifndef CONFIG_SENSOR_LOG_STORE_BATCH_SIZE
+#define CONFIG_SENSOR_LOG_STORE_BATCH_SIZE 32
+#endif
+
+#ifndef CONFIG_SENSOR_LOG_STORE_MIN_INTERVAL_SECONDS
+#define CONFIG_SENSOR_LOG_STORE_MIN_INTERVAL_SECONDS 60
+#endif
+
+#ifndef CONFIG_SENSOR_LOG_STORE_MAX_AGE_SECONDS
+#define CONFIG_SENSOR_LOG_STORE_MAX_AGE_SECONDS 300
+#endif
+
+#ifndef CONFIG_SENSOR_LOG_STORE_FILE_EVENTS
+#define CONFIG_SENSOR_LOG_STORE_FILE_EVENTS 128
+#endif
+
+/* Each sensor has an active file that events are appended to.  When it is
+ * full it replaces the previous file (rename is atomic).
+ */
+#define SENSOR_LOG_STORE_DIR CONFIG_FSU_MOUNT_POINT "/slog"
+#define SENSOR_LOG_STORE_OLD_EXT ".old"
+#define SENSOR_LOG_STORE_NAME_SIZE                                             \
+	(SENSOR_ADDR_STR_LEN + sizeof(SENSOR_LOG_STORE_OLD_EXT))
+#define SENSOR_LOG_STORE_PATH_SIZE                                             \
+	(sizeof(SENSOR_LOG_STORE_DIR "/") + SENSOR_LOG_STORE_NAME_SIZE)
+
+/* A file starts with a header so that a change to the record format
+ * isn't misread after a firmware update (files of another version are
+ * deleted).
+ */
+#define SENSOR_LOG_STORE_MAGIC 0x474f4c53 /* "SLOG" */
+#define SENSOR_LOG_STORE_VERSION 1
+
+typedef struct StoreHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t recordSize;
+} StoreHeader_t;
+
+/* The sequence number is the one used in the shadow (eventLogSequence).
+ * It orders events that have the same epoch (or no epoch).
+ */
+typedef struct StoreRecord {
+	uint32_t sequence;
+	uint32_t epoch;
+	uint16_t data;
+	uint8_t recordType;
+	uint8_t reserved;
+} StoreRecord_t;
+BUILD_ASSERT(sizeof(StoreRecord_t) == 12, "Sensor log record size changed");
+
+#define SENSOR_LOG_STORE_FILE_SIZE                                             \
+	(sizeof(StoreHeader_t) +                                               \
+	 (CONFIG_SENSOR_LOG_STORE_FILE_EVENTS * sizeof(StoreRecord_t)))
+
+/* The oldest staged event is written within MAX_AGE because staging
+ * starts after a write (so the minimum interval has always elapsed).
+ */
+#define MIN_INTERVAL_MS                                                        \
+	(CONFIG_SENSOR_LOG_STORE_MIN_INTERVAL_SECONDS * MSEC_PER_SEC)
+#define MAX_AGE_MS (CONFIG_SENSOR_LOG_STORE_MAX_AGE_SECONDS * MSEC_PER_SEC)
+BUILD_ASSERT(CONFIG_SENSOR_LOG_STORE_MAX_AGE_SECONDS >=
+		     CONFIG_SENSOR_LOG_STORE_MIN_INTERVAL_SECONDS,
+	     "Sensor log store max age is less than the write interval");
+
+/* Records are read in chunks during replay. */
+#define SENSOR_LOG_STORE_READ_EVENTS 16
+
+/* Files are deleted in batches after the directory has been read. */
+#define SENSOR_LOG_STORE_DELETE_BATCH 8
+
+typedef struct StagedEvent {
+	char addrString[SENSOR_ADDR_STR_SIZE];
+	StoreRecord_t record;
+} StagedEvent_t;
+
+/******************************************************************************/
+/* Local Data Definitions                                                     */
+/******************************************************************************/
+static bool initialized;
+static StagedEvent_t staged[CONFIG_SENSOR_LOG_STORE_BATCH_SIZE];
+static size_t stagedCount;
+static int64_t firstStagedTime;
+static int64_t lastFlushTime;
+static uint32_t discarded;
+
+/******************************************************************************/
+/* Local Function Prototypes                                                  */
+/******************************************************************************/
+static void BuildPath(char *pPath, const char *pAddrString, bool Old);
+static int Append(const char *pAddrString, size_t First);
+static void Rotate(const char *pAddrString);
+static size_t ReplayFile(const char *pPath, SensorLog_t *pLog,
+			 uint32_t *pSequence);
+static bool HeaderValid(struct fs_file_t *pFile);
+static size_t ReadNames(char (*pNames)[SENSOR_LOG_STORE_NAME_SIZE],
+			size_t Max);
+static void Unstage(const char *pAddrString);
+
+/******************************************************************************/
+/* Global Function Definitions                                                */
+/******************************************************************************/
+int SensorLogStore_Initialize(void)
+{
+	if (!CONFIG_SENSOR_LOG_STORE) {
+		return 0;
+	}
+
+	int r = fsu_lfs_mount();
+	if (r == 0) {
+		r = fs_mkdir(SENSOR_LOG_STORE_DIR);
+		if (r == -EEXIST) {
+			r = 0;
+		}
+	}
+
+	initialized = (r == 0);
+	lastFlushTime = k_uptime_get();
+	if (!initialized) {
+		LOG_ERR("Unable to initialize sensor log store (%d)", r);
+	}
+	return r;
+}
+
+bool SensorLogStore_IsAvailable(void)
+{
+	return initialized;
+}
+
+bool SensorLogStore_Add(const char *pAddrString, uint32_t Sequence,
+			const SensorLogEvent_t *pEvent)
+{
+	if (!initialized) {
+		return false;
+	}
+
+	/* The write rate is bounded, so events can be lost during a burst.
+	 * They are still in the RAM log.
+	 */
+	if (stagedCount >= CONFIG_SENSOR_LOG_STORE_BATCH_SIZE) {
+		if (k_uptime_get() < (lastFlushTime + MIN_INTERVAL_MS)) {
+			discarded += 1;
+			LOG_WRN("Sensor log store discarded %u events",
+				discarded);
+			return false;
+		}
+		SensorLogStore_Flush();
+	}
+
+	if (stagedCount == 0) {
+		firstStagedTime = k_uptime_get();
+	}
+	strncpy(staged[stagedCount].addrString, pAddrString,
+		SENSOR_ADDR_STR_LEN);
+	staged[stagedCount].addrString[SENSOR_ADDR_STR_LEN] = 0;
+	StoreRecord_t *p = &staged[stagedCount].record;
+	p->sequence = Sequence;
+	p->epoch = pEvent->epoch;
+	p->data = pEvent->data;
+	p->recordType = pEvent->recordType;
+	p->reserved = 0;
+	stagedCount += 1;
+	return true;
+}
+
+/* Staged events are written when the staging area is full or the oldest
+ * reaches the maximum age (whichever is first), but not more often than
+ * the minimum interval.
+ */
+int64_t SensorLogStore_GetFlushTime(void)
+{
+	if (stagedCount == 0) {
+		return SENSOR_DEADLINE_NONE;
+	}
+
+	int64_t allowed = lastFlushTime + MIN_INTERVAL_MS;
+	if (stagedCount >= CONFIG_SENSOR_LOG_STORE_BATCH_SIZE) {
+		return allowed;
+	}
+	return MAX(allowed, firstStagedTime + MAX_AGE_MS);
+}
+
+void SensorLogStore_Flush(void)
+{
+	size_t i;
+	for (i = 0; i < stagedCount; i++) {
+		if (staged[i].addrString[0] == 0) {
+			continue;
+		}
+		int r = Append(staged[i].addrString, i);
+		if (r < 0) {
+			LOG_ERR("Unable to store events for %s (%d)",
+				log_strdup(staged[i].addrString), r);
+		}
+	}
+	stagedCount = 0;
+	lastFlushTime = k_uptime_get();
+}
+
+size_t SensorLogStore_Replay(const char *pAddrString, SensorLog_t *pLog,
+			     uint32_t *pSequence)
+{
+	if (!initialized) {
+		return 0;
+	}
+
+	/* Staged events haven't been written yet (they are still in RAM). */
+	char path[SENSOR_LOG_STORE_PATH_SIZE];
+	size_t count = 0;
+	BuildPath(path, pAddrString, true);
+	count += ReplayFile(path, pLog, pSequence);
+	BuildPath(path, pAddrString, false);
+	count += ReplayFile(path, pLog, pSequence);
+	LOG_DBG("Replayed %u events for %s", count, log_strdup(pAddrString));
+	return count;
+}
+
+void SensorLogStore_Delete(const char *pAddrString)
+{
+	if (!initialized) {
+		return;
+	}
+
+	char path[SENSOR_LOG_STORE_PATH_SIZE];
+	Unstage(pAddrString);
+	BuildPath(path, pAddrString, false);
+	(void)fs_unlink(path);
+	BuildPath(path, pAddrString, true);
+	(void)fs_unlink(path);
+}
+
+void SensorLogStore_DeleteAll(void)
+{
+	if (!initialized) {
+		return;
+	}
+
+	stagedCount = 0;
+
+	/* The directory isn't modified while it is being read.  Another
+	 * batch is read only if the previous one was full and deleted.
+	 */
+	char names[SENSOR_LOG_STORE_DELETE_BATCH][SENSOR_LOG_STORE_NAME_SIZE];
+	char path[SENSOR_LOG_STORE_PATH_SIZE];
+	size_t n;
+	size_t deleted;
+	do {
+		n = ReadNames(names, SENSOR_LOG_STORE_DELETE_BATCH);
+		deleted = 0;
+		size_t i;
+		for (i = 0; i < n; i++) {
+			snprintk(path, sizeof(path), SENSOR_LOG_STORE_DIR "/%s",
+				 names[i]);
+			if (fs_unlink(path) == 0) {
+				deleted += 1;
+			}
+		}
+	} while (n == SENSOR_LOG_STORE_DELETE_BATCH && deleted > 0);
+}
+
+/******************************************************************************/
+/* Local Function Definitions                                                 */
+/******************************************************************************/
+static void BuildPath(char *pPath, const char *pAddrString, bool Old)
+{
+	snprintk(pPath, SENSOR_LOG_STORE_PATH_SIZE,
+		 SENSOR_LOG_STORE_DIR "/%s%s", pAddrString,
+		 Old ? SENSOR_LOG_STORE_OLD_EXT : "");
+}
+
+/* All of the staged events for a sensor are written with one open/close.
+ * They are removed from the staging area by clearing the address.
+ */
+static int Append(const char *pAddrString, size_t First)
+{
+	char path[SENSOR_LOG_STORE_PATH_SIZE];
+	char addrString[SENSOR_ADDR_STR_SIZE];
+	struct fs_file_t file;
+
+	strcpy(addrString, pAddrString);
+	BuildPath(path, addrString, false);
+	int r = fs_open(&file, path);
+	if (r < 0) {
+		return r;
+	}
+
+	r = fs_seek(&file, 0, FS_SEEK_END);
+	if (r >= 0 && fs_tell(&file) == 0) {
+		StoreHeader_t header = { .magic = SENSOR_LOG_STORE_MAGIC,
+					 .version = SENSOR_LOG_STORE_VERSION,
+					 .recordSize = sizeof(StoreRecord_t) };
+		r = fs_write(&file, &header, sizeof(header));
+	}
+	size_t i;
+	for (i = First; i < stagedCount && r >= 0; i++) {
+		if (strcmp(staged[i].addrString, addrString) == 0) {
+			r = fs_write(&file, &staged[i].record,
+				     sizeof(StoreRecord_t));
+			staged[i].addrString[0] = 0;
+		}
+	}
+	off_t size = fs_tell(&file);
+	(void)fs_close(&file);
+
+	if (r >= 0 && size >= SENSOR_LOG_STORE_FILE_SIZE) {
+		Rotate(addrString);
+	}
+	return r;
+}
+
+static void Rotate(const char *pAddrString)
+{
+	char path[SENSOR_LOG_STORE_PATH_SIZE];
+	char oldPath[SENSOR_LOG_STORE_PATH_SIZE];
+
+	BuildPath(path, pAddrString, false);
+	BuildPath(oldPath, pAddrString, true);
+	(void)fs_unlink(oldPath);
+	int r = fs_rename(path, oldPath);
+	if (r < 0) {
+		LOG_ERR("Unable to rotate sensor log %s (%d)",
+			log_strdup(pAddrString), r);
+	}
+}
+
+/* Events must be added to the log in order.  Events that aren't newer than
+ * the sequence number (of the last event in the log) are skipped.
+ * The unsigned difference handles roll-over.
+ */
+static size_t ReplayFile(const char *pPath, SensorLog_t *pLog,
+			 uint32_t *pSequence)
+{
+	struct fs_dirent entry;
+	if (fs_stat(pPath, &entry) != 0) {
+		return 0;
+	}
+
+	struct fs_file_t file;
+	if (fs_open(&file, pPath) != 0) {
+		return 0;
+	}
+
+	if (!HeaderValid(&file)) {
+		(void)fs_close(&file);
+		LOG_WRN("Deleting sensor log with unknown format %s",
+			log_strdup(pPath));
+		(void)fs_unlink(pPath);
+		return 0;
+	}
+
+	StoreRecord_t records[SENSOR_LOG_STORE_READ_EVENTS];
+	size_t count = 0;
+	ssize_t bytes;
+	do {
+		bytes = fs_read(&file, records, sizeof(records));
+		size_t n = (bytes > 0) ? (bytes / sizeof(StoreRecord_t)) : 0;
+		size_t i;
+		for (i = 0; i < n; i++) {
+			if ((int32_t)(records[i].sequence - *pSequence) <= 0) {
+				continue;
+			}
+			SensorLogEvent_t event = {
+				.epoch = records[i].epoch,
+				.data = records[i].data,
+				.recordType = records[i].recordType
+			};
+			SensorLog_Add(pLog, &event);
+			*pSequence = records[i].sequence;
+			count += 1;
+		}
+	} while (bytes == sizeof(records));
+
+	(void)fs_close(&file);
+	return count;
+}
+
+static bool HeaderValid(struct fs_file_t *pFile)
+{
+	StoreHeader_t header;
+	ssize_t bytes = fs_read(pFile, &header, sizeof(header));
+	return (bytes == sizeof(header) &&
+		header.magic == SENSOR_LOG_STORE_MAGIC &&
+		header.version == SENSOR_LOG_STORE_VERSION &&
+		header.recordSize == sizeof(StoreRecord_t));
+}
+
+/* Names that are too long weren't created by the store (they are
+ * skipped).
+ */
+static size_t ReadNames(char (*pNames)[SENSOR_LOG_STORE_NAME_SIZE],
+			size_t Max)
+{
+	struct fs_dir_t dir;
+	struct fs_dirent entry;
+	size_t n = 0;
+	if (fs_opendir(&dir, SENSOR_LOG_STORE_DIR) != 0) {
+		return 0;
+	}
+	/* An empty name marks the end of the directory. */
+	while (n < Max && fs_readdir(&dir, &entry) == 0 &&
+	       entry.name[0] != 0) {
+		if (strlen(entry.name) < SENSOR_LOG_STORE_NAME_SIZE) {
+			strcpy(pNames[n], entry.name);
+			n += 1;
+		}
+	}
+	(void)fs_closedir(&dir);
+	return n;
+}
+
+static void Unstage(const char *pAddrString)
+{
+	size_t i;
+	for (i = 0; i < stagedCount; i++) {
+		if (strcmp(staged[i].addrString, pAddrString) == 0) {
+			staged[i].addrString[0] = 0;
+		}
+	}
+}
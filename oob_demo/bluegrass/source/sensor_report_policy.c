@@ -0,0 +1,90 @@
+/**
+ * @file sensor_report_policy.c
+ * @brief
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr.h>
+#include <stdlib.h>
+
+#include "sensor_report_policy.h"
+
+/******************************************************************************/
+/* Local Constant, Macro and Type Definitions                                 */
+/******************************************************************************/
+#ifndef CONFIG_SENSOR_REPORT_DEADBAND_CC
+#define CONFIG_SENSOR_REPORT_DEADBAND_CC 0
+#endif
+
+#ifndef CONFIG_SENSOR_REPORT_DEADBAND_PERCENT
+#define CONFIG_SENSOR_REPORT_DEADBAND_PERCENT 0
+#endif
+
+#ifndef CONFIG_SENSOR_REPORT_MIN_INTERVAL_SECONDS
+#define CONFIG_SENSOR_REPORT_MIN_INTERVAL_SECONDS 0
+#endif
+
+#ifndef CONFIG_SENSOR_REPORT_HEARTBEAT_SECONDS
+#define CONFIG_SENSOR_REPORT_HEARTBEAT_SECONDS 0
+#endif
+
+/******************************************************************************/
+/* Local Function Prototypes                                                  */
+/******************************************************************************/
+static bool OutsideDeadband(const SensorReportPolicy_t *p, int32_t Reported,
+			    int32_t Value);
+static int64_t Remaining(uint32_t Seconds, int64_t ElapsedMs);
+
+/******************************************************************************/
+/* Global Function Definitions                                                */
+/******************************************************************************/
+void SensorReportPolicy_GetDefault(SensorReportPolicy_t *p)
+{
+	p->deadbandCc = CONFIG_SENSOR_REPORT_DEADBAND_CC;
+	p->deadbandPercent = CONFIG_SENSOR_REPORT_DEADBAND_PERCENT;
+	p->minIntervalSeconds = CONFIG_SENSOR_REPORT_MIN_INTERVAL_SECONDS;
+	p->heartbeatSeconds = CONFIG_SENSOR_REPORT_HEARTBEAT_SECONDS;
+}
+
+int64_t SensorReportPolicy_Delay(const SensorReportPolicy_t *p,
+				 int32_t Reported, int32_t Value,
+				 int64_t ElapsedMs)
+{
+	int64_t delay = SENSOR_REPORT_POLICY_HOLD;
+	if (OutsideDeadband(p, Reported, Value)) {
+		delay = Remaining(p->minIntervalSeconds, ElapsedMs);
+	}
+	if (p->heartbeatSeconds != 0) {
+		delay = MIN(delay, Remaining(p->heartbeatSeconds, ElapsedMs));
+	}
+	return delay;
+}
+
+/******************************************************************************/
+/* Local Function Definitions                                                 */
+/******************************************************************************/
+/* The larger of the two deadbands is used.  Without a deadband every
+ * value is reported (even if it didn't change).
+ */
+static bool OutsideDeadband(const SensorReportPolicy_t *p, int32_t Reported,
+			    int32_t Value)
+{
+	uint32_t relative = (abs(Reported) * p->deadbandPercent) / 100;
+	uint32_t deadband = MAX(p->deadbandCc, relative);
+	if (deadband == 0) {
+		return true;
+	}
+	return ((uint32_t)abs(Value - Reported) >= deadband);
+}
+
+static int64_t Remaining(uint32_t Seconds, int64_t ElapsedMs)
+{
+	int64_t ms = (int64_t)Seconds * MSEC_PER_SEC;
+	return (ElapsedMs >= ms) ? 0 : (ms - ElapsedMs);
+}
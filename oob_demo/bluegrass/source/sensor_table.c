@@ -30,8 +30,13 @@ LOG_MODULE_REGISTER(sensor_table);
 #include "sensor_adv_format.h"
 #include "sensor_event.h"
 #include "sensor_log.h"
+#include "sensor_log_store.h"
+#include "sensor_deadline.h"
+#include "sensor_twin.h"
+#include "sensor_aggregate.h"
 #include "bt510_flags.h"
 #include "lte.h"
+#include "nv.h"
 #include "sensor_table.h"
 
 /******************************************************************************/
@@ -49,6 +54,24 @@ LOG_MODULE_REGISTER(sensor_table);
 #define SENSOR_GET_ACCEPTED_TOPIC_FMT_STR                                      \
 	CONFIG_SENSOR_TOPIC_FMT_STR_PREFIX SENSOR_GET_ACCEPTED_SUB_STR
 
+/* Leases are claimed in a named shadow so that the gateways receive the
+ * claims without the updates of the sensor shadow.
+ */
+#define SENSOR_LEASE_SUB_STR "/name/lease/"
+
+#define SENSOR_LEASE_TOPIC_FMT_STR                                             \
+	CONFIG_SENSOR_TOPIC_FMT_STR_PREFIX SENSOR_LEASE_SUB_STR "update"
+
+#define SENSOR_LEASE_ACCEPTED_TOPIC_FMT_STR                                    \
+	CONFIG_SENSOR_TOPIC_FMT_STR_PREFIX SENSOR_LEASE_SUB_STR "update/accepted"
+
+#define SENSOR_LEASE_GET_TOPIC_FMT_STR                                         \
+	CONFIG_SENSOR_TOPIC_FMT_STR_PREFIX SENSOR_LEASE_SUB_STR "get"
+
+/* The get is rejected when the sensor has never been claimed. */
+#define SENSOR_LEASE_GET_RESULT_TOPIC_FMT_STR                                  \
+	CONFIG_SENSOR_TOPIC_FMT_STR_PREFIX SENSOR_LEASE_SUB_STR "get/+"
+
 #ifndef CONFIG_USE_SINGLE_AWS_TOPIC
 #define CONFIG_USE_SINGLE_AWS_TOPIC 0
 #endif
@@ -61,6 +84,74 @@ LOG_MODULE_REGISTER(sensor_table);
 #define CONFIG_SENSOR_TTL_SECONDS (60 * 60 * 2)
 #endif
 
+/* When the table is full, a sensor that hasn't been whitelisted can only
+ * replace another (non-whitelisted) sensor that hasn't been seen for this
+ * long.  This prevents a crowd of foreign sensors from thrashing the table.
+ */
+#ifndef CONFIG_SENSOR_EVICTION_MIN_IDLE_SECONDS
+#define CONFIG_SENSOR_EVICTION_MIN_IDLE_SECONDS 60
+#endif
+
+/* Changes to the sensor table (new sensors and events) are coalesced so
+ * that at most one gateway shadow update is sent per interval.
+ */
+#ifndef CONFIG_SENSOR_GATEWAY_SHADOW_INTERVAL_SECONDS
+#define CONFIG_SENSOR_GATEWAY_SHADOW_INTERVAL_SECONDS 30
+#endif
+
+/* Configuration changes (shadow deltas) that arrive within this time of
+ * each other are merged into one command before a sensor is connected to.
+ */
+#ifndef CONFIG_SENSOR_CONFIG_COALESCE_SECONDS
+#define CONFIG_SENSOR_CONFIG_COALESCE_SECONDS 3
+#endif
+
+#define COALESCE_MS (CONFIG_SENSOR_CONFIG_COALESCE_SECONDS * MSEC_PER_SEC)
+
+/* Only the gateway that owns a sensor's lease publishes its shadow.
+ * A value of zero disables leases (every gateway publishes).
+ */
+#ifndef CONFIG_SENSOR_LEASE_SECONDS
+#define CONFIG_SENSOR_LEASE_SECONDS 0
+#endif
+
+/* A gateway must receive a sensor this much stronger (dB) than the
+ * lease owner before it takes the lease.
+ */
+#ifndef CONFIG_SENSOR_LEASE_RSSI_MARGIN
+#define CONFIG_SENSOR_LEASE_RSSI_MARGIN 10
+#endif
+
+/* Claims (and renewals) aren't repeated until the shadow has had time
+ * to deliver the result.
+ */
+#define LEASE_CLAIM_INTERVAL_MS                                                \
+	((CONFIG_SENSOR_LEASE_SECONDS * MSEC_PER_SEC) / 4)
+
+/* When non-zero, temperature events are summarized (min/max/mean) in the
+ * gateway shadow at the end of each bucket of this length.
+ */
+#ifndef CONFIG_SENSOR_AGGREGATE_SECONDS
+#define CONFIG_SENSOR_AGGREGATE_SECONDS 0
+#endif
+
+/* Events that occur within this window (after a sensor shadow has been
+ * published) are merged into a single update.  Alarms are sent immediately.
+ * A value of zero publishes every event.
+ */
+#ifndef CONFIG_SENSOR_SHADOW_WINDOW_SECONDS
+#define CONFIG_SENSOR_SHADOW_WINDOW_SECONDS 5
+#endif
+
+/* At 1 second there are duplicate requests for shadow information.
+ * Only one request is made at a time because it is memory intensive.
+ */
+#define SENSOR_INIT_SHADOW_SPACING_MS (3 * MSEC_PER_SEC)
+#define SENSOR_INIT_SHADOW_RETRY_MS (10 * MSEC_PER_SEC)
+
+/* Used when a message couldn't be sent (or wasn't acknowledged) */
+#define SENSOR_DEADLINE_RETRY_MS (3 * MSEC_PER_SEC)
+
 #define JSON_DEFAULT_BUF_SIZE (1536)
 
 /* An empty message can be sent, but a value is sent for test purposes.  */
@@ -75,19 +166,76 @@ BUILD_ASSERT(((sizeof(SENSOR_SUBSCRIPTION_TOPIC_FMT_STR) +
 	       SENSOR_ADDR_STR_LEN) < CONFIG_AWS_TOPIC_MAX_SIZE),
 	     "Topic too small");
 
+BUILD_ASSERT(((sizeof(SENSOR_LEASE_ACCEPTED_TOPIC_FMT_STR) +
+	       SENSOR_ADDR_STR_LEN) < CONFIG_AWS_TOPIC_MAX_SIZE),
+	     "Topic too small");
+
 #define MAX_KEY_STR_LEN 64
 #define MANGLED_NAME_MAX_STR_LEN                                               \
 	(SENSOR_NAME_MAX_SIZE + sizeof('-') + MAX_KEY_STR_LEN)
 #define MANGLED_NAME_MAX_SIZE (MANGLED_NAME_MAX_STR_LEN + 1)
 
 /* {"reported":{"bt510":{"sensors":[["c13a7e4118a2",<epoch>,false], .... */
-#define SENSOR_GATEWAY_SHADOW_MAX_SIZE 600
+#define SENSOR_GATEWAY_SHADOW_BASE_SIZE 64
+#define SENSOR_GATEWAY_SHADOW_ENTRY_SIZE 36
+/* "reportPolicy":[["c13a7e4118a2",<cc>,<%>,<interval>,<heartbeat>], ... */
+#define SENSOR_GATEWAY_POLICY_ENTRY_SIZE 64
+#define SENSOR_GATEWAY_POLICY_SIZE                                             \
+	((CONFIG_SENSOR_REPORT_POLICY_MAX_COUNT + 1) *                         \
+	 SENSOR_GATEWAY_POLICY_ENTRY_SIZE)
+#define SENSOR_GATEWAY_SHADOW_SIZE(n)                                          \
+	(SENSOR_GATEWAY_SHADOW_BASE_SIZE + SENSOR_GATEWAY_POLICY_SIZE +        \
+	 ((n)*SENSOR_GATEWAY_SHADOW_ENTRY_SIZE))
+#define SENSOR_GATEWAY_SHADOW_MAX_SIZE                                         \
+	SENSOR_GATEWAY_SHADOW_SIZE(CONFIG_SENSOR_TABLE_MAX_SIZE)
 CHECK_BUFFER_SIZE(FWK_BUFFER_MSG_SIZE(JsonMsg_t,
 				      SENSOR_GATEWAY_SHADOW_MAX_SIZE));
 
-typedef struct SensorEntry {
+/* {"reported":{"bt510":{"aggregate":{"epoch":<epoch>,"seconds":<bucket>,
+ * "sensors":[["c13a7e4118a2",<count>,<minCc>,<maxCc>,<meanCc>], ....
+ */
+#define SENSOR_AGGREGATE_BASE_SIZE 128
+#define SENSOR_AGGREGATE_ENTRY_SIZE 64
+#define SENSOR_AGGREGATE_SIZE(n)                                               \
+	(SENSOR_AGGREGATE_BASE_SIZE + ((n)*SENSOR_AGGREGATE_ENTRY_SIZE))
+CHECK_BUFFER_SIZE(FWK_BUFFER_MSG_SIZE(
+	JsonMsg_t, SENSOR_AGGREGATE_SIZE(CONFIG_SENSOR_TABLE_MAX_SIZE)));
+
+/* The last value reported to AWS is cached for each field so that only
+ * the fields that have changed are published (AWS merges reported state).
+ * Each IG60 generated event has its own field.
+ */
+enum SHADOW_FIELD {
+	SHADOW_FIELD_BT_ADDR,
+	SHADOW_FIELD_RSSI,
+	SHADOW_FIELD_NETWORK_ID,
+	SHADOW_FIELD_FLAGS,
+	SHADOW_FIELD_FLAG_KEYS, /* the flags are also sent individually */
+	SHADOW_FIELD_RESET_COUNT,
+	SHADOW_FIELD_TEMPERATURE,
+	SHADOW_FIELD_BATTERY_VOLTAGE,
+	SHADOW_FIELD_RESET_REASON,
+	SHADOW_FIELD_EVENT_LOG_SIZE,
+	SHADOW_FIELD_EVENT_BASE,
+	SHADOW_FIELD_COUNT = SHADOW_FIELD_EVENT_BASE + SENSOR_EVENT_RESET + 1
+};
+BUILD_ASSERT(SHADOW_FIELD_COUNT <= 32, "Reported mask too small");
+
+/* The fields accessed for every advertisement are kept in a compact table
+ * so that searching it and filtering duplicate events touches as little
+ * memory as possible.  Everything else lives in the sensor (cold) table
+ * at the same index.
+ */
+typedef struct SensorHotEntry {
+	bt_addr_t addr;
+	uint16_t lastId;
 	bool inUse;
 	bool validAd;
+	uint32_t lastSeen; /* uptime in seconds */
+	uint32_t adCount;
+} SensorHotEntry_t;
+
+typedef struct SensorEntry {
 	bool validRsp;
 	bool updatedName;
 	bool updatedRsp;
@@ -103,37 +251,165 @@ typedef struct SensorEntry {
 	bool getAcceptedSubscribed;
 	bool shadowInitReceived;
 	uint64_t subscriptionDispatchTime;
-	uint32_t ttl;
 	void *pCmd;
 	void *pSecondCmd;
+	int64_t cmdDispatchTime; /* allows successive deltas to be merged */
 	bool configBusy;
 	uint32_t configBusyVersion;
 	bool dumpBusy;
 	bool firstDumpComplete;
-	uint32_t adCount;
-	uint16_t lastFlags;
+	bool gatewayDirty; /* rxEpoch or whitelist changed since last update */
+	uint32_t reportedValid; /* bit for each field in reported cache */
+	uint16_t reported[SHADOW_FIELD_COUNT];
+	uint32_t bytesSaved; /* by not sending unchanged fields */
+	SensorTwin_t *pTwin; /* config from last dump */
+	uint8_t pendingEvents; /* logged but not yet published */
+	uint8_t heldEvents; /* pending events held by the report policy */
+	bool customPolicy;
+	SensorReportPolicy_t policy; /* used if custom */
+	int32_t policyTemperature; /* last temperature published */
+	int64_t policyUptime; /* of last temperature publish */
+	SensorAggregate_t aggregate; /* temperature in current bucket */
+	char leaseOwner[SENSOR_LEASE_OWNER_SIZE]; /* gateway ID */
+	int8_t leaseRssi;
+	uint32_t leaseExpires; /* epoch */
+	int64_t leaseClaimUptime;
+	bool leaseKnown; /* read from the lease shadow */
+	uint32_t eventSequence; /* of the newest event in the log */
+	uint32_t ackedSequence; /* newest event that AWS has received */
+	uint32_t fullLogSequence; /* of the last publish containing eventLog */
+	bool fullLogRequired;
 	SensorLog_t *pLog;
 } SensorEntry_t;
 
 #define RSSI_UNKNOWN -127
 
+/* Whitelisted sensors are saved so that they can be restored after a reset
+ * without waiting for advertisements, the gateway shadow, and the sensor
+ * shadow (get accepted).
+ */
+#ifndef CONFIG_SENSOR_SNAPSHOT_DELAY_SECONDS
+#define CONFIG_SENSOR_SNAPSHOT_DELAY_SECONDS 10
+#endif
+
+#define SENSOR_SNAPSHOT_VERSION 1
+
+typedef struct SensorSnapshotEntry {
+	bool validAd;
+	bool validRsp;
+	uint16_t lastId;
+	uint8_t lastRecordType;
+	char name[SENSOR_NAME_MAX_SIZE];
+	Bt510AdEvent_t ad;
+	Bt510Rsp_t rsp;
+} __packed SensorSnapshotEntry_t;
+
+typedef struct SensorSnapshot {
+	uint8_t version;
+	uint8_t count;
+	SensorSnapshotEntry_t entries[];
+} __packed SensorSnapshot_t;
+
+#define SENSOR_SNAPSHOT_SIZE(n)                                                \
+	(sizeof(SensorSnapshot_t) + ((n) * sizeof(SensorSnapshotEntry_t)))
+
+/* An NV entry must fit in a flash sector. */
+#define SENSOR_SNAPSHOT_MAX_BYTES 3072
+#define SENSOR_SNAPSHOT_MAX_COUNT                                              \
+	((SENSOR_SNAPSHOT_MAX_BYTES - sizeof(SensorSnapshot_t)) /              \
+	 sizeof(SensorSnapshotEntry_t))
+
+/* The address indices are open-addressed (linear probing) hash tables.
+ * Keeping them at least twice the size of the sensor table keeps the
+ * probe sequences short.  A slot contains the table index + 1 so that
+ * zero can be used to mark an empty slot.
+ */
+#define SENSOR_INDEX_EMPTY 0
+BUILD_ASSERT(CONFIG_SENSOR_TABLE_MAX_SIZE < UINT8_MAX, "Index slot too small");
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+/* Each entry has a deadline for each type of work.  The key of a deadline
+ * is a combination of the table index and type.
+ */
+enum SENSOR_DEADLINE {
+	SENSOR_DEADLINE_TTL,
+	SENSOR_DEADLINE_SUBSCRIBE,
+	SENSOR_DEADLINE_GET_ACCEPTED,
+	SENSOR_DEADLINE_INIT_SHADOW,
+	SENSOR_DEADLINE_LEASE,
+	SENSOR_DEADLINE_SHADOW_WINDOW,
+	SENSOR_DEADLINE_REPORT_POLICY,
+	SENSOR_DEADLINE_COUNT
+};
+#define DEADLINE_KEY(i, type) (((i)*SENSOR_DEADLINE_COUNT) + (type))
+#define GATEWAY_SHADOW_DEADLINE_KEY (tableCapacity * SENSOR_DEADLINE_COUNT)
+#define LOG_STORE_DEADLINE_KEY (GATEWAY_SHADOW_DEADLINE_KEY + 1)
+#define SNAPSHOT_DEADLINE_KEY (LOG_STORE_DEADLINE_KEY + 1)
+#define AGGREGATE_DEADLINE_KEY (SNAPSHOT_DEADLINE_KEY + 1)
+#define NUMBER_OF_DEADLINE_KEYS (AGGREGATE_DEADLINE_KEY + 1)
+
+/* Keys that can be generated by more than one type of event.  When events
+ * are merged only the newest value is added to the shadow.
+ */
+#define SHADOW_KEY_TEMPERATURE BIT(0)
+#define SHADOW_KEY_BATTERY BIT(1)
+#define SHADOW_KEY_RESET BIT(2)
+
+typedef uint8_t SensorIndexSlot_t;
+typedef uint32_t (*SensorIndexHash_t)(size_t Index);
+
+/******************************************************************************/
+/* Global                                                                     */
+/******************************************************************************/
+extern struct k_msgq cloudAlarmQ;
+
 /******************************************************************************/
 /* Local Data Definitions                                                     */
 /******************************************************************************/
 static size_t tableCount;
-static SensorEntry_t sensorTable[CONFIG_SENSOR_TABLE_SIZE];
+static size_t tableCapacity;
+static SensorHotEntry_t *hotTable;
+static SensorEntry_t *sensorTable;
 static char queryCmd[CONFIG_SENSOR_QUERY_CMD_MAX_SIZE];
-static uint64_t ttlUptime;
 static struct lte_status *pLte;
 static bool allowGatewayShadowGeneration;
+static bool gatewayShadowRemoved;
+static SensorReportPolicy_t defaultPolicy;
+static bool reportPolicyDirty; /* not yet in gateway shadow */
+/* Policies of sensors that aren't in the table (applied when added) */
+static SensorReportPolicyEntry_t
+	pendingPolicies[CONFIG_SENSOR_REPORT_POLICY_MAX_COUNT];
+static size_t pendingPolicyCount;
+static uint32_t heldReports;
+static uint32_t aggregateEpoch; /* start of current bucket */
+static uint32_t leaseSuppressed; /* publishes left to other gateways */
+static int64_t gatewayShadowUptime;
+static SensorDeadline_t *pDeadlines;
+static int64_t initShadowUptime;
+static SubscribeMsg_t *pSubscribeBatch;
+static SubscribeMsg_t *pUnsubscribeBatch;
+static size_t indexSize;
+static size_t indexMask;
+static SensorIndexSlot_t *addrIndex;
+static SensorIndexSlot_t *addrStringIndex;
 
 /******************************************************************************/
 /* Local Function Prototypes                                                  */
 /******************************************************************************/
+static void AllocateTable(void);
+static size_t IndexSize(size_t Capacity);
+static size_t TableBytes(size_t Capacity);
 static void ClearTable(void);
 static void ClearEntry(SensorEntry_t *pEntry);
+static void RemoveEntry(SensorEntry_t *pEntry);
 static void FreeCmdBuffers(SensorEntry_t *pEntry);
 static void FreeEntryBuffers(SensorEntry_t *pEntry);
+static size_t RestoreStoredEvents(SensorEntry_t *pEntry);
+static void RestoreSnapshot(void);
+static void SnapshotHandler(void);
+static void ScheduleSnapshot(void);
 
 static bool FindBt510Advertisement(AdHandle_t *pHandle);
 static bool FindBt510ScanResponse(AdHandle_t *pHandle);
@@ -142,12 +418,41 @@ static bool FindBt510CodedAdvertisement(AdHandle_t *pHandle);
 static size_t AddByScanResponse(const bt_addr_le_t *pAddr,
 				AdHandle_t *pNameHandle, Bt510Rsp_t *pRsp,
 				int8_t Rssi);
-static size_t AddByAddress(const bt_addr_t *pAddr);
+static size_t AddByAddress(const bt_addr_t *pAddr, uint32_t MinIdleSeconds);
 static void AddEntry(SensorEntry_t *pEntry, const bt_addr_t *pAddr,
 		     int8_t Rssi);
 static size_t FindTableIndex(const bt_addr_le_t *pAddr);
+static size_t FindTableIndexByString(const char *pAddrString);
+static size_t FindTableIndexByTopic(const char *pTopic);
 static size_t FindFirstFree(void);
+static size_t FindFreeEntry(uint32_t MinIdleSeconds);
+static size_t EvictLeastRecentlySeen(uint32_t MinIdleSeconds);
+static uint32_t UptimeSeconds(void);
+static SensorHotEntry_t *GetHotEntry(const SensorEntry_t *pEntry);
+
+static uint32_t Hash(const void *pData, size_t Length);
+static uint32_t AddrHash(size_t Index);
+static uint32_t AddrStringHash(size_t Index);
+static void IndexInsert(SensorIndexSlot_t *pIndex, uint32_t HashValue,
+			size_t Index);
+static void IndexRemove(SensorIndexSlot_t *pIndex, SensorIndexHash_t HashFn,
+			size_t Index);
 static void AdEventHandler(Bt510AdEvent_t *p, int8_t Rssi, uint32_t Index);
+static void LogEvent(size_t Index);
+static bool ReportPolicyHold(size_t Index);
+static void ReportPolicyPublished(SensorEntry_t *pEntry);
+static const SensorReportPolicy_t *GetReportPolicy(SensorEntry_t *pEntry);
+static bool SetReportPolicy(SensorEntry_t *pEntry,
+			    const SensorReportPolicy_t *pPolicy);
+static bool AddPendingPolicy(size_t Position, const char *pAddrString,
+			     const SensorReportPolicy_t *pPolicy);
+static void ApplyPendingPolicy(SensorEntry_t *pEntry);
+static void AggregateTemperature(SensorEntry_t *pEntry);
+static void AggregateHandler(void);
+static bool LeasesEnabled(void);
+static bool LeaseOwner(SensorEntry_t *pEntry);
+static void LeaseHandler(size_t Index);
+static void PublishLease(SensorEntry_t *pEntry, uint32_t Expires);
 
 static bool AddrMatch(const void *p, size_t Index);
 static bool AddrStringMatch(const char *str, size_t Index);
@@ -158,10 +463,20 @@ static bool NewEvent(uint16_t Id, size_t Index);
 static void SensorAddrToString(SensorEntry_t *pEntry);
 static bt_addr_t BtAddrStringToStruct(const char *pAddrString);
 
+static bool ShadowEnabled(SensorEntry_t *pEntry);
 static void ShadowMaker(SensorEntry_t *pEntry);
-static void ShadowTemperatureHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry);
-static void ShadowEventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry);
-static void ShadowIg60EventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry);
+static enum JSON_MSG_PRIORITY GetPriority(SensorEntry_t *pEntry);
+static bool AlarmPriority(uint8_t RecordType);
+static void SendToCloud(JsonMsg_t *pMsg, enum JSON_MSG_PRIORITY Priority);
+static void DropOldestAlarm(void);
+static void ShadowPendingEventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry);
+static void ShadowTemperatureHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+				     const SensorLogEvent_t *pEvent,
+				     uint32_t *pKeys);
+static void ShadowEventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+			       const SensorLogEvent_t *pEvent, uint32_t *pKeys);
+static void ShadowIg60EventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+				   const SensorLogEvent_t *pEvent);
 static void ShadowBtHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry);
 static void ShadowAdHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry);
 static void ShadowRspHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry);
@@ -169,32 +484,81 @@ static void ShadowFlagHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry);
 static void ShadowLogHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry);
 static void ShadowSpecialHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry);
 static void GatewayShadowMaker(bool WhitelistProcessed);
+static bool GatewayShadowChanged(size_t *pChanged);
 
 static char *MangleKey(const char *pKey, const char *pName);
 static uint32_t WhitelistByAddress(const char *pAddrString, bool NextState);
 static void Whitelist(SensorEntry_t *pEntry, bool NextState);
 
-static int32_t GetTemperature(SensorEntry_t *pEntry);
-static uint32_t GetBattery(SensorEntry_t *pEntry);
+static int32_t GetTemperature(uint16_t Data);
+static uint32_t GetBattery(uint16_t Data);
 static bool LowBatteryAlarm(SensorEntry_t *pEntry);
+static bool AlarmEvent(uint8_t RecordType);
+static bool TemperatureEvent(uint8_t RecordType);
+static SensorLogEvent_t AdToLogEvent(SensorEntry_t *pEntry);
+static bool FirstKey(uint32_t *pKeys, uint32_t Key);
+
+static bool ReportedChanged(SensorEntry_t *pEntry, enum SHADOW_FIELD Field,
+			    uint16_t Value);
+static void ReportUint32(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+			 enum SHADOW_FIELD Field, const char *pKey,
+			 uint32_t Value);
+static void ReportSigned32(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+			   enum SHADOW_FIELD Field, const char *pKey,
+			   int32_t Value);
+static void ReportPair(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+		       enum SHADOW_FIELD Field, uint16_t Value,
+		       const char *pKey, const char *pStr, bool IsString);
+static void ReportFlag(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+		       const char *pKey, uint16_t Changed, uint16_t Flags,
+		       uint32_t Mask, uint8_t Position);
 
 static void ConnectRequestHandler(size_t Index, bool Coded);
+static uint32_t GetFirmwareVersion(SensorEntry_t *pEntry);
+static SensorCmdMsg_t *MergeConfigRequest(SensorCmdMsg_t *pOlder,
+					  SensorCmdMsg_t *pNewer);
+static void CreateFirstRequest(SensorEntry_t *pEntry);
 static void CreateDumpRequest(SensorEntry_t *pEntry);
 static void CreateConfigRequest(SensorEntry_t *pEntry);
+static bool PublishReportedConfig(const char *pReported,
+				  const char *pAddrStr);
+static void AckMatchingConfig(SensorEntry_t *pEntry, SensorCmdMsg_t *pMsg);
 
 static uint32_t GetFlag(uint16_t Value, uint32_t Mask, uint8_t Position);
 
-static void PublishToGetAccepted(SensorEntry_t *pEntry);
+static void PublishToGetAccepted(SensorEntry_t *pEntry, const char *pFmt);
+
+static void Schedule(size_t Index, enum SENSOR_DEADLINE Type, int64_t Delay);
+static void ScheduleTimeToLive(size_t Index);
+static void ScheduleSubscription(size_t Index);
+static void ScheduleGatewayShadow(void);
+static void CancelDeadlines(size_t Index);
+static void TimeToLiveHandler(size_t Index);
+static void SubscriptionHandler(size_t Index);
+static void GetAcceptedSubscriptionHandler(size_t Index);
+static void InitShadowHandler(size_t Index);
+static void LeaseReadHandler(size_t Index);
+static void ShadowWindowHandler(size_t Index);
+static void ReportPolicyHandler(size_t Index);
+static void GatewayShadowDeadlineHandler(void);
+
+static bool BatchSubscription(size_t Index, bool Subscribe, const char *pFmt);
+static void SendSubscriptionBatch(SubscribeMsg_t **ppMsg);
+static void SubscriptionAck(bool Subscribe, SubscribeTopic_t *pTopic);
 
 /******************************************************************************/
 /* Global Function Definitions                                                */
 /******************************************************************************/
 void SensorTable_Initialize(void)
 {
+	AllocateTable();
 	ClearTable();
 	strncpy(queryCmd, SENSOR_CMD_DEFAULT_QUERY,
 		CONFIG_SENSOR_QUERY_CMD_MAX_SIZE - 1);
 	pLte = lteGetStatus();
+	SensorReportPolicy_GetDefault(&defaultPolicy);
+	SensorLogStore_Initialize();
+	RestoreSnapshot();
 }
 
 bool SensorTable_MatchBt510(struct net_buf_simple *ad)
@@ -235,7 +599,7 @@ void SensorTable_AdvertisementHandler(const bt_addr_le_t *pAddr, int8_t rssi,
 	}
 
 	AdHandle_t nameHandle = AdFind_Name(pAd->data, pAd->len);
-	size_t tableIndex = CONFIG_SENSOR_TABLE_SIZE;
+	size_t tableIndex = tableCapacity;
 	/* Take name from scan response and use it to populate table.
 	 * If device is already in table, then check if any fields need to be updated.
 	 */
@@ -253,16 +617,18 @@ void SensorTable_AdvertisementHandler(const bt_addr_le_t *pAddr, int8_t rssi,
 
 	if (FindBt510Advertisement(&manHandle)) {
 		size_t tableIndex = FindTableIndex(pAddr);
-		if (tableIndex < CONFIG_SENSOR_TABLE_SIZE) {
+		if (tableIndex < tableCapacity) {
 			FRAMEWORK_DEBUG_ASSERT(
-				memcmp(sensorTable[tableIndex].ad.addr.val,
+				memcmp(hotTable[tableIndex].addr.val,
 				       pAddr->a.val, sizeof(bt_addr_t)) == 0);
 		} else {
 			/* Try to populate table with sensor (without name and scan rsp) */
-			tableIndex = AddByAddress(&pAddr->a);
+			tableIndex = AddByAddress(
+				&pAddr->a,
+				CONFIG_SENSOR_EVICTION_MIN_IDLE_SECONDS);
 		}
 
-		if (tableIndex < CONFIG_SENSOR_TABLE_SIZE) {
+		if (tableIndex < tableCapacity) {
 			Bt510AdEvent_t *pAd =
 				(Bt510AdEvent_t *)manHandle.pPayload;
 			AdEventHandler(pAd, rssi, tableIndex);
@@ -277,18 +643,18 @@ void SensorTable_AdvertisementHandler(const bt_addr_le_t *pAddr, int8_t rssi,
 			tableIndex = AddByScanResponse(pAddr, &nameHandle,
 						       &pCoded->rsp, rssi);
 
-			if (tableIndex < CONFIG_SENSOR_TABLE_SIZE) {
+			if (tableIndex < tableCapacity) {
 				AdEventHandler(&pCoded->ad, rssi, tableIndex);
 			}
 		}
 	}
 
-	if (tableIndex < CONFIG_SENSOR_TABLE_SIZE) {
+	if (tableIndex < tableCapacity) {
 		ConnectRequestHandler(tableIndex, coded);
-		sensorTable[tableIndex].adCount += 1;
+		hotTable[tableIndex].adCount += 1;
 		VERBOSE_AD_LOG("'%s' %u",
 			       log_strdup(sensorTable[tableIndex].name),
-			       sensorTable[tableIndex].adCount);
+			       hotTable[tableIndex].adCount);
 	}
 }
 
@@ -308,28 +674,120 @@ void SensorTable_ProcessWhitelistRequest(SensorWhitelistMsg_t *pMsg)
 	}
 }
 
-DispatchResult_t SensorTable_AddConfigRequest(SensorCmdMsg_t *pMsg)
+void SensorTable_ProcessReportPolicyMsg(SensorReportPolicyMsg_t *pMsg)
 {
+	SensorReportPolicy_t policy;
+	if (pMsg->defaultFound) {
+		policy = pMsg->defaultPolicy;
+	} else {
+		SensorReportPolicy_GetDefault(&policy);
+	}
+	bool changed = (memcmp(&policy, &defaultPolicy, sizeof(policy)) != 0);
+	defaultPolicy = policy;
+
+	/* Sensors that aren't in the message use the default policy.
+	 * The policies of sensors that aren't in the table are kept (and
+	 * reported) until they are added.
+	 */
+	bool custom[CONFIG_SENSOR_TABLE_MAX_SIZE] = { 0 };
+	size_t pending = 0;
 	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
-		if (AddrStringMatch(pMsg->addrString, i)) {
-			break;
+	for (i = 0; i < pMsg->sensorCount; i++) {
+		SensorReportPolicyEntry_t *p = &pMsg->sensors[i];
+		size_t index = FindTableIndexByString(p->addrString);
+		if (index < tableCapacity) {
+			custom[index] = true;
+			changed |= SetReportPolicy(&sensorTable[index],
+						   &p->policy);
+		} else {
+			LOG_INF("Report policy for '%s' is pending",
+				log_strdup(p->addrString));
+			changed |= AddPendingPolicy(pending++, p->addrString,
+						    &p->policy);
 		}
 	}
+	changed |= (pending != pendingPolicyCount);
+	pendingPolicyCount = pending;
+	for (i = 0; i < tableCapacity; i++) {
+		if (!custom[i]) {
+			changed |= SetReportPolicy(&sensorTable[i], NULL);
+		}
+	}
+	LOG_INF("Report policy deadband %u cC %u%% interval %u s heartbeat %u s"
+		" (%u sensors with their own)",
+		defaultPolicy.deadbandCc, defaultPolicy.deadbandPercent,
+		defaultPolicy.minIntervalSeconds, defaultPolicy.heartbeatSeconds,
+		pMsg->sensorCount);
+
+	/* The accepted policy is reported so that it can be restored
+	 * after a reset (and to clear the delta).
+	 */
+	if (changed) {
+		reportPolicyDirty = true;
+		GatewayShadowMaker(true);
+	}
+}
+
+void SensorTable_ProcessLeaseMsg(SensorLeaseMsg_t *pMsg)
+{
+	size_t i = FindTableIndexByString(pMsg->addrString);
+	if (i >= tableCapacity) {
+		LOG_ERR("Lease sensor not found");
+		return;
+	}
+
+	SensorEntry_t *p = &sensorTable[i];
+	if (pMsg->owner[0] != 0 && strcmp(p->leaseOwner, pMsg->owner) != 0) {
+		LOG_INF("'%s' is owned by gateway %s until %u",
+			log_strdup(p->addrString), log_strdup(pMsg->owner),
+			pMsg->expires);
+	}
+	strncpy(p->leaseOwner, pMsg->owner, SENSOR_LEASE_OWNER_LEN);
+	p->leaseRssi = (int8_t)MAX(MIN(pMsg->rssi, INT8_MAX), INT8_MIN);
+	p->leaseExpires = pMsg->expires;
+
+	/* The sensor is read (or configured) once the owner is known. */
+	if (!p->leaseKnown) {
+		p->leaseKnown = true;
+		SensorDeadline_Cancel(pDeadlines,
+				      DEADLINE_KEY(i, SENSOR_DEADLINE_LEASE));
+		CreateFirstRequest(p);
+	}
+}
 
-	if (i >= CONFIG_SENSOR_TABLE_SIZE) {
+DispatchResult_t SensorTable_AddConfigRequest(SensorCmdMsg_t *pMsg)
+{
+	size_t i = FindTableIndexByString(pMsg->addrString);
+	if (i >= tableCapacity) {
 		LOG_ERR("Config request sensor not found");
 		return DISPATCH_ERROR;
 	}
 
 	SensorEntry_t *p = &sensorTable[i];
 
+	/* Every gateway receives the delta, but only the owner connects. */
+	if (!LeaseOwner(p)) {
+		LOG_INF("Config for '%s' is left to gateway %s",
+			log_strdup(p->addrString), log_strdup(p->leaseOwner));
+		if (pMsg->dumpRequest) {
+			p->dumpBusy = false;
+		}
+		return DISPATCH_OK;
+	}
+
 	if (LowBatteryAlarm(p)) {
 		/* A sensor in low battery mode is unable to write flash. */
 		LOG_WRN("Unable to accept config for sensor in low battery mode");
 		return DISPATCH_OK;
 	}
 
+	/* A connection isn't required if the sensor already has the config. */
+	if (!pMsg->dumpRequest && !pMsg->setEpochRequest &&
+	    p->pTwin != NULL && SensorTwin_Matches(p->pTwin, pMsg->cmd)) {
+		AckMatchingConfig(p, pMsg);
+		return DISPATCH_OK;
+	}
+
 	if (pMsg->dumpRequest) {
 		pMsg->resetRequest = false;
 	} else if (p->rsp.firmwareVersionMajor >=
@@ -350,9 +808,35 @@ DispatchResult_t SensorTable_AddConfigRequest(SensorCmdMsg_t *pMsg)
 		if (p->configBusy || p->pCmd != NULL) {
 			if (!pMsg->dumpRequest &&
 			    (p->configBusyVersion != pMsg->configVersion)) {
+				/* Successive deltas are combined into one
+				 * command (and connection).
+				 */
+				SensorCmdMsg_t *pMerged = NULL;
+				if (!p->configBusy) {
+					pMerged = MergeConfigRequest(p->pCmd,
+								     pMsg);
+				}
+				if (pMerged != NULL) {
+					LOG_INF("Merged config for sensor '%s' Version: %u",
+						log_strdup(p->name),
+						pMerged->configVersion);
+					p->pCmd = pMerged;
+					p->cmdDispatchTime =
+						k_uptime_get() + COALESCE_MS;
+					return DISPATCH_DO_NOT_FREE;
+				}
+
 				LOG_WRN("(Config Busy) Saving config for sensor '%s' Version: %u",
 					log_strdup(p->name),
 					pMsg->configVersion);
+				if (p->pSecondCmd != NULL) {
+					pMerged = MergeConfigRequest(
+						p->pSecondCmd, pMsg);
+				}
+				if (pMerged != NULL) {
+					p->pSecondCmd = pMerged;
+					return DISPATCH_DO_NOT_FREE;
+				}
 				/* Delete any oustanding command. */
 				if (p->pSecondCmd != NULL) {
 					BufferPool_Free(p->pSecondCmd);
@@ -368,6 +852,8 @@ DispatchResult_t SensorTable_AddConfigRequest(SensorCmdMsg_t *pMsg)
 				LOG_WRN("New config for sensor '%s' Version: %u",
 					log_strdup(p->name),
 					pMsg->configVersion);
+				p->cmdDispatchTime =
+					k_uptime_get() + COALESCE_MS;
 			}
 			p->pCmd = pMsg;
 			return DISPATCH_DO_NOT_FREE;
@@ -381,9 +867,9 @@ DispatchResult_t SensorTable_AddConfigRequest(SensorCmdMsg_t *pMsg)
 DispatchResult_t SensorTable_RetryConfigRequest(SensorCmdMsg_t *pMsg)
 {
 	FRAMEWORK_ASSERT(pMsg != NULL);
-	FRAMEWORK_ASSERT(pMsg->tableIndex < CONFIG_SENSOR_TABLE_SIZE);
+	FRAMEWORK_ASSERT(pMsg->tableIndex < tableCapacity);
 
-	if (pMsg->tableIndex < CONFIG_SENSOR_TABLE_SIZE) {
+	if (pMsg->tableIndex < tableCapacity) {
 		SensorEntry_t *pEntry = &sensorTable[pMsg->tableIndex];
 		pEntry->configBusy = false;
 		pEntry->pCmd = pMsg;
@@ -394,9 +880,9 @@ DispatchResult_t SensorTable_RetryConfigRequest(SensorCmdMsg_t *pMsg)
 void SensorTable_AckConfigRequest(SensorCmdMsg_t *pMsg)
 {
 	FRAMEWORK_ASSERT(pMsg != NULL);
-	FRAMEWORK_ASSERT(pMsg->tableIndex < CONFIG_SENSOR_TABLE_SIZE);
+	FRAMEWORK_ASSERT(pMsg->tableIndex < tableCapacity);
 
-	if (pMsg->tableIndex < CONFIG_SENSOR_TABLE_SIZE) {
+	if (pMsg->tableIndex < tableCapacity) {
 		SensorEntry_t *pEntry = &sensorTable[pMsg->tableIndex];
 		/* After AWS config was written and sensor was reset,
 		 * send dump request to read state.
@@ -405,7 +891,7 @@ void SensorTable_AckConfigRequest(SensorCmdMsg_t *pMsg)
 		if (pEntry->pSecondCmd != NULL) {
 			pEntry->pCmd = pEntry->pSecondCmd;
 			pEntry->pSecondCmd = NULL;
-		} else if (pMsg->dumpRequest) {
+		} else if (pMsg->dumpRequest || pMsg->readbackComplete) {
 			pEntry->dumpBusy = false;
 			pEntry->firstDumpComplete = true;
 		} else {
@@ -416,6 +902,16 @@ void SensorTable_AckConfigRequest(SensorCmdMsg_t *pMsg)
 	BufferPool_Free(pMsg);
 }
 
+const char *SensorTable_GetQueryCmd(void)
+{
+	/* If an empty command is written by cloud, then send dump command. */
+	if (strlen(queryCmd) != 0) {
+		return queryCmd;
+	} else {
+		return SENSOR_CMD_DUMP;
+	}
+}
+
 void SensorTable_EnableGatewayShadowGeneration(void)
 {
 	allowGatewayShadowGeneration = true;
@@ -429,163 +925,194 @@ void SensorTable_DisableGatewayShadowGeneration(void)
 void SensorTable_DecomissionHandler(void)
 {
 	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
+	SensorLogStore_DeleteAll();
+	for (i = 0; i < tableCapacity; i++) {
 		Whitelist(&sensorTable[i], false);
 		sensorTable[i].shadowInitReceived = false;
 		sensorTable[i].firstDumpComplete = false;
 	}
+	SensorDeadline_Cancel(pDeadlines, SNAPSHOT_DEADLINE_KEY);
+	nvDeleteSensorSnapshot();
 }
 
 void SensorTable_UnsubscribeAll(void)
 {
 	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
+	for (i = 0; i < tableCapacity; i++) {
 		sensorTable[i].subscribed = false;
 		sensorTable[i].getAcceptedSubscribed = false;
+		/* Updates that were queued when the connection was lost may not
+		 * have been sent.
+		 */
+		sensorTable[i].reportedValid = 0;
+		SensorTwin_Clear(sensorTable[i].pTwin);
+		ScheduleSubscription(i);
 	}
 }
 
-void SensorTable_SubscriptionHandler(void)
+void SensorTable_ProcessShadowInitMsg(SensorShadowInitMsg_t *pMsg)
 {
-	char *fmt = SENSOR_SUBSCRIPTION_TOPIC_FMT_STR;
-	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
-		SensorEntry_t *pEntry = &sensorTable[i];
-		/* Waiting until AD and RSP are valid makes things easier for config.
-		 * When subscribing there must be a delay to allow AWS to configure
-		 * permissions.
-		 */
-		if (pEntry->validAd && pEntry->validRsp &&
-		    (pEntry->whitelisted != pEntry->subscribed) &&
-		    (pEntry->subscriptionDispatchTime <= k_uptime_get())) {
-			SubscribeMsg_t *pMsg =
-				BufferPool_Take(sizeof(SubscribeMsg_t));
-			if (pMsg != NULL) {
-				pMsg->header.msgCode = FMC_SUBSCRIBE;
-				pMsg->header.rxId = FWK_ID_CLOUD;
-				pMsg->header.txId = FWK_ID_SENSOR_TASK;
-				pMsg->subscribe = pEntry->whitelisted;
-				pMsg->tableIndex = i;
-				pMsg->length =
-					snprintk(pMsg->topic,
-						 CONFIG_AWS_TOPIC_MAX_SIZE, fmt,
-						 pEntry->addrString);
-				FRAMEWORK_MSG_SEND(pMsg);
-				/* For now, assume the subscription will work. */
-				pEntry->subscribed = pEntry->whitelisted;
-			}
+	size_t i = FindTableIndexByString(pMsg->addrString);
+	if (i >= tableCapacity) {
+		LOG_ERR("Shadow Init sensor not found");
+		return;
+	}
+
+	SensorEntry_t *p = &sensorTable[i];
+	p->shadowInitReceived = true;
+	SensorDeadline_Cancel(pDeadlines,
+			      DEADLINE_KEY(i, SENSOR_DEADLINE_INIT_SHADOW));
+
+	/* To keep things simple, throw away the table.
+	 * The sequence number continues from the shadow so that it doesn't
+	 * restart after a reset.  It is only taken when the log is replaced
+	 * because it must be that of the newest event in the log (stored
+	 * events after it are replayed).
+	 */
+	if (pMsg->eventCount > 0) {
+		SensorLog_Free(p->pLog);
+		p->pLog = SensorLog_Allocate(CONFIG_SENSOR_LOG_MAX_SIZE);
+		p->pendingEvents = 0;
+		p->heldEvents = 0;
+		p->reportedValid = 0;
+		for (i = 0; i < pMsg->eventCount; i++) {
+			FRAMEWORK_ASSERT(pMsg->events[i].epoch != 0);
+			SensorLog_Add(p->pLog, &pMsg->events[i]);
 		}
+		if (pMsg->sequence != 0) {
+			p->eventSequence = pMsg->sequence;
+		}
+	}
+
+	/* The events in the shadow have already been published.
+	 * The first publish after init contains the entire log so that the
+	 * cloud can resynchronize to the sequence number.
+	 */
+	p->ackedSequence = p->eventSequence;
+	p->fullLogRequired = true;
+	RestoreStoredEvents(p);
+}
+
+void SensorTable_PublishAckHandler(SensorPublishAckMsg_t *pMsg)
+{
+	/* A lease claim isn't part of the sensor shadow. */
+	size_t i = FindTableIndexByTopic(pMsg->topic);
+	if (i >= tableCapacity ||
+	    strstr(pMsg->topic, SENSOR_LEASE_SUB_STR) != NULL) {
+		return;
+	}
+
+	/* The reported cache (and the config twin) was updated when the
+	 * shadow was built.  The fields in a failed update must be sent again.
+	 */
+	SensorEntry_t *p = &sensorTable[i];
+	if (!pMsg->success) {
+		LOG_WRN("Publish of events up to %u failed for %s",
+			pMsg->sequence, log_strdup(p->addrString));
+		p->reportedValid = 0;
+		SensorTwin_Clear(p->pTwin);
+		return;
+	}
+
+	/* Acks can't be ahead of the log.  The unsigned difference
+	 * handles sequence number roll-over.
+	 */
+	if ((pMsg->sequence - p->ackedSequence) <=
+	    (p->eventSequence - p->ackedSequence)) {
+		p->ackedSequence = pMsg->sequence;
+	}
+	if (p->fullLogRequired && pMsg->sequence == p->fullLogSequence) {
+		p->fullLogRequired = false;
 	}
 }
 
-void SensorTable_GetAcceptedSubscriptionHandler(void)
+void SensorTable_RequestFullEventLog(void)
 {
-	char *fmt = SENSOR_GET_ACCEPTED_TOPIC_FMT_STR;
 	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
-		SensorEntry_t *pEntry = &sensorTable[i];
-		if (pEntry->subscribed && !pEntry->getAcceptedSubscribed &&
-		    !pEntry->shadowInitReceived &&
-		    (pEntry->subscriptionDispatchTime <= k_uptime_get())) {
-			SubscribeMsg_t *pMsg =
-				BufferPool_Take(sizeof(SubscribeMsg_t));
-			if (pMsg != NULL) {
-				pMsg->header.msgCode = FMC_SUBSCRIBE;
-				pMsg->header.rxId = FWK_ID_CLOUD;
-				pMsg->header.txId = FWK_ID_SENSOR_TASK;
-				pMsg->subscribe = true;
-				pMsg->tableIndex = i;
-				pMsg->length =
-					snprintk(pMsg->topic,
-						 CONFIG_AWS_TOPIC_MAX_SIZE, fmt,
-						 pEntry->addrString);
-				FRAMEWORK_MSG_SEND(pMsg);
-			}
-		}
+	for (i = 0; i < tableCapacity; i++) {
+		sensorTable[i].fullLogRequired = true;
 	}
 }
 
-void SensorTable_InitShadowHandler(void)
+void SensorTable_PublishDroppedHandler(void)
 {
 	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
-		SensorEntry_t *pEntry = &sensorTable[i];
-		if (pEntry->getAcceptedSubscribed &&
-		    !pEntry->shadowInitReceived) {
-			PublishToGetAccepted(pEntry);
-			/* Limit to one because it is memory intensive. */
-			return;
-		}
+	for (i = 0; i < tableCapacity; i++) {
+		sensorTable[i].reportedValid = 0;
+		SensorTwin_Clear(sensorTable[i].pTwin);
 	}
 }
 
-void SensorTable_ProcessShadowInitMsg(SensorShadowInitMsg_t *pMsg)
+void SensorTable_SubscriptionAckHandler(SubscribeMsg_t *pMsg)
 {
 	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
-		if (AddrStringMatch(pMsg->addrString, i)) {
-			break;
-		}
+	for (i = 0; i < MIN(pMsg->count, CONFIG_SENSOR_SUBSCRIBE_BATCH_MAX_SIZE);
+	     i++) {
+		SubscriptionAck(pMsg->subscribe, &pMsg->topics[i]);
 	}
+}
 
-	if (i >= CONFIG_SENSOR_TABLE_SIZE) {
-		LOG_ERR("Shadow Init sensor not found");
+void SensorTable_CreateShadowFromDumpResponse(const char *pRsp,
+					      size_t Length,
+					      const char *pAddrStr)
+{
+	SensorEntry_t *pEntry = NULL;
+	size_t i = FindTableIndexByString(pAddrStr);
+	if (i < tableCapacity) {
+		pEntry = &sensorTable[i];
+		if (pEntry->whitelisted && pEntry->pTwin == NULL) {
+			pEntry->pTwin = SensorTwin_Allocate();
+		}
+	}
+	if (pEntry == NULL || pEntry->pTwin == NULL) {
+		PublishReportedConfig(pRsp, pAddrStr);
 		return;
 	}
 
-	SensorEntry_t *p = &sensorTable[i];
-	p->shadowInitReceived = true;
-
-	/* To keep things simple, throw away the table. */
-	if (pMsg->eventCount > 0) {
-		if (p->pLog != NULL) {
-			SensorLog_Free(p->pLog);
-		}
-		p->pLog = SensorLog_Allocate(CONFIG_SENSOR_LOG_MAX_SIZE);
-		for (i = 0; i < pMsg->eventCount; i++) {
-			FRAMEWORK_ASSERT(pMsg->events[i].epoch != 0);
-			SensorLog_Add(p->pLog, &pMsg->events[i]);
-		}
+	/* Only the values that changed are published ({} + NULL). */
+	size_t size = Length + 3;
+	char *pChanges = BufferPool_Take(size);
+	if (pChanges == NULL) {
+		PublishReportedConfig(pRsp, pAddrStr);
+		return;
 	}
-}
-
-void SensorTable_SubscriptionAckHandler(SubscribeMsg_t *pMsg)
-{
-	if (pMsg->tableIndex < CONFIG_SENSOR_TABLE_SIZE) {
-		SensorEntry_t *p = &sensorTable[pMsg->tableIndex];
 
-		if (strstr(pMsg->topic, SENSOR_GET_ACCEPTED_SUB_STR) != NULL) {
-			if (pMsg->success) {
-				p->getAcceptedSubscribed = true;
-			}
-		} else {
-			/* This is a delta subscription ack */
-			if (pMsg->success) {
-				if (p->subscribed) {
-					if (p->rsp.configVersion == 0) {
-						CreateConfigRequest(p);
-					} else if (!p->firstDumpComplete) {
-						CreateDumpRequest(p);
-					}
-				}
-			} else { /* Try again (most likely AWS disconnect has occurred) */
-				p->subscribed = !pMsg->subscribe;
-			}
+	int n = SensorTwin_Update(pEntry->pTwin, pRsp, &pChanges[1], size - 2);
+	if (n < 0) {
+		LOG_ERR("Unable to compare config of '%s' (%d)",
+			log_strdup(pAddrStr), n);
+		PublishReportedConfig(pRsp, pAddrStr);
+	} else {
+		pChanges[0] = '{';
+		pChanges[n + 1] = '}';
+		pChanges[n + 2] = 0;
+		pEntry->bytesSaved += Length - (n + 2);
+		LOG_INF("Config of '%s' has %d changed bytes (of %u)",
+			log_strdup(pAddrStr), n, Length);
+		/* The desired state is cleared even when nothing changed.
+		 * The twin already holds the changes, so it is cleared if
+		 * they can't be sent.
+		 */
+		if (!PublishReportedConfig((n > 0) ? pChanges : NULL,
+					   pAddrStr)) {
+			SensorTwin_Clear(pEntry->pTwin);
 		}
 	}
+	BufferPool_Free(pChanges);
 }
 
-void SensorTable_CreateShadowFromDumpResponse(FwkBufMsg_t *pRsp,
-					      const char *pAddrStr)
+/* pReported is a JSON object (or NULL to only clear the desired state) */
+static bool PublishReportedConfig(const char *pReported, const char *pAddrStr)
 {
-	size_t size = JSON_DEFAULT_BUF_SIZE + pRsp->length + 1;
+	size_t length = (pReported == NULL) ? 0 : strlen(pReported);
+	size_t size = JSON_DEFAULT_BUF_SIZE + length + 1;
 	JsonMsg_t *pMsg = BufferPool_Take(FWK_BUFFER_MSG_SIZE(JsonMsg_t, size));
 	if (pMsg == NULL) {
-		return;
+		return false;
 	}
 	pMsg->header.msgCode = FMC_SENSOR_PUBLISH;
-	pMsg->header.rxId = FWK_ID_CLOUD;
 	pMsg->size = size;
+	pMsg->sequence = 0;
 
 	ShadowBuilder_Start(pMsg, SKIP_MEMSET);
 	ShadowBuilder_StartGroup(pMsg, "state");
@@ -594,57 +1121,187 @@ void SensorTable_CreateShadowFromDumpResponse(FwkBufMsg_t *pRsp,
 	/* Add the entire response.  AWS app will ignore jsonrpc, id field,
 	 * and status fields.
 	 */
-	ShadowBuilder_AddString(pMsg, "reported", pRsp->buffer);
+	if (pReported != NULL) {
+		ShadowBuilder_AddString(pMsg, "reported", pReported);
+	}
 	ShadowBuilder_EndGroup(pMsg);
 	ShadowBuilder_Finalize(pMsg);
 
 	char *fmt = SENSOR_UPDATE_TOPIC_FMT_STR;
 	snprintk(pMsg->topic, CONFIG_AWS_TOPIC_MAX_SIZE, fmt, pAddrStr);
-	FRAMEWORK_MSG_SEND(pMsg);
+	SendToCloud(pMsg, JSON_MSG_PRIORITY_ROUTINE);
+	return true;
 }
 
-void SensorTable_TimeToLiveHandler(void)
+void SensorTable_DeadlineHandler(void)
 {
-	int64_t deltaS = k_uptime_delta(&ttlUptime) / (1 * MSEC_PER_SEC);
-	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
-		SensorEntry_t *p = &sensorTable[i];
-		if (p->inUse) {
-			p->ttl = (p->ttl > deltaS) ? (p->ttl - deltaS) : 0;
-			if (p->ttl == 0 && !p->whitelisted) {
-				LOG_WRN("Removing '%s' sensor %s from table",
-					log_strdup(p->name),
-					log_strdup(p->addrString));
-				ClearEntry(p);
-				FRAMEWORK_DEBUG_ASSERT(tableCount > 0);
-				tableCount -= 1;
-			}
+	int64_t now = k_uptime_get();
+	size_t key;
+	while (SensorDeadline_PopExpired(pDeadlines, now, &key)) {
+		if (key == GATEWAY_SHADOW_DEADLINE_KEY) {
+			GatewayShadowDeadlineHandler();
+			continue;
+		}
+
+		if (key == LOG_STORE_DEADLINE_KEY) {
+			SensorLogStore_Flush();
+			continue;
+		}
+
+		if (key == SNAPSHOT_DEADLINE_KEY) {
+			SnapshotHandler();
+			continue;
+		}
+
+		if (key == AGGREGATE_DEADLINE_KEY) {
+			AggregateHandler();
+			continue;
+		}
+
+		size_t i = key / SENSOR_DEADLINE_COUNT;
+		switch (key % SENSOR_DEADLINE_COUNT) {
+		case SENSOR_DEADLINE_TTL:
+			TimeToLiveHandler(i);
+			break;
+		case SENSOR_DEADLINE_SUBSCRIBE:
+			SubscriptionHandler(i);
+			break;
+		case SENSOR_DEADLINE_GET_ACCEPTED:
+			GetAcceptedSubscriptionHandler(i);
+			break;
+		case SENSOR_DEADLINE_INIT_SHADOW:
+			InitShadowHandler(i);
+			break;
+		case SENSOR_DEADLINE_LEASE:
+			LeaseReadHandler(i);
+			break;
+		case SENSOR_DEADLINE_SHADOW_WINDOW:
+			ShadowWindowHandler(i);
+			break;
+		case SENSOR_DEADLINE_REPORT_POLICY:
+			ReportPolicyHandler(i);
+			break;
+		default:
+			break;
 		}
 	}
+
+	SendSubscriptionBatch(&pSubscribeBatch);
+	SendSubscriptionBatch(&pUnsubscribeBatch);
+}
+
+int64_t SensorTable_NextDeadline(void)
+{
+	return SensorDeadline_Next(pDeadlines);
 }
 
 /******************************************************************************/
 /* Local Function Definitions                                                 */
 /******************************************************************************/
 
+/* The capacity of the table is read from non-volatile memory so that it
+ * can be changed without rebuilding.  All of the arrays are taken from
+ * the system heap in a single allocation.
+ */
+static void AllocateTable(void)
+{
+	uint16_t size = CONFIG_SENSOR_TABLE_SIZE;
+	if (nvReadSensorTableSize(&size) <= 0) {
+		size = CONFIG_SENSOR_TABLE_SIZE;
+	}
+	if (size == 0 || size > CONFIG_SENSOR_TABLE_MAX_SIZE) {
+		LOG_WRN("Invalid sensor table size %u", size);
+		size = CONFIG_SENSOR_TABLE_SIZE;
+	}
+
+	uint8_t *p = k_calloc(1, TableBytes(size));
+	if (p == NULL && size != CONFIG_SENSOR_TABLE_SIZE) {
+		LOG_ERR("Unable to allocate sensor table of size %u", size);
+		size = CONFIG_SENSOR_TABLE_SIZE;
+		p = k_calloc(1, TableBytes(size));
+	}
+	FRAMEWORK_ASSERT(p != NULL);
+	if (p == NULL) {
+		return;
+	}
+
+	tableCapacity = size;
+	indexSize = IndexSize(size);
+	indexMask = indexSize - 1;
+	sensorTable = (SensorEntry_t *)p;
+	p += size * sizeof(SensorEntry_t);
+	hotTable = (SensorHotEntry_t *)p;
+	p += size * sizeof(SensorHotEntry_t);
+	addrIndex = (SensorIndexSlot_t *)p;
+	p += indexSize * sizeof(SensorIndexSlot_t);
+	addrStringIndex = (SensorIndexSlot_t *)p;
+	LOG_INF("Sensor table capacity %u", tableCapacity);
+
+	pDeadlines = SensorDeadline_Allocate(NUMBER_OF_DEADLINE_KEYS);
+	FRAMEWORK_ASSERT(pDeadlines != NULL);
+}
+
+/* Power of two that is at least twice the table size */
+static size_t IndexSize(size_t Capacity)
+{
+	size_t size = 1;
+	while (size < (2 * Capacity)) {
+		size <<= 1;
+	}
+	return size;
+}
+
+static size_t TableBytes(size_t Capacity)
+{
+	return (Capacity * (sizeof(SensorEntry_t) + sizeof(SensorHotEntry_t))) +
+	       (2 * IndexSize(Capacity) * sizeof(SensorIndexSlot_t));
+}
+
 /* The purpose of the table is to keep track of the event id and
  * associate names with addresses.
  */
 static void ClearTable(void)
 {
 	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
+	for (i = 0; i < tableCapacity; i++) {
 		ClearEntry(&sensorTable[i]);
 	}
+	memset(addrIndex, SENSOR_INDEX_EMPTY,
+	       indexSize * sizeof(SensorIndexSlot_t));
+	memset(addrStringIndex, SENSOR_INDEX_EMPTY,
+	       indexSize * sizeof(SensorIndexSlot_t));
 	tableCount = 0;
 }
 
 static void ClearEntry(SensorEntry_t *pEntry)
 {
+	SensorHotEntry_t *pHot = GetHotEntry(pEntry);
+	size_t index = pEntry - sensorTable;
+	if (pHot->inUse) {
+		IndexRemove(addrIndex, AddrHash, index);
+		IndexRemove(addrStringIndex, AddrStringHash, index);
+	}
+	CancelDeadlines(index);
 	FreeEntryBuffers(pEntry);
+	memset(pHot, 0, sizeof(SensorHotEntry_t));
 	memset(pEntry, 0, sizeof(SensorEntry_t));
 }
 
+static void RemoveEntry(SensorEntry_t *pEntry)
+{
+	if (pEntry->customPolicy &&
+	    pendingPolicyCount < CONFIG_SENSOR_REPORT_POLICY_MAX_COUNT) {
+		AddPendingPolicy(pendingPolicyCount++, pEntry->addrString,
+				 &pEntry->policy);
+	}
+	reportPolicyDirty |= pEntry->customPolicy;
+	ClearEntry(pEntry);
+	FRAMEWORK_DEBUG_ASSERT(tableCount > 0);
+	tableCount -= 1;
+	gatewayShadowRemoved = true;
+	ScheduleGatewayShadow();
+}
+
 static void FreeCmdBuffers(SensorEntry_t *pEntry)
 {
 	if (pEntry->pCmd != NULL) {
@@ -661,44 +1318,520 @@ static void FreeEntryBuffers(SensorEntry_t *pEntry)
 {
 	FreeCmdBuffers(pEntry);
 
-	if (pEntry->pLog != NULL) {
-		SensorLog_Free(pEntry->pLog);
-		pEntry->pLog = NULL;
-	}
+	SensorLog_Free(pEntry->pLog);
+	pEntry->pLog = NULL;
+
+	SensorTwin_Free(pEntry->pTwin);
+	pEntry->pTwin = NULL;
 }
 
-static void AdEventHandler(Bt510AdEvent_t *p, int8_t Rssi, uint32_t Index)
+/* Events that were stored after the last shadow update (before a reset)
+ * are restored and then published.
+ */
+static size_t RestoreStoredEvents(SensorEntry_t *pEntry)
 {
-	sensorTable[Index].ttl = CONFIG_SENSOR_TTL_SECONDS;
-	if (NewEvent(p->id, Index)) {
-		sensorTable[Index].validAd = true;
-		LOG_DBG("New Event for [%u] '%s' (%s) RSSI: %d", Index,
-			log_strdup(sensorTable[Index].name),
-			log_strdup(sensorTable[Index].addrString), Rssi);
-		sensorTable[Index].lastRecordType =
-			sensorTable[Index].ad.recordType;
-		memcpy(&sensorTable[Index].ad, p, sizeof(Bt510AdEvent_t));
-		sensorTable[Index].rssi = Rssi;
-		/* If event occurs before epoch is set, then AWS shows ~1970. */
-		sensorTable[Index].rxEpoch = Qrtc_GetEpoch();
-		ShadowMaker(&sensorTable[Index]);
-		/* The cloud uses the RX epoch (in the table) for filtering. */
-		GatewayShadowMaker(false);
+	if (pEntry->pLog == NULL) {
+		return 0;
 	}
+
+	size_t restored = SensorLogStore_Replay(
+		pEntry->addrString, pEntry->pLog, &pEntry->eventSequence);
+	pEntry->pendingEvents = MIN(pEntry->pendingEvents + restored,
+				    CONFIG_SENSOR_LOG_MAX_SIZE);
+	return restored;
 }
 
-/* The BT510 advertisement can be recognized by the manufacturer
- * specific data type with LAIRD as the company ID.
- * It is further qualified by having a length of 27 and matching protocol ID.
+/* If the event log can be restored from the file system, then the sensor
+ * shadow doesn't need to be read before publishing.  Subscriptions are
+ * always made again because the MQTT session is new.
  */
-static bool FindBt510Advertisement(AdHandle_t *pHandle)
+static void RestoreSnapshot(void)
 {
-	if (pHandle->pPayload != NULL) {
-		if ((pHandle->size == BT510_MSD_AD_PAYLOAD_LENGTH)) {
-			if (memcmp(pHandle->pPayload, BT510_AD_HEADER,
-				   sizeof(BT510_AD_HEADER)) == 0) {
-				return true;
-			}
+	SensorSnapshot_t *pSnapshot =
+		k_malloc(SENSOR_SNAPSHOT_SIZE(tableCapacity));
+	if (pSnapshot == NULL) {
+		return;
+	}
+
+	/* NVS returns the length of the stored item, which is larger than
+	 * the buffer if the table size was reduced since the snapshot was
+	 * saved.  Only the entries that were read are restored.
+	 */
+	int rc = nvReadSensorSnapshot(pSnapshot,
+				      SENSOR_SNAPSHOT_SIZE(tableCapacity));
+	if (rc < (int)sizeof(SensorSnapshot_t) ||
+	    pSnapshot->version != SENSOR_SNAPSHOT_VERSION ||
+	    rc != SENSOR_SNAPSHOT_SIZE(pSnapshot->count)) {
+		k_free(pSnapshot);
+		return;
+	}
+	if (pSnapshot->count > tableCapacity) {
+		LOG_WRN("Snapshot has %u sensors, table has room for %u",
+			pSnapshot->count, tableCapacity);
+	}
+
+	/* Replaying the stored events of a full table should take well under
+	 * a second.
+	 */
+	int64_t start = k_uptime_get();
+	size_t events = 0;
+	size_t count = MIN(pSnapshot->count, tableCapacity);
+	size_t n;
+	for (n = 0; n < count; n++) {
+		SensorSnapshotEntry_t *s = &pSnapshot->entries[n];
+		size_t i = AddByAddress(&s->ad.addr, 0);
+		if (i >= tableCapacity) {
+			break;
+		}
+		SensorEntry_t *p = &sensorTable[i];
+		hotTable[i].validAd = s->validAd;
+		hotTable[i].lastId = s->lastId;
+		p->validRsp = s->validRsp;
+		p->lastRecordType = s->lastRecordType;
+		memcpy(p->name, s->name, SENSOR_NAME_MAX_SIZE);
+		p->name[SENSOR_NAME_MAX_STR_LEN] = 0;
+		memcpy(&p->ad, &s->ad, sizeof(Bt510AdEvent_t));
+		memcpy(&p->rsp, &s->rsp, sizeof(Bt510Rsp_t));
+		Whitelist(p, true);
+		/* AWS permissions were configured before the reset. */
+		p->subscriptionDispatchTime = 0;
+		ScheduleSubscription(i);
+		if (SensorLogStore_IsAvailable()) {
+			p->shadowInitReceived = true;
+			p->fullLogRequired = true;
+			events += RestoreStoredEvents(p);
+		}
+	}
+	LOG_INF("Restored %u sensors (%u events) from snapshot in %u ms", n,
+		events, (uint32_t)(k_uptime_get() - start));
+	k_free(pSnapshot);
+}
+
+/* The event id isn't a reason to save the snapshot because it changes
+ * too often.
+ */
+static void SnapshotHandler(void)
+{
+	size_t count = 0;
+	size_t i;
+	for (i = 0; i < tableCapacity; i++) {
+		count += sensorTable[i].whitelisted ? 1 : 0;
+	}
+	count = MIN(count, SENSOR_SNAPSHOT_MAX_COUNT);
+
+	if (count == 0) {
+		nvDeleteSensorSnapshot();
+		return;
+	}
+
+	SensorSnapshot_t *pSnapshot = k_calloc(1, SENSOR_SNAPSHOT_SIZE(count));
+	if (pSnapshot == NULL) {
+		ScheduleSnapshot();
+		return;
+	}
+
+	pSnapshot->version = SENSOR_SNAPSHOT_VERSION;
+	for (i = 0; i < tableCapacity; i++) {
+		SensorEntry_t *p = &sensorTable[i];
+		if (!p->whitelisted || pSnapshot->count >= count) {
+			continue;
+		}
+		SensorSnapshotEntry_t *s = &pSnapshot->entries[pSnapshot->count];
+		s->validAd = hotTable[i].validAd;
+		s->validRsp = p->validRsp;
+		s->lastId = hotTable[i].lastId;
+		s->lastRecordType = p->lastRecordType;
+		memcpy(s->name, p->name, SENSOR_NAME_MAX_SIZE);
+		memcpy(&s->ad, &p->ad, sizeof(Bt510AdEvent_t));
+		memcpy(&s->rsp, &p->rsp, sizeof(Bt510Rsp_t));
+		pSnapshot->count += 1;
+	}
+
+	int rc = nvStoreSensorSnapshot(pSnapshot, SENSOR_SNAPSHOT_SIZE(count));
+	if (rc < 0) {
+		LOG_ERR("Unable to save sensor snapshot (%d)", rc);
+	}
+	k_free(pSnapshot);
+}
+
+static void ScheduleSnapshot(void)
+{
+	if (!SensorDeadline_IsPending(pDeadlines, SNAPSHOT_DEADLINE_KEY)) {
+		SensorDeadline_Schedule(
+			pDeadlines, SNAPSHOT_DEADLINE_KEY,
+			k_uptime_get() + (CONFIG_SENSOR_SNAPSHOT_DELAY_SECONDS *
+					  MSEC_PER_SEC));
+	}
+}
+
+static void AdEventHandler(Bt510AdEvent_t *p, int8_t Rssi, uint32_t Index)
+{
+	hotTable[Index].lastSeen = UptimeSeconds();
+	if (NewEvent(p->id, Index)) {
+		hotTable[Index].validAd = true;
+		hotTable[Index].lastId = p->id;
+		ScheduleSubscription(Index);
+		LOG_DBG("New Event for [%u] '%s' (%s) RSSI: %d", Index,
+			log_strdup(sensorTable[Index].name),
+			log_strdup(sensorTable[Index].addrString), Rssi);
+		sensorTable[Index].lastRecordType =
+			sensorTable[Index].ad.recordType;
+		memcpy(&sensorTable[Index].ad, p, sizeof(Bt510AdEvent_t));
+		sensorTable[Index].rssi = Rssi;
+		/* If event occurs before epoch is set, then AWS shows ~1970. */
+		sensorTable[Index].rxEpoch = Qrtc_GetEpoch();
+		LogEvent(Index);
+		/* A held event isn't published (and the RX epoch that the
+		 * cloud uses for filtering doesn't change).
+		 */
+		LeaseHandler(Index);
+		if (ReportPolicyHold(Index)) {
+			return;
+		}
+		/* Events are merged while the window is open. */
+		size_t key = DEADLINE_KEY(Index, SENSOR_DEADLINE_SHADOW_WINDOW);
+		if (CONFIG_SENSOR_SHADOW_WINDOW_SECONDS == 0 ||
+		    AlarmEvent(p->recordType) ||
+		    !SensorDeadline_IsPending(pDeadlines, key)) {
+			ShadowWindowHandler(Index);
+		}
+		/* The cloud uses the RX epoch (in the table) for filtering. */
+		sensorTable[Index].gatewayDirty = true;
+		ScheduleGatewayShadow();
+	}
+}
+
+/* Every event is logged (even if it is merged with others before it is
+ * published).
+ */
+static void LogEvent(size_t Index)
+{
+	SensorEntry_t *pEntry = &sensorTable[Index];
+	if (!ShadowEnabled(pEntry)) {
+		return;
+	}
+
+	SensorLogEvent_t event = AdToLogEvent(pEntry);
+	SensorLog_Add(pEntry->pLog, &event);
+	pEntry->eventSequence += 1;
+	if (pEntry->pendingEvents < CONFIG_SENSOR_LOG_MAX_SIZE) {
+		pEntry->pendingEvents += 1;
+	}
+
+	if (SensorLogStore_Add(pEntry->addrString, pEntry->eventSequence,
+			       &event)) {
+		SensorDeadline_Schedule(pDeadlines, LOG_STORE_DEADLINE_KEY,
+					SensorLogStore_GetFlushTime());
+	}
+}
+
+/* Temperature events are held while they are within the deadband of the
+ * last published temperature (or the minimum interval hasn't elapsed).
+ * Held events are published when the policy deadline expires or with the
+ * next event that isn't held.
+ *
+ * In aggregation mode every temperature event is held (the statistics
+ * of each bucket are published instead).
+ */
+static bool ReportPolicyHold(size_t Index)
+{
+	SensorEntry_t *pEntry = &sensorTable[Index];
+	if (pEntry->ad.recordType != SENSOR_EVENT_TEMPERATURE ||
+	    pEntry->pendingEvents == 0) {
+		return false;
+	}
+
+	int64_t delay = SENSOR_REPORT_POLICY_HOLD;
+	if (CONFIG_SENSOR_AGGREGATE_SECONDS != 0) {
+		AggregateTemperature(pEntry);
+	} else if (pEntry->policyUptime == 0) {
+		return false;
+	} else {
+		delay = SensorReportPolicy_Delay(
+			GetReportPolicy(pEntry), pEntry->policyTemperature,
+			GetTemperature(pEntry->ad.data),
+			k_uptime_get() - pEntry->policyUptime);
+		if (delay == 0) {
+			return false;
+		}
+	}
+
+	pEntry->heldEvents = MIN(pEntry->heldEvents + 1, pEntry->pendingEvents);
+	heldReports += 1;
+	size_t key = DEADLINE_KEY(Index, SENSOR_DEADLINE_REPORT_POLICY);
+	if (delay == SENSOR_REPORT_POLICY_HOLD) {
+		SensorDeadline_Cancel(pDeadlines, key);
+	} else {
+		Schedule(Index, SENSOR_DEADLINE_REPORT_POLICY, delay);
+	}
+	LOG_DBG("Holding temperature of '%s' (%u held, %u total)",
+		log_strdup(pEntry->addrString), pEntry->heldEvents,
+		heldReports);
+	return true;
+}
+
+/* The deadband and intervals of the policy are relative to the newest
+ * temperature that was published (the log isn't used in single topic
+ * mode).
+ */
+static void ReportPolicyPublished(SensorEntry_t *pEntry)
+{
+	SensorLogEvent_t events[CONFIG_SENSOR_LOG_MAX_SIZE];
+	size_t n = 0;
+	size_t i;
+
+	if (CONFIG_USE_SINGLE_AWS_TOPIC) {
+		events[n++] = AdToLogEvent(pEntry);
+	} else {
+		n = SensorLog_GetRecentEvents(pEntry->pLog,
+					      pEntry->pendingEvents, events);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (TemperatureEvent(events[i].recordType)) {
+			pEntry->policyTemperature =
+				GetTemperature(events[i].data);
+			pEntry->policyUptime = k_uptime_get();
+			return;
+		}
+	}
+}
+
+static const SensorReportPolicy_t *GetReportPolicy(SensorEntry_t *pEntry)
+{
+	return pEntry->customPolicy ? &pEntry->policy : &defaultPolicy;
+}
+
+/* Buckets are aligned to the epoch so that the buckets of all
+ * sensors (and gateways) line up.
+ */
+static void AggregateTemperature(SensorEntry_t *pEntry)
+{
+	SensorAggregate_Add(&pEntry->aggregate,
+			    GetTemperature(pEntry->ad.data));
+
+	if (!SensorDeadline_IsPending(pDeadlines, AGGREGATE_DEADLINE_KEY)) {
+		uint32_t bucket = MAX(CONFIG_SENSOR_AGGREGATE_SECONDS, 1);
+		uint32_t epoch = Qrtc_GetEpoch();
+		uint32_t elapsed = epoch % bucket;
+		aggregateEpoch = epoch - elapsed;
+		SensorDeadline_Schedule(pDeadlines, AGGREGATE_DEADLINE_KEY,
+					k_uptime_get() + ((bucket - elapsed) *
+							  MSEC_PER_SEC));
+	}
+}
+
+/* A single message contains the statistics of every sensor that had
+ * a temperature event during the bucket.
+ */
+static void AggregateHandler(void)
+{
+	size_t size = SENSOR_AGGREGATE_SIZE(tableCapacity);
+	JsonMsg_t *pMsg = BufferPool_Take(FWK_BUFFER_MSG_SIZE(JsonMsg_t, size));
+	if (pMsg == NULL) {
+		/* The bucket is extended. */
+		SensorDeadline_Schedule(pDeadlines, AGGREGATE_DEADLINE_KEY,
+					k_uptime_get() +
+						SENSOR_DEADLINE_RETRY_MS);
+		return;
+	}
+	pMsg->header.msgCode = FMC_GATEWAY_OUT;
+	pMsg->size = size;
+
+	ShadowBuilder_Start(pMsg, SKIP_MEMSET);
+	ShadowBuilder_StartGroup(pMsg, "state");
+	ShadowBuilder_StartGroup(pMsg, "reported");
+	ShadowBuilder_StartGroup(pMsg, "bt510");
+	ShadowBuilder_StartGroup(pMsg, "aggregate");
+	ShadowBuilder_AddUint32(pMsg, "epoch", aggregateEpoch);
+	ShadowBuilder_AddUint32(pMsg, "seconds",
+				CONFIG_SENSOR_AGGREGATE_SECONDS);
+	ShadowBuilder_StartArray(pMsg, "sensors");
+	size_t sensors = 0;
+	uint32_t events = 0;
+	size_t i;
+	for (i = 0; i < tableCapacity; i++) {
+		SensorEntry_t *p = &sensorTable[i];
+		if (hotTable[i].inUse && p->aggregate.count != 0 &&
+		    LeaseOwner(p)) {
+			ShadowBuilder_AddAggregateArrayEntry(
+				pMsg, p->addrString, &p->aggregate);
+			sensors += 1;
+			events += p->aggregate.count;
+		}
+		SensorAggregate_Clear(&p->aggregate);
+	}
+	ShadowBuilder_EndArray(pMsg);
+	ShadowBuilder_EndGroup(pMsg);
+	ShadowBuilder_EndGroup(pMsg);
+	ShadowBuilder_EndGroup(pMsg);
+	ShadowBuilder_EndGroup(pMsg);
+	ShadowBuilder_Finalize(pMsg);
+
+	LOG_INF("Aggregated %u temperature events from %u sensors", events,
+		sensors);
+	SendToCloud(pMsg, JSON_MSG_PRIORITY_ROUTINE);
+}
+
+static bool LeasesEnabled(void)
+{
+	return (CONFIG_SENSOR_LEASE_SECONDS != 0 &&
+		!CONFIG_USE_SINGLE_AWS_TOPIC);
+}
+
+/* Nothing is published (or configured) until the lease has been read.
+ * Without a valid lease (empty, expired, or the time isn't known)
+ * every gateway publishes.  This bounds the time to take over from a
+ * gateway that has gone away to the length of a lease.
+ */
+static bool LeaseOwner(SensorEntry_t *pEntry)
+{
+	if (!LeasesEnabled()) {
+		return true;
+	}
+	if (!pEntry->leaseKnown) {
+		return false;
+	}
+	if (!Qrtc_EpochWasSet()) {
+		return true;
+	}
+	return (pEntry->leaseOwner[0] == 0 ||
+		pEntry->leaseExpires <= Qrtc_GetEpoch() ||
+		strcmp(pEntry->leaseOwner, pLte->IMEI) == 0);
+}
+
+/* The owner renews its lease when half of it has elapsed.  Another
+ * gateway claims the sensor when the lease expires or when it receives
+ * the sensor with a better RSSI (by a margin to prevent ping-ponging).
+ * The lease shadow is the arbiter; the last claim written wins and every
+ * gateway receives it on the update accepted topic of the lease shadow.
+ */
+static void LeaseHandler(size_t Index)
+{
+	SensorEntry_t *pEntry = &sensorTable[Index];
+	if (!LeasesEnabled() || !Qrtc_EpochWasSet() ||
+	    !ShadowEnabled(pEntry) || !pEntry->leaseKnown) {
+		return;
+	}
+
+	int64_t now = k_uptime_get();
+	if (pEntry->leaseClaimUptime != 0 &&
+	    (now - pEntry->leaseClaimUptime) < LEASE_CLAIM_INTERVAL_MS) {
+		return;
+	}
+
+	uint32_t epoch = Qrtc_GetEpoch();
+	bool expired = (pEntry->leaseOwner[0] == 0 ||
+			pEntry->leaseExpires <= epoch);
+	bool owner = (strcmp(pEntry->leaseOwner, pLte->IMEI) == 0);
+	bool renew = owner && !expired &&
+		     ((pEntry->leaseExpires - epoch) <
+		      (CONFIG_SENSOR_LEASE_SECONDS / 2));
+	bool takeover = !owner &&
+			(pEntry->rssi >= (pEntry->leaseRssi +
+					  CONFIG_SENSOR_LEASE_RSSI_MARGIN));
+	if (expired || renew || takeover) {
+		pEntry->leaseClaimUptime = now;
+		PublishLease(pEntry, epoch + CONFIG_SENSOR_LEASE_SECONDS);
+		/* The previous owner may not have read the sensor. */
+		if (!owner) {
+			CreateFirstRequest(pEntry);
+		}
+	}
+}
+
+/* The claim is assumed to succeed until another claim is received. */
+static void PublishLease(SensorEntry_t *pEntry, uint32_t Expires)
+{
+	size_t size = JSON_DEFAULT_BUF_SIZE;
+	JsonMsg_t *pMsg = BufferPool_Take(FWK_BUFFER_MSG_SIZE(JsonMsg_t, size));
+	if (pMsg == NULL) {
+		return;
+	}
+	pMsg->header.msgCode = FMC_SENSOR_PUBLISH;
+	pMsg->header.txId = FWK_ID_SENSOR_TASK;
+	pMsg->size = size;
+	pMsg->sequence = 0;
+
+	ShadowBuilder_Start(pMsg, SKIP_MEMSET);
+	ShadowBuilder_StartGroup(pMsg, "state");
+	ShadowBuilder_StartGroup(pMsg, "reported");
+	ShadowBuilder_AddLease(pMsg, "lease", pLte->IMEI, pEntry->rssi,
+			       Expires);
+	ShadowBuilder_EndGroup(pMsg);
+	ShadowBuilder_EndGroup(pMsg);
+	ShadowBuilder_Finalize(pMsg);
+
+	char *fmt = SENSOR_LEASE_TOPIC_FMT_STR;
+	snprintk(pMsg->topic, CONFIG_AWS_TOPIC_MAX_SIZE, fmt,
+		 pEntry->addrString);
+	SendToCloud(pMsg, JSON_MSG_PRIORITY_ROUTINE);
+
+	strncpy(pEntry->leaseOwner, pLte->IMEI, SENSOR_LEASE_OWNER_LEN);
+	pEntry->leaseRssi = pEntry->rssi;
+	pEntry->leaseExpires = Expires;
+	LOG_INF("Claiming '%s' until %u (RSSI %d)",
+		log_strdup(pEntry->addrString), Expires, pEntry->rssi);
+}
+
+static bool SetReportPolicy(SensorEntry_t *pEntry,
+			    const SensorReportPolicy_t *pPolicy)
+{
+	bool custom = (pPolicy != NULL);
+	bool changed = (pEntry->customPolicy != custom);
+	if (custom) {
+		changed |= (memcmp(&pEntry->policy, pPolicy,
+				   sizeof(SensorReportPolicy_t)) != 0);
+		pEntry->policy = *pPolicy;
+	}
+	pEntry->customPolicy = custom;
+	return changed;
+}
+
+/* Returns true if the entry at Position changed. */
+static bool AddPendingPolicy(size_t Position, const char *pAddrString,
+			     const SensorReportPolicy_t *pPolicy)
+{
+	SensorReportPolicyEntry_t *p = &pendingPolicies[Position];
+	bool changed = (Position >= pendingPolicyCount ||
+			strcmp(p->addrString, pAddrString) != 0 ||
+			memcmp(&p->policy, pPolicy,
+			       sizeof(SensorReportPolicy_t)) != 0);
+	strncpy(p->addrString, pAddrString, SENSOR_ADDR_STR_LEN);
+	p->addrString[SENSOR_ADDR_STR_LEN] = 0;
+	p->policy = *pPolicy;
+	return changed;
+}
+
+/* The set of policies (and the gateway shadow) doesn't change when a
+ * pending policy moves to the table.
+ */
+static void ApplyPendingPolicy(SensorEntry_t *pEntry)
+{
+	size_t i;
+	for (i = 0; i < pendingPolicyCount; i++) {
+		if (strcmp(pendingPolicies[i].addrString,
+			   pEntry->addrString) == 0) {
+			SetReportPolicy(pEntry, &pendingPolicies[i].policy);
+			pendingPolicyCount -= 1;
+			pendingPolicies[i] = pendingPolicies[pendingPolicyCount];
+			return;
+		}
+	}
+}
+
+/* The BT510 advertisement can be recognized by the manufacturer
+ * specific data type with LAIRD as the company ID.
+ * It is further qualified by having a length of 27 and matching protocol ID.
+ */
+static bool FindBt510Advertisement(AdHandle_t *pHandle)
+{
+	if (pHandle->pPayload != NULL) {
+		if ((pHandle->size == BT510_MSD_AD_PAYLOAD_LENGTH)) {
+			if (memcmp(pHandle->pPayload, BT510_AD_HEADER,
+				   sizeof(BT510_AD_HEADER)) == 0) {
+				return true;
+			}
 		}
 	}
 	return false;
@@ -735,11 +1868,11 @@ static size_t AddByScanResponse(const bt_addr_le_t *pAddr,
 				int8_t Rssi)
 {
 	if (pNameHandle->pPayload == NULL) {
-		return CONFIG_SENSOR_TABLE_SIZE;
+		return tableCapacity;
 	}
 
 	if (pRsp == NULL) {
-		return CONFIG_SENSOR_TABLE_SIZE;
+		return tableCapacity;
 	}
 
 	/* The first free entry will be used after entire table is searched. */
@@ -748,7 +1881,7 @@ static size_t AddByScanResponse(const bt_addr_le_t *pAddr,
 	bool updateName = false;
 	SensorEntry_t *pEntry = NULL;
 	size_t i = FindTableIndex(pAddr);
-	if (i < CONFIG_SENSOR_TABLE_SIZE) {
+	if (i < tableCapacity) {
 		pEntry = &sensorTable[i];
 		if (!NameMatch(pNameHandle->pPayload, i)) {
 			updateName = true;
@@ -757,8 +1890,8 @@ static size_t AddByScanResponse(const bt_addr_le_t *pAddr,
 			updateRsp = true;
 		}
 	} else {
-		i = FindFirstFree();
-		if (i < CONFIG_SENSOR_TABLE_SIZE) {
+		i = FindFreeEntry(CONFIG_SENSOR_EVICTION_MIN_IDLE_SECONDS);
+		if (i < tableCapacity) {
 			pEntry = &sensorTable[i];
 			add = true;
 		}
@@ -780,14 +1913,18 @@ static size_t AddByScanResponse(const bt_addr_le_t *pAddr,
 		if (add) {
 			AddEntry(pEntry, &pAddr->a, Rssi);
 		}
+		if (pEntry->whitelisted) {
+			ScheduleSnapshot();
+		}
+		ScheduleSubscription(i);
 	}
 	return i;
 }
 
-static size_t AddByAddress(const bt_addr_t *pAddr)
+static size_t AddByAddress(const bt_addr_t *pAddr, uint32_t MinIdleSeconds)
 {
-	size_t i = FindFirstFree();
-	if (i < CONFIG_SENSOR_TABLE_SIZE) {
+	size_t i = FindFreeEntry(MinIdleSeconds);
+	if (i < tableCapacity) {
 		AddEntry(&sensorTable[i], pAddr, RSSI_UNKNOWN);
 	}
 	return i;
@@ -795,8 +1932,11 @@ static size_t AddByAddress(const bt_addr_t *pAddr)
 
 static void AddEntry(SensorEntry_t *pEntry, const bt_addr_t *pAddr, int8_t Rssi)
 {
+	SensorHotEntry_t *pHot = GetHotEntry(pEntry);
 	tableCount += 1;
-	pEntry->inUse = true;
+	pHot->inUse = true;
+	pHot->lastSeen = UptimeSeconds();
+	memcpy(pHot->addr.val, pAddr->val, sizeof(bt_addr_t));
 	pEntry->rssi = Rssi;
 	memcpy(pEntry->ad.addr.val, pAddr->val, sizeof(bt_addr_t));
 	/* The address is duplicated in the advertisement payload because
@@ -805,41 +1945,207 @@ static void AddEntry(SensorEntry_t *pEntry, const bt_addr_t *pAddr, int8_t Rssi)
 	 * because the two formats are the same.
 	 */
 	SensorAddrToString(pEntry);
+	ApplyPendingPolicy(pEntry);
+	size_t index = pEntry - sensorTable;
+	IndexInsert(addrIndex, AddrHash(index), index);
+	IndexInsert(addrStringIndex, AddrStringHash(index), index);
 	LOG_INF("Added BT510 sensor %s '%s' RSSI: %d",
 		log_strdup(pEntry->addrString), log_strdup(pEntry->name),
 		pEntry->rssi);
-	GatewayShadowMaker(false);
+	pEntry->gatewayDirty = true;
+	ScheduleGatewayShadow();
+	ScheduleTimeToLive(index);
 }
 
 /* Find index of advertiser's address in the sensor table */
 static size_t FindTableIndex(const bt_addr_le_t *pAddr)
 {
-	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
-		if (sensorTable[i].inUse) {
-			if (AddrMatch(pAddr->a.val, i)) {
-				return i;
-			}
+	size_t slot = Hash(pAddr->a.val, sizeof(bt_addr_t)) & indexMask;
+	while (addrIndex[slot] != SENSOR_INDEX_EMPTY) {
+		size_t i = addrIndex[slot] - 1;
+		if (AddrMatch(pAddr->a.val, i)) {
+			return i;
 		}
+		slot = (slot + 1) & indexMask;
 	}
-	return CONFIG_SENSOR_TABLE_SIZE;
+	return tableCapacity;
+}
+
+/* Find index of an address string (from the cloud) in the sensor table */
+static size_t FindTableIndexByString(const char *pAddrString)
+{
+	size_t slot =
+		Hash(pAddrString, SENSOR_ADDR_STR_LEN) & indexMask;
+	while (addrStringIndex[slot] != SENSOR_INDEX_EMPTY) {
+		size_t i = addrStringIndex[slot] - 1;
+		if (AddrStringMatch(pAddrString, i)) {
+			return i;
+		}
+		slot = (slot + 1) & indexMask;
+	}
+	return tableCapacity;
+}
+
+/* The address is the only part of a sensor topic that changes. */
+static size_t FindTableIndexByTopic(const char *pTopic)
+{
+	const char *pFmt = SENSOR_UPDATE_TOPIC_FMT_STR;
+	const char *pAddr = strstr(pFmt, "%s");
+	if (pAddr == NULL) {
+		return tableCapacity;
+	}
+
+	size_t offset = pAddr - pFmt;
+	if (strlen(pTopic) < (offset + SENSOR_ADDR_STR_LEN)) {
+		return tableCapacity;
+	}
+
+	char addrString[SENSOR_ADDR_STR_SIZE];
+	memcpy(addrString, &pTopic[offset], SENSOR_ADDR_STR_LEN);
+	addrString[SENSOR_ADDR_STR_LEN] = 0;
+	return FindTableIndexByString(addrString);
 }
 
 static size_t FindFirstFree(void)
 {
 	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
-		if (!sensorTable[i].inUse) {
+	for (i = 0; i < tableCapacity; i++) {
+		if (!hotTable[i].inUse) {
 			return i;
 		}
 	}
-	return CONFIG_SENSOR_TABLE_SIZE;
+	return tableCapacity;
+}
+
+static size_t FindFreeEntry(uint32_t MinIdleSeconds)
+{
+	size_t i = FindFirstFree();
+	if (i < tableCapacity) {
+		return i;
+	}
+	return EvictLeastRecentlySeen(MinIdleSeconds);
+}
+
+/* When the table is full, the least recently seen sensor that isn't
+ * whitelisted (and isn't being configured) is removed so that dense
+ * deployments can't starve whitelisted sensors of table space.
+ */
+static size_t EvictLeastRecentlySeen(uint32_t MinIdleSeconds)
+{
+	uint32_t now = UptimeSeconds();
+	uint32_t maxIdle = 0;
+	size_t lru = tableCapacity;
+	size_t i;
+	for (i = 0; i < tableCapacity; i++) {
+		SensorEntry_t *p = &sensorTable[i];
+		if (p->whitelisted || p->configBusy || p->dumpBusy ||
+		    p->pCmd != NULL) {
+			continue;
+		}
+		uint32_t idle = now - hotTable[i].lastSeen;
+		if (idle >= MinIdleSeconds && idle >= maxIdle) {
+			maxIdle = idle;
+			lru = i;
+		}
+	}
+
+	if (lru < tableCapacity) {
+		LOG_WRN("Evicting '%s' sensor %s from table (idle %u seconds)",
+			log_strdup(sensorTable[lru].name),
+			log_strdup(sensorTable[lru].addrString), maxIdle);
+		RemoveEntry(&sensorTable[lru]);
+	}
+	return lru;
+}
+
+static uint32_t UptimeSeconds(void)
+{
+	return (uint32_t)(k_uptime_get() / MSEC_PER_SEC);
+}
+
+static SensorHotEntry_t *GetHotEntry(const SensorEntry_t *pEntry)
+{
+	FRAMEWORK_DEBUG_ASSERT(pEntry >= sensorTable &&
+			       pEntry < &sensorTable[tableCapacity]);
+	return &hotTable[pEntry - sensorTable];
+}
+
+/* FNV-1a */
+static uint32_t Hash(const void *pData, size_t Length)
+{
+	const uint8_t *p = pData;
+	uint32_t h = FNV_OFFSET_BASIS;
+	size_t i;
+	for (i = 0; i < Length; i++) {
+		h ^= p[i];
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+static uint32_t AddrHash(size_t Index)
+{
+	return Hash(hotTable[Index].addr.val, sizeof(bt_addr_t));
+}
+
+static uint32_t AddrStringHash(size_t Index)
+{
+	return Hash(sensorTable[Index].addrString, SENSOR_ADDR_STR_LEN);
+}
+
+static void IndexInsert(SensorIndexSlot_t *pIndex, uint32_t HashValue,
+			size_t Index)
+{
+	FRAMEWORK_ASSERT(Index < tableCapacity);
+	size_t slot = HashValue & indexMask;
+	while (pIndex[slot] != SENSOR_INDEX_EMPTY) {
+		slot = (slot + 1) & indexMask;
+	}
+	pIndex[slot] = (SensorIndexSlot_t)(Index + 1);
+}
+
+/* Linear probing allows deletion without tombstones.  Entries that follow
+ * the removed slot are shifted back when the removed slot is part of their
+ * probe sequence.
+ */
+static void IndexRemove(SensorIndexSlot_t *pIndex, SensorIndexHash_t HashFn,
+			size_t Index)
+{
+	size_t slot = HashFn(Index) & indexMask;
+	size_t probes;
+	for (probes = 0; probes < indexSize; probes++) {
+		if (pIndex[slot] == (Index + 1)) {
+			break;
+		}
+		slot = (slot + 1) & indexMask;
+	}
+	if (probes >= indexSize) {
+		return;
+	}
+
+	size_t hole = slot;
+	pIndex[hole] = SENSOR_INDEX_EMPTY;
+	for (;;) {
+		slot = (slot + 1) & indexMask;
+		if (pIndex[slot] == SENSOR_INDEX_EMPTY) {
+			break;
+		}
+		size_t home = HashFn(pIndex[slot] - 1) & indexMask;
+		/* Leave the entry if its home is cyclically in (hole, slot]. */
+		bool inRange = (hole <= slot) ?
+				       ((hole < home) && (home <= slot)) :
+				       ((hole < home) || (home <= slot));
+		if (!inRange) {
+			pIndex[hole] = pIndex[slot];
+			pIndex[slot] = SENSOR_INDEX_EMPTY;
+			hole = slot;
+		}
+	}
 }
 
 static bool AddrMatch(const void *p, size_t Index)
 {
-	return (memcmp(p, sensorTable[Index].ad.addr.val, sizeof(bt_addr_t)) ==
-		0);
+	return (memcmp(p, hotTable[Index].addr.val, sizeof(bt_addr_t)) == 0);
 }
 
 static bool AddrStringMatch(const char *str, size_t Index)
@@ -861,22 +2167,42 @@ static bool RspMatch(const Bt510Rsp_t *p, size_t Index)
 
 static bool NewEvent(uint16_t Id, size_t Index)
 {
-	if (!sensorTable[Index].validAd) {
+	if (!hotTable[Index].validAd) {
+		return true;
+	} else {
+		return (Id != hotTable[Index].lastId);
+	}
+}
+
+/* AWS will disconnect if data is sent for devices that have not
+ * been whitelisted.
+ */
+static bool ShadowEnabled(SensorEntry_t *pEntry)
+{
+	if (CONFIG_USE_SINGLE_AWS_TOPIC) {
 		return true;
 	} else {
-		return (Id != sensorTable[Index].ad.id);
+		return (pEntry->whitelisted && pEntry->shadowInitReceived);
 	}
 }
 
 static void ShadowMaker(SensorEntry_t *pEntry)
 {
-	/* AWS will disconnect if data is sent for devices that have not
-	 * been whitelisted.
-	 */
-	if (!CONFIG_USE_SINGLE_AWS_TOPIC) {
-		if (!pEntry->whitelisted || !pEntry->shadowInitReceived) {
-			return;
-		}
+	if (!ShadowEnabled(pEntry)) {
+		pEntry->pendingEvents = 0;
+		pEntry->heldEvents = 0;
+		return;
+	}
+
+	/* Another gateway publishes the events of a sensor it owns. */
+	if (!LeaseOwner(pEntry)) {
+		leaseSuppressed += 1;
+		LOG_DBG("'%s' is published by gateway %s (%u suppressed)",
+			log_strdup(pEntry->addrString),
+			log_strdup(pEntry->leaseOwner), leaseSuppressed);
+		pEntry->pendingEvents = 0;
+		pEntry->heldEvents = 0;
+		return;
 	}
 
 	JsonMsg_t *pMsg = BufferPool_Take(
@@ -886,16 +2212,19 @@ static void ShadowMaker(SensorEntry_t *pEntry)
 	}
 
 	pMsg->header.msgCode = FMC_SENSOR_PUBLISH;
-	pMsg->header.rxId = FWK_ID_CLOUD;
+	pMsg->header.txId = FWK_ID_SENSOR_TASK;
 	pMsg->size = SHADOW_BUF_SIZE;
+	pMsg->sequence = 0;
 
 	ShadowBuilder_Start(pMsg, SKIP_MEMSET);
 	ShadowBuilder_StartGroup(pMsg, "state");
 	ShadowBuilder_StartGroup(pMsg, "reported");
 	if (CONFIG_USE_SINGLE_AWS_TOPIC) {
-		ShadowTemperatureHandler(pMsg, pEntry);
+		SensorLogEvent_t event = AdToLogEvent(pEntry);
+		uint32_t keys = 0;
+		ShadowTemperatureHandler(pMsg, pEntry, &event, &keys);
 		/* Sending RSSI prevents an empty buffer when
-		 * temperature isn't present.
+		 * temperature isn't present (or hasn't changed).
 		 */
 		ShadowBuilder_AddSigned32(pMsg, MangleKey(pEntry->name, "rssi"),
 					  pEntry->rssi);
@@ -917,7 +2246,76 @@ static void ShadowMaker(SensorEntry_t *pEntry)
 	snprintk(pMsg->topic, CONFIG_AWS_TOPIC_MAX_SIZE, fmt,
 		 pEntry->addrString);
 
-	FRAMEWORK_MSG_SEND(pMsg);
+	SendToCloud(pMsg, GetPriority(pEntry));
+	ReportPolicyPublished(pEntry);
+	pEntry->pendingEvents = 0;
+	/* Held events were published with the others. */
+	pEntry->heldEvents = 0;
+	SensorDeadline_Cancel(pDeadlines,
+			      DEADLINE_KEY(pEntry - sensorTable,
+					   SENSOR_DEADLINE_REPORT_POLICY));
+	LOG_DBG("Delta encoding of '%s' has saved %u bytes",
+		log_strdup(pEntry->addrString), pEntry->bytesSaved);
+}
+
+/* A shadow containing an alarm or movement event is an alarm.
+ * The log isn't used in single topic mode, so the last advertisement
+ * is also checked.
+ */
+static enum JSON_MSG_PRIORITY GetPriority(SensorEntry_t *pEntry)
+{
+	if (AlarmPriority(pEntry->ad.recordType)) {
+		return JSON_MSG_PRIORITY_ALARM;
+	}
+
+	SensorLogEvent_t events[CONFIG_SENSOR_LOG_MAX_SIZE];
+	size_t n = SensorLog_GetRecentEvents(pEntry->pLog,
+					     pEntry->pendingEvents, events);
+	size_t i;
+	for (i = 0; i < n; i++) {
+		if (AlarmPriority(events[i].recordType)) {
+			return JSON_MSG_PRIORITY_ALARM;
+		}
+	}
+	return JSON_MSG_PRIORITY_ROUTINE;
+}
+
+static bool AlarmPriority(uint8_t RecordType)
+{
+	return (AlarmEvent(RecordType) || RecordType == SENSOR_EVENT_MOVEMENT);
+}
+
+/* Alarms are sent to a separate queue that isn't purged.  The cloud task
+ * blocks on the routine queue, so it is sent a message to wake it up.
+ */
+static void SendToCloud(JsonMsg_t *pMsg, enum JSON_MSG_PRIORITY Priority)
+{
+	pMsg->priority = Priority;
+	pMsg->timestamp = k_uptime_get_32();
+	if (Priority == JSON_MSG_PRIORITY_ALARM) {
+		pMsg->header.rxId = FWK_ID_CLOUD_ALARM;
+		DropOldestAlarm();
+		FRAMEWORK_MSG_SEND(pMsg);
+		FRAMEWORK_MSG_CREATE_AND_SEND(FWK_ID_SENSOR_TASK, FWK_ID_CLOUD,
+					      FMC_CLOUD_ALARM_PENDING);
+	} else {
+		pMsg->header.rxId = FWK_ID_CLOUD;
+		FRAMEWORK_MSG_SEND(pMsg);
+	}
+}
+
+/* A full alarm queue drops its oldest alarm instead of the newest one.
+ * The sensor whose alarm was dropped must publish its values again.
+ */
+static void DropOldestAlarm(void)
+{
+	FwkMsg_t *pOldest = NULL;
+	if (k_msgq_num_free_get(&cloudAlarmQ) == 0 &&
+	    k_msgq_get(&cloudAlarmQ, &pOldest, K_NO_WAIT) == 0) {
+		LOG_WRN("Alarm queue full, dropping oldest alarm");
+		BufferPool_Free(pOldest);
+		SensorTable_PublishDroppedHandler();
+	}
 }
 
 /**
@@ -940,10 +2338,10 @@ static char *MangleKey(const char *pName, const char *pKey)
 
 static void ShadowBtHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
 {
-	ShadowBuilder_AddPair(pMsg, "bluetoothAddress", pEntry->addrString,
-			      SB_IS_STRING);
+	ReportPair(pMsg, pEntry, SHADOW_FIELD_BT_ADDR, 0, "bluetoothAddress",
+		   pEntry->addrString, SB_IS_STRING);
 
-	ShadowBuilder_AddSigned32(pMsg, "rssi", pEntry->rssi);
+	ReportSigned32(pMsg, pEntry, SHADOW_FIELD_RSSI, "rssi", pEntry->rssi);
 }
 
 static void ShadowAdHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
@@ -952,18 +2350,46 @@ static void ShadowAdHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
 	 * before an AD or RSP has been received.  The shadow is already valid.
 	 * Don't send bad data.
 	 */
-	if (!pEntry->validAd) {
+	if (!GetHotEntry(pEntry)->validAd) {
 		return;
 	}
 
-	ShadowBuilder_AddUint32(pMsg, "networkId", pEntry->ad.networkId);
-	ShadowBuilder_AddUint32(pMsg, "flags", pEntry->ad.flags);
-	ShadowBuilder_AddUint32(pMsg, "resetCount", pEntry->ad.resetCount);
+	ReportUint32(pMsg, pEntry, SHADOW_FIELD_NETWORK_ID, "networkId",
+		     pEntry->ad.networkId);
+	ReportUint32(pMsg, pEntry, SHADOW_FIELD_FLAGS, "flags",
+		     pEntry->ad.flags);
+	ReportUint32(pMsg, pEntry, SHADOW_FIELD_RESET_COUNT, "resetCount",
+		     pEntry->ad.resetCount);
 
-	ShadowTemperatureHandler(pMsg, pEntry);
-	ShadowEventHandler(pMsg, pEntry);
+	ShadowPendingEventHandler(pMsg, pEntry);
 	ShadowFlagHandler(pMsg, pEntry);
-	ShadowIg60EventHandler(pMsg, pEntry);
+}
+
+/* The events that occurred since the last update are taken from the log
+ * (newest first).  The newest value of each key is added.
+ */
+static void ShadowPendingEventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
+{
+	uint32_t recordTypes = 0;
+	uint32_t keys = 0;
+	SensorLogEvent_t events[CONFIG_SENSOR_LOG_MAX_SIZE];
+	size_t n = SensorLog_GetRecentEvents(pEntry->pLog,
+					     pEntry->pendingEvents, events);
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		const SensorLogEvent_t *p = &events[i];
+		if (p->recordType < 32) {
+			if ((recordTypes & BIT(p->recordType)) != 0) {
+				continue;
+			}
+			recordTypes |= BIT(p->recordType);
+		}
+
+		ShadowTemperatureHandler(pMsg, pEntry, p, &keys);
+		ShadowEventHandler(pMsg, pEntry, p, &keys);
+		ShadowIg60EventHandler(pMsg, pEntry, p);
+	}
 }
 
 /**
@@ -1009,66 +2435,117 @@ static void ShadowRspHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
  * Get temperature from advertisement (assumes event contains temperature).
  * retval temperature in hundredths of degree C
  */
-static int32_t GetTemperature(SensorEntry_t *pEntry)
+static int32_t GetTemperature(uint16_t Data)
+{
+	return (int32_t)((int16_t)Data);
+}
+
+static uint32_t GetBattery(uint16_t Data)
+{
+	return (uint32_t)Data;
+}
+
+static bool LowBatteryAlarm(SensorEntry_t *pEntry)
+{
+	return (GetFlag(pEntry->ad.flags, FLAG_LOW_BATTERY_ALARM) != 0);
+}
+
+/* Alarms aren't merged with other events (they are published immediately). */
+static bool AlarmEvent(uint8_t RecordType)
+{
+	switch (RecordType) {
+	case SENSOR_EVENT_ALARM_HIGH_TEMP_1:
+	case SENSOR_EVENT_ALARM_HIGH_TEMP_2:
+	case SENSOR_EVENT_ALARM_LOW_TEMP_1:
+	case SENSOR_EVENT_ALARM_LOW_TEMP_2:
+	case SENSOR_EVENT_ALARM_DELTA_TEMP:
+	case SENSOR_EVENT_ALARM_TEMPERATURE_RATE_OF_CHANGE:
+	case SENSOR_EVENT_BATTERY_BAD:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool TemperatureEvent(uint8_t RecordType)
 {
-	return (int32_t)((int16_t)pEntry->ad.data);
+	switch (RecordType) {
+	case SENSOR_EVENT_TEMPERATURE:
+	case SENSOR_EVENT_ALARM_HIGH_TEMP_1:
+	case SENSOR_EVENT_ALARM_HIGH_TEMP_2:
+	case SENSOR_EVENT_ALARM_HIGH_TEMP_CLEAR:
+	case SENSOR_EVENT_ALARM_LOW_TEMP_1:
+	case SENSOR_EVENT_ALARM_LOW_TEMP_2:
+	case SENSOR_EVENT_ALARM_LOW_TEMP_CLEAR:
+	case SENSOR_EVENT_ALARM_DELTA_TEMP:
+	case SENSOR_EVENT_ALARM_TEMPERATURE_RATE_OF_CHANGE:
+		return true;
+	default:
+		return false;
+	}
 }
 
-static uint32_t GetBattery(SensorEntry_t *pEntry)
+static SensorLogEvent_t AdToLogEvent(SensorEntry_t *pEntry)
 {
-	return (uint32_t)((uint16_t)pEntry->ad.data);
+	SensorLogEvent_t event = { .epoch = pEntry->ad.epoch,
+				   .data = pEntry->ad.data,
+				   .recordType = pEntry->ad.recordType };
+	return event;
 }
 
-static bool LowBatteryAlarm(SensorEntry_t *pEntry)
+/* Returns true if the key hasn't been added to the shadow yet. */
+static bool FirstKey(uint32_t *pKeys, uint32_t Key)
 {
-	return (GetFlag(pEntry->ad.flags, FLAG_LOW_BATTERY_ALARM) != 0);
+	if ((*pKeys & Key) != 0) {
+		return false;
+	}
+	*pKeys |= Key;
+	return true;
 }
 
-static void ShadowTemperatureHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
+static void ShadowTemperatureHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+				     const SensorLogEvent_t *pEvent,
+				     uint32_t *pKeys)
 {
-	int32_t temperature = GetTemperature(pEntry);
+	int32_t temperature = GetTemperature(pEvent->data);
 	if (CONFIG_USE_SINGLE_AWS_TOPIC) {
 		/* The desired format is degrees when publishing to a single topic
 		 * because that is how the BL654 Sensor data is formatted.
 		 */
 		temperature /= 100;
 	}
-	switch (pEntry->ad.recordType) {
-	case SENSOR_EVENT_TEMPERATURE:
-	case SENSOR_EVENT_ALARM_HIGH_TEMP_1:
-	case SENSOR_EVENT_ALARM_HIGH_TEMP_2:
-	case SENSOR_EVENT_ALARM_HIGH_TEMP_CLEAR:
-	case SENSOR_EVENT_ALARM_LOW_TEMP_1:
-	case SENSOR_EVENT_ALARM_LOW_TEMP_2:
-	case SENSOR_EVENT_ALARM_LOW_TEMP_CLEAR:
-	case SENSOR_EVENT_ALARM_DELTA_TEMP:
-	case SENSOR_EVENT_ALARM_TEMPERATURE_RATE_OF_CHANGE:
-		ShadowBuilder_AddSigned32(
-			pMsg,
-			MangleKey(pEntry->name, CONFIG_USE_SINGLE_AWS_TOPIC ?
-							"temperature" :
-							"tempCc"),
-			temperature);
-		break;
-	default:
-		break;
+	if (TemperatureEvent(pEvent->recordType) &&
+	    FirstKey(pKeys, SHADOW_KEY_TEMPERATURE)) {
+		ReportSigned32(pMsg, pEntry, SHADOW_FIELD_TEMPERATURE,
+			       MangleKey(pEntry->name,
+					 CONFIG_USE_SINGLE_AWS_TOPIC ?
+						 "temperature" :
+						 "tempCc"),
+			       temperature);
 	}
 }
 
-static void ShadowEventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
+static void ShadowEventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+			       const SensorLogEvent_t *pEvent, uint32_t *pKeys)
 {
 	/* Many events are replicated in flags (and not processed here). */
-	switch (pEntry->ad.recordType) {
+	switch (pEvent->recordType) {
 	case SENSOR_EVENT_BATTERY_GOOD:
 	case SENSOR_EVENT_BATTERY_BAD:
-		ShadowBuilder_AddUint32(pMsg, "batteryVoltageMv",
-					(uint32_t)pEntry->ad.data);
+		if (FirstKey(pKeys, SHADOW_KEY_BATTERY)) {
+			ReportUint32(pMsg, pEntry, SHADOW_FIELD_BATTERY_VOLTAGE,
+				     "batteryVoltageMv",
+				     (uint32_t)pEvent->data);
+		}
 		break;
 	case SENSOR_EVENT_RESET:
-		ShadowBuilder_AddPair(
-			pMsg, "resetReason",
-			lbt_get_nrf52_reset_reason_string(pEntry->ad.data),
-			false);
+		if (FirstKey(pKeys, SHADOW_KEY_RESET)) {
+			ReportPair(
+				pMsg, pEntry, SHADOW_FIELD_RESET_REASON,
+				pEvent->data, "resetReason",
+				lbt_get_nrf52_reset_reason_string(pEvent->data),
+				false);
+		}
 		break;
 	default:
 		break;
@@ -1081,107 +2558,192 @@ static void ShadowEventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
  * method of preventing lost events.
  * The names are taken from the bt510_cli project and bt510.schema.json.
  */
-static void ShadowIg60EventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
+static void ShadowIg60EventHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+				   const SensorLogEvent_t *pEvent)
 {
-	int32_t t = GetTemperature(pEntry);
-	switch (pEntry->ad.recordType) {
+	enum SHADOW_FIELD field = SHADOW_FIELD_EVENT_BASE + pEvent->recordType;
+	int32_t t = GetTemperature(pEvent->data);
+	uint32_t b = GetBattery(pEvent->data);
+	switch (pEvent->recordType) {
 	case SENSOR_EVENT_ALARM_HIGH_TEMP_1:
-		ShadowBuilder_AddSigned32(
-			pMsg, IG60_GENERATED_EVENT_STR_ALARM_HIGH_TEMP_1, t);
+		ReportSigned32(pMsg, pEntry, field,
+			       IG60_GENERATED_EVENT_STR_ALARM_HIGH_TEMP_1, t);
 		break;
 	case SENSOR_EVENT_ALARM_HIGH_TEMP_2:
-		ShadowBuilder_AddSigned32(
-			pMsg, IG60_GENERATED_EVENT_STR_ALARM_HIGH_TEMP_2, t);
+		ReportSigned32(pMsg, pEntry, field,
+			       IG60_GENERATED_EVENT_STR_ALARM_HIGH_TEMP_2, t);
 		break;
 	case SENSOR_EVENT_ALARM_HIGH_TEMP_CLEAR:
-		ShadowBuilder_AddSigned32(
-			pMsg, IG60_GENERATED_EVENT_STR_ALARM_HIGH_TEMP_CLEAR,
-			t);
+		ReportSigned32(pMsg, pEntry, field,
+			       IG60_GENERATED_EVENT_STR_ALARM_HIGH_TEMP_CLEAR,
+			       t);
 		break;
 	case SENSOR_EVENT_ALARM_LOW_TEMP_1:
-		ShadowBuilder_AddSigned32(
-			pMsg, IG60_GENERATED_EVENT_STR_ALARM_LOW_TEMP_1, t);
+		ReportSigned32(pMsg, pEntry, field,
+			       IG60_GENERATED_EVENT_STR_ALARM_LOW_TEMP_1, t);
 		break;
 	case SENSOR_EVENT_ALARM_LOW_TEMP_2:
-		ShadowBuilder_AddSigned32(
-			pMsg, IG60_GENERATED_EVENT_STR_ALARM_LOW_TEMP_2, t);
+		ReportSigned32(pMsg, pEntry, field,
+			       IG60_GENERATED_EVENT_STR_ALARM_LOW_TEMP_2, t);
 		break;
 	case SENSOR_EVENT_ALARM_LOW_TEMP_CLEAR:
-		ShadowBuilder_AddSigned32(
-			pMsg, IG60_GENERATED_EVENT_STR_ALARM_LOW_TEMP_CLEAR, t);
+		ReportSigned32(pMsg, pEntry, field,
+			       IG60_GENERATED_EVENT_STR_ALARM_LOW_TEMP_CLEAR, t);
 		break;
 	case SENSOR_EVENT_ALARM_DELTA_TEMP:
-		ShadowBuilder_AddSigned32(
-			pMsg, IG60_GENERATED_EVENT_STR_ALARM_DELTA_TEMP, t);
+		ReportSigned32(pMsg, pEntry, field,
+			       IG60_GENERATED_EVENT_STR_ALARM_DELTA_TEMP, t);
 		break;
 	case SENSOR_EVENT_BATTERY_GOOD:
-		ShadowBuilder_AddUint32(pMsg,
-					IG60_GENERATED_EVENT_STR_BATTERY_GOOD,
-					GetBattery(pEntry));
+		ReportUint32(pMsg, pEntry, field,
+			     IG60_GENERATED_EVENT_STR_BATTERY_GOOD, b);
 		break;
 	case SENSOR_EVENT_BATTERY_BAD:
-		ShadowBuilder_AddUint32(pMsg,
-					IG60_GENERATED_EVENT_STR_BATTERY_BAD,
-					GetBattery(pEntry));
+		ReportUint32(pMsg, pEntry, field,
+			     IG60_GENERATED_EVENT_STR_BATTERY_BAD, b);
 		break;
 	case SENSOR_EVENT_ADV_ON_BUTTON:
-		ShadowBuilder_AddUint32(
-			pMsg, IG60_GENERATED_EVENT_STR_ADVERTISE_ON_BUTTON,
-			GetBattery(pEntry));
+		ReportUint32(pMsg, pEntry, field,
+			     IG60_GENERATED_EVENT_STR_ADVERTISE_ON_BUTTON, b);
 		break;
 	default:
 		break;
 	}
 }
 
+/* Only the flags that have changed are sent. */
 static void ShadowFlagHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
 {
 	uint16_t flags = pEntry->ad.flags;
-	if (flags != pEntry->lastFlags) {
-		ShadowBuilder_AddUint32(pMsg, "rtcSet",
-					GetFlag(flags, FLAG_TIME_WAS_SET));
-		ShadowBuilder_AddUint32(pMsg, "activeMode",
-					GetFlag(flags, FLAG_ACTIVE_MODE));
-		ShadowBuilder_AddUint32(pMsg, "anyAlarm",
-					GetFlag(flags, FLAG_ANY_ALARM));
-		ShadowBuilder_AddUint32(pMsg, "lowBatteryAlarm",
-					GetFlag(flags, FLAG_LOW_BATTERY_ALARM));
-		ShadowBuilder_AddUint32(pMsg, "highTemperatureAlarm",
-					GetFlag(flags, FLAG_HIGH_TEMP_ALARM));
-		ShadowBuilder_AddUint32(pMsg, "lowTemperatureAlarm",
-					GetFlag(flags, FLAG_LOW_TEMP_ALARM));
-		ShadowBuilder_AddUint32(pMsg, "deltaTemperatureAlarm",
-					GetFlag(flags, FLAG_DELTA_TEMP_ALARM));
-		ShadowBuilder_AddUint32(
-			pMsg, "rateOfChangeTemperatureAlarm",
-			GetFlag(flags, FLAG_RATE_OF_CHANGE_TEMP_ALARM));
-		ShadowBuilder_AddUint32(pMsg, "movementAlarm",
-					GetFlag(flags, FLAG_MOVEMENT_ALARM));
-		ShadowBuilder_AddUint32(pMsg, "magnetState",
-					GetFlag(flags, FLAG_MAGNET_STATE));
-
-		pEntry->lastFlags = flags;
-	}
+	uint16_t changed = UINT16_MAX;
+	if ((pEntry->reportedValid & BIT(SHADOW_FIELD_FLAG_KEYS)) != 0) {
+		changed = flags ^ pEntry->reported[SHADOW_FIELD_FLAG_KEYS];
+	}
+	ReportedChanged(pEntry, SHADOW_FIELD_FLAG_KEYS, flags);
+
+	ReportFlag(pMsg, pEntry, "rtcSet", changed, flags, FLAG_TIME_WAS_SET);
+	ReportFlag(pMsg, pEntry, "activeMode", changed, flags,
+		   FLAG_ACTIVE_MODE);
+	ReportFlag(pMsg, pEntry, "anyAlarm", changed, flags, FLAG_ANY_ALARM);
+	ReportFlag(pMsg, pEntry, "lowBatteryAlarm", changed, flags,
+		   FLAG_LOW_BATTERY_ALARM);
+	ReportFlag(pMsg, pEntry, "highTemperatureAlarm", changed, flags,
+		   FLAG_HIGH_TEMP_ALARM);
+	ReportFlag(pMsg, pEntry, "lowTemperatureAlarm", changed, flags,
+		   FLAG_LOW_TEMP_ALARM);
+	ReportFlag(pMsg, pEntry, "deltaTemperatureAlarm", changed, flags,
+		   FLAG_DELTA_TEMP_ALARM);
+	ReportFlag(pMsg, pEntry, "rateOfChangeTemperatureAlarm", changed, flags,
+		   FLAG_RATE_OF_CHANGE_TEMP_ALARM);
+	ReportFlag(pMsg, pEntry, "movementAlarm", changed, flags,
+		   FLAG_MOVEMENT_ALARM);
+	ReportFlag(pMsg, pEntry, "magnetState", changed, flags,
+		   FLAG_MAGNET_STATE);
 }
 
+/* Only the events that AWS hasn't acknowledged are sent (eventLogAppend).
+ * The entire log is sent after shadow init, when requested, or when
+ * unacknowledged events have been overwritten.  The sequence number is
+ * that of the newest event sent so the cloud can detect gaps.
+ * The log can hold more events than fit in a shadow, so a backlog is sent
+ * oldest first over several updates.
+ */
 static void ShadowLogHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
 {
-	SensorLogEvent_t event = { .epoch = pEntry->ad.epoch,
-				   .data = pEntry->ad.data,
-				   .recordType = pEntry->ad.recordType,
-				   .idLsb = (uint8_t)pEntry->ad.id };
-
-	SensorLog_Add(pEntry->pLog, &event);
+	uint32_t sequence = pEntry->eventSequence;
+	uint32_t unacked = pEntry->eventSequence - pEntry->ackedSequence;
+	if (unacked == 0 && !pEntry->fullLogRequired) {
+		return;
+	}
 
-	SensorLog_GenerateJson(pEntry->pLog, pMsg);
+	if (pEntry->fullLogRequired ||
+	    unacked > SensorLog_GetNumberOfEntries(pEntry->pLog)) {
+		SensorLog_GenerateJson(pEntry->pLog, pMsg);
+		/* AWS replaces arrays, so the previous append is stale. */
+		ShadowBuilder_AddNull(pMsg, "eventLogAppend");
+		pEntry->fullLogRequired = true;
+		pEntry->fullLogSequence = pEntry->eventSequence;
+	} else {
+		size_t sent = SensorLog_GenerateAppendJson(pEntry->pLog, pMsg,
+							   unacked);
+		sequence -= (unacked - sent);
+	}
+	ShadowBuilder_AddUint32(pMsg, "eventLogSequence", sequence);
+	pMsg->sequence = sequence;
 }
 
-/* These special items exist on the gateway and not on the sensor */
+/* These special items exist on the gateway and not on the sensor.
+ * The gateway ID is always sent because a sensor can move between gateways.
+ */
 static void ShadowSpecialHandler(JsonMsg_t *pMsg, SensorEntry_t *pEntry)
 {
 	ShadowBuilder_AddPair(pMsg, "gatewayId", pLte->IMEI, false);
-	ShadowBuilder_AddUint32(pMsg, "eventLogSize",
-				SensorLog_GetSize(pEntry->pLog));
+	ReportUint32(pMsg, pEntry, SHADOW_FIELD_EVENT_LOG_SIZE, "eventLogSize",
+		     SensorLog_GetSize(pEntry->pLog));
+}
+
+/* Returns true (and updates the cache) if the value hasn't been reported. */
+static bool ReportedChanged(SensorEntry_t *pEntry, enum SHADOW_FIELD Field,
+			    uint16_t Value)
+{
+	if ((pEntry->reportedValid & BIT(Field)) != 0 &&
+	    pEntry->reported[Field] == Value) {
+		return false;
+	}
+	pEntry->reportedValid |= BIT(Field);
+	pEntry->reported[Field] = Value;
+	return true;
+}
+
+/* When a field isn't sent the size of the JSON pair is counted. */
+static void ReportUint32(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+			 enum SHADOW_FIELD Field, const char *pKey,
+			 uint32_t Value)
+{
+	if (ReportedChanged(pEntry, Field, (uint16_t)Value)) {
+		ShadowBuilder_AddUint32(pMsg, pKey, Value);
+	} else {
+		pEntry->bytesSaved +=
+			snprintk(NULL, 0, "\"%s\":%u,", pKey, Value);
+	}
+}
+
+static void ReportSigned32(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+			   enum SHADOW_FIELD Field, const char *pKey,
+			   int32_t Value)
+{
+	if (ReportedChanged(pEntry, Field, (uint16_t)Value)) {
+		ShadowBuilder_AddSigned32(pMsg, pKey, Value);
+	} else {
+		pEntry->bytesSaved +=
+			snprintk(NULL, 0, "\"%s\":%d,", pKey, Value);
+	}
+}
+
+/* The value is cached because the string is derived from it. */
+static void ReportPair(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+		       enum SHADOW_FIELD Field, uint16_t Value,
+		       const char *pKey, const char *pStr, bool IsString)
+{
+	if (ReportedChanged(pEntry, Field, Value)) {
+		ShadowBuilder_AddPair(pMsg, pKey, pStr, IsString);
+	} else {
+		pEntry->bytesSaved +=
+			snprintk(NULL, 0, "\"%s\":\"%s\",", pKey, pStr);
+	}
+}
+
+static void ReportFlag(JsonMsg_t *pMsg, SensorEntry_t *pEntry,
+		       const char *pKey, uint16_t Changed, uint16_t Flags,
+		       uint32_t Mask, uint8_t Position)
+{
+	uint32_t value = GetFlag(Flags, Mask, Position);
+	if (GetFlag(Changed, Mask, Position) != 0) {
+		ShadowBuilder_AddUint32(pMsg, pKey, value);
+	} else {
+		pEntry->bytesSaved +=
+			snprintk(NULL, 0, "\"%s\":%u,", pKey, value);
+	}
 }
 
 static void SensorAddrToString(SensorEntry_t *pEntry)
@@ -1207,14 +2769,16 @@ static void GatewayShadowMaker(bool WhitelistProcessed)
 		return;
 	}
 
-	JsonMsg_t *pMsg = BufferPool_Take(
-		FWK_BUFFER_MSG_SIZE(JsonMsg_t, SENSOR_GATEWAY_SHADOW_MAX_SIZE));
+	size_t changed = 0;
+	GatewayShadowChanged(&changed);
+
+	size_t size = SENSOR_GATEWAY_SHADOW_SIZE(tableCapacity);
+	JsonMsg_t *pMsg = BufferPool_Take(FWK_BUFFER_MSG_SIZE(JsonMsg_t, size));
 	if (pMsg == NULL) {
 		return;
 	}
 	pMsg->header.msgCode = FMC_GATEWAY_OUT;
-	pMsg->header.rxId = FWK_ID_CLOUD;
-	pMsg->size = SENSOR_GATEWAY_SHADOW_MAX_SIZE;
+	pMsg->size = size;
 
 	ShadowBuilder_Start(pMsg, SKIP_MEMSET);
 	ShadowBuilder_StartGroup(pMsg, "state");
@@ -1226,40 +2790,86 @@ static void GatewayShadowMaker(bool WhitelistProcessed)
 	}
 	ShadowBuilder_StartGroup(pMsg, "reported");
 	ShadowBuilder_StartGroup(pMsg, "bt510");
+	/* AWS replaces arrays (instead of merging them), so every sensor
+	 * must be present in the update.
+	 */
 	ShadowBuilder_StartArray(pMsg, "sensors");
 	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
+	for (i = 0; i < tableCapacity; i++) {
 		SensorEntry_t *p = &sensorTable[i];
-		if (p->inUse) {
+		if (hotTable[i].inUse) {
 			ShadowBuilder_AddSensorTableArrayEntry(pMsg,
 							       p->addrString,
 							       p->rxEpoch,
 							       p->whitelisted);
 		}
+		p->gatewayDirty = false;
 	}
 	ShadowBuilder_EndArray(pMsg);
+	if (reportPolicyDirty) {
+		ShadowBuilder_StartArray(pMsg, "reportPolicy");
+		ShadowBuilder_AddReportPolicyArrayEntry(pMsg, "*",
+							&defaultPolicy);
+		for (i = 0; i < tableCapacity; i++) {
+			SensorEntry_t *p = &sensorTable[i];
+			if (hotTable[i].inUse && p->customPolicy) {
+				ShadowBuilder_AddReportPolicyArrayEntry(
+					pMsg, p->addrString, &p->policy);
+			}
+		}
+		for (i = 0; i < pendingPolicyCount; i++) {
+			ShadowBuilder_AddReportPolicyArrayEntry(
+				pMsg, pendingPolicies[i].addrString,
+				&pendingPolicies[i].policy);
+		}
+		ShadowBuilder_EndArray(pMsg);
+		reportPolicyDirty = false;
+	}
 	ShadowBuilder_EndGroup(pMsg);
 	ShadowBuilder_EndGroup(pMsg);
 	ShadowBuilder_EndGroup(pMsg);
 	ShadowBuilder_Finalize(pMsg);
 
-	FRAMEWORK_MSG_SEND(pMsg);
+	LOG_DBG("Gateway shadow update (%u of %u sensors changed)", changed,
+		tableCount);
+	gatewayShadowRemoved = false;
+	gatewayShadowUptime = k_uptime_get();
+	SendToCloud(pMsg, JSON_MSG_PRIORITY_ROUTINE);
 }
 
-/* Returns 1 if the value was changed from its current state. */
-static uint32_t WhitelistByAddress(const char *pAddrString, bool NextState)
+/* Returns true if the gateway shadow needs to be updated.
+ * Optionally counts the number of changed sensors.
+ */
+static bool GatewayShadowChanged(size_t *pChanged)
 {
+	size_t changed = 0;
 	size_t i;
-	for (i = 0; i < CONFIG_SENSOR_TABLE_SIZE; i++) {
-		if (AddrStringMatch(pAddrString, i)) {
-			if (sensorTable[i].whitelisted != NextState) {
-				Whitelist(&sensorTable[i], NextState);
-				return 1;
-			} else {
-				return 0;
+	for (i = 0; i < tableCapacity; i++) {
+		if (sensorTable[i].gatewayDirty) {
+			changed += 1;
+			if (pChanged == NULL) {
+				break;
 			}
 		}
 	}
+	if (pChanged != NULL) {
+		*pChanged = changed;
+	}
+	return (changed > 0) || gatewayShadowRemoved || reportPolicyDirty;
+}
+
+/* Returns 1 if the value was changed from its current state. */
+static uint32_t WhitelistByAddress(const char *pAddrString, bool NextState)
+{
+	size_t i = FindTableIndexByString(pAddrString);
+	if (i < tableCapacity) {
+		if (sensorTable[i].whitelisted != NextState) {
+			Whitelist(&sensorTable[i], NextState);
+			return 1;
+		} else {
+			return 0;
+		}
+	}
 	/* Don't add it to the table if it isn't whitelisted because
 	 * the client may not care about this sensor.
 	 */
@@ -1268,8 +2878,11 @@ static uint32_t WhitelistByAddress(const char *pAddrString, bool NextState)
 	 	 * the shadow may have values that aren't in our table.
 		 */
 		bt_addr_t addr = BtAddrStringToStruct(pAddrString);
-		i = AddByAddress(&addr);
-		if (i < CONFIG_SENSOR_TABLE_SIZE) {
+		/* Whitelisted sensors can replace any sensor that
+		 * isn't whitelisted.
+		 */
+		i = AddByAddress(&addr, 0);
+		if (i < tableCapacity) {
 			Whitelist(&sensorTable[i], true);
 			return 1;
 		}
@@ -1279,7 +2892,10 @@ static uint32_t WhitelistByAddress(const char *pAddrString, bool NextState)
 
 static void Whitelist(SensorEntry_t *pEntry, bool NextState)
 {
+	bool changed = (pEntry->whitelisted != NextState);
+	pEntry->gatewayDirty |= changed;
 	pEntry->whitelisted = NextState;
+	pEntry->reportedValid = 0;
 	if (pEntry->whitelisted) {
 		pEntry->subscribed = false;
 		pEntry->getAcceptedSubscribed = false;
@@ -1293,6 +2909,17 @@ static void Whitelist(SensorEntry_t *pEntry, bool NextState)
 		}
 	} else {
 		FreeEntryBuffers(pEntry);
+		ScheduleTimeToLive(pEntry - sensorTable);
+		if (changed) {
+			SensorLogStore_Delete(pEntry->addrString);
+		}
+	}
+	ScheduleSubscription(pEntry - sensorTable);
+	if (pEntry->gatewayDirty) {
+		ScheduleGatewayShadow();
+	}
+	if (changed) {
+		ScheduleSnapshot();
 	}
 }
 
@@ -1301,10 +2928,11 @@ static void Whitelist(SensorEntry_t *pEntry, bool NextState)
  */
 static void ConnectRequestHandler(size_t Index, bool Coded)
 {
-	FRAMEWORK_DEBUG_ASSERT(Index < CONFIG_SENSOR_TABLE_SIZE);
+	FRAMEWORK_DEBUG_ASSERT(Index < tableCapacity);
 	SensorEntry_t *pEntry = &sensorTable[Index];
 
-	if (pEntry->pCmd != NULL && !pEntry->configBusy) {
+	if (pEntry->pCmd != NULL && !pEntry->configBusy &&
+	    pEntry->cmdDispatchTime <= k_uptime_get()) {
 		if (LowBatteryAlarm(pEntry)) {
 			LOG_WRN("Discarding configuration request (sensor low battery)");
 			FreeCmdBuffers(pEntry);
@@ -1318,6 +2946,7 @@ static void ConnectRequestHandler(size_t Index, bool Coded)
 			       sizeof(bt_addr_t));
 			pMsg->addr.type = BT_ADDR_LE_RANDOM;
 			pMsg->useCodedPhy = Coded;
+			pMsg->firmwareVersion = GetFirmwareVersion(pEntry);
 			strncpy(pMsg->name, pEntry->name,
 				SENSOR_NAME_MAX_STR_LEN);
 
@@ -1330,16 +2959,85 @@ static void ConnectRequestHandler(size_t Index, bool Coded)
 	}
 }
 
-static void CreateDumpRequest(SensorEntry_t *pEntry)
+static uint32_t GetFirmwareVersion(SensorEntry_t *pEntry)
 {
-	/* If an empty command is written by cloud, then send dump command. */
-	const char *pCmd;
-	if (strlen(queryCmd) != 0) {
-		pCmd = queryCmd;
-	} else {
-		pCmd = SENSOR_CMD_DUMP;
+	if (!pEntry->validRsp) {
+		return 0;
+	}
+	return ((uint32_t)pEntry->rsp.firmwareVersionMajor << 16) |
+	       ((uint32_t)pEntry->rsp.firmwareVersionMinor << 8) |
+	       pEntry->rsp.firmwareVersionPatch;
+}
+
+/* Only set commands from AWS are merged.  The newer message is reused if the
+ * merged command fits.  Both messages are consumed when a merge occurs.
+ */
+static SensorCmdMsg_t *MergeConfigRequest(SensorCmdMsg_t *pOlder,
+					  SensorCmdMsg_t *pNewer)
+{
+	if (pOlder->dumpRequest || pOlder->setEpochRequest ||
+	    pNewer->dumpRequest || pNewer->setEpochRequest) {
+		return NULL;
+	}
+
+	size_t bufSize = pOlder->length + pNewer->length + 1;
+	SensorCmdMsg_t *pMsg =
+		BufferPool_Take(FWK_BUFFER_MSG_SIZE(SensorCmdMsg_t, bufSize));
+	if (pMsg == NULL) {
+		return NULL;
+	}
+
+	size_t length =
+		SensorCmd_MergeSet(pOlder->cmd, pNewer->cmd, pMsg->cmd, bufSize);
+	if (length == 0) {
+		BufferPool_Free(pMsg);
+		return NULL;
+	}
+
+	memcpy(pMsg, pNewer, sizeof(SensorCmdMsg_t));
+	pMsg->size = bufSize;
+	pMsg->length = length;
+	pMsg->attempts = 0;
+	pMsg->resetRequest = pOlder->resetRequest || pNewer->resetRequest;
+	BufferPool_Free(pOlder);
+	BufferPool_Free(pNewer);
+	return pMsg;
+}
+
+/* The params of the set command are reported (AWS clears the delta).
+ * The command is terminated after the params object because the message
+ * is freed after this.
+ */
+static void AckMatchingConfig(SensorEntry_t *pEntry, SensorCmdMsg_t *pMsg)
+{
+	size_t prefix = strlen(SENSOR_CMD_SET_PREFIX);
+	size_t suffix = strlen(SENSOR_CMD_SUFFIX);
+	LOG_INF("Config for sensor '%s' matches its state (no connection)",
+		log_strdup(pEntry->name));
+	if (pMsg->length > (prefix + suffix) &&
+	    strncmp(pMsg->cmd, SENSOR_CMD_SET_PREFIX, prefix) == 0) {
+		pMsg->cmd[pMsg->length - suffix] = 0;
+		PublishReportedConfig(&pMsg->cmd[prefix], pEntry->addrString);
+	}
+}
+
+/* Only the owner of the lease connects to the sensor. */
+static void CreateFirstRequest(SensorEntry_t *pEntry)
+{
+	if (!pEntry->subscribed || !LeaseOwner(pEntry)) {
+		return;
 	}
 
+	if (pEntry->rsp.configVersion == 0) {
+		CreateConfigRequest(pEntry);
+	} else if (!pEntry->firstDumpComplete) {
+		CreateDumpRequest(pEntry);
+	}
+}
+
+static void CreateDumpRequest(SensorEntry_t *pEntry)
+{
+	const char *pCmd = SensorTable_GetQueryCmd();
 	size_t bufSize = strlen(pCmd) + 1;
 	SensorCmdMsg_t *pMsg =
 		BufferPool_Take(FWK_BUFFER_MSG_SIZE(SensorCmdMsg_t, bufSize));
@@ -1412,7 +3110,7 @@ static uint32_t GetFlag(uint16_t Value, uint32_t Mask, uint8_t Position)
 	return (v >> Position);
 }
 
-static void PublishToGetAccepted(SensorEntry_t *pEntry)
+static void PublishToGetAccepted(SensorEntry_t *pEntry, const char *pFmt)
 {
 	size_t size = sizeof(GET_ACCEPTED_MSG);
 	JsonMsg_t *pMsg = BufferPool_Take(FWK_BUFFER_MSG_SIZE(JsonMsg_t, size));
@@ -1421,12 +3119,297 @@ static void PublishToGetAccepted(SensorEntry_t *pEntry)
 	}
 
 	pMsg->header.msgCode = FMC_SENSOR_PUBLISH;
-	pMsg->header.rxId = FWK_ID_CLOUD;
 	pMsg->size = size;
-	char *fmt = SENSOR_GET_TOPIC_FMT_STR;
-	snprintk(pMsg->topic, CONFIG_AWS_TOPIC_MAX_SIZE, fmt,
+	pMsg->sequence = 0;
+	snprintk(pMsg->topic, CONFIG_AWS_TOPIC_MAX_SIZE, pFmt,
 		 pEntry->addrString);
 	strcpy(pMsg->buffer, GET_ACCEPTED_MSG);
 	pMsg->length = strlen(pMsg->buffer);
-	FRAMEWORK_MSG_SEND(pMsg);
+	SendToCloud(pMsg, JSON_MSG_PRIORITY_ROUTINE);
+}
+
+static void Schedule(size_t Index, enum SENSOR_DEADLINE Type, int64_t Delay)
+{
+	SensorDeadline_Schedule(pDeadlines, DEADLINE_KEY(Index, Type),
+				k_uptime_get() + Delay);
+}
+
+/* The last seen time is updated for every advertisement without changing
+ * the deadline.  When the deadline expires it is moved if the sensor
+ * was seen in the meantime.
+ */
+static void ScheduleTimeToLive(size_t Index)
+{
+	if (!hotTable[Index].inUse || sensorTable[Index].whitelisted) {
+		return;
+	}
+
+	int64_t expiry =
+		((int64_t)hotTable[Index].lastSeen + CONFIG_SENSOR_TTL_SECONDS) *
+		MSEC_PER_SEC;
+	SensorDeadline_Schedule(pDeadlines,
+				DEADLINE_KEY(Index, SENSOR_DEADLINE_TTL),
+				expiry);
+}
+
+static void ScheduleSubscription(size_t Index)
+{
+	SensorEntry_t *pEntry = &sensorTable[Index];
+	if (pEntry->whitelisted != pEntry->subscribed) {
+		SensorDeadline_Schedule(
+			pDeadlines,
+			DEADLINE_KEY(Index, SENSOR_DEADLINE_SUBSCRIBE),
+			pEntry->subscriptionDispatchTime);
+	}
+}
+
+static void ScheduleGatewayShadow(void)
+{
+	if (CONFIG_USE_SINGLE_AWS_TOPIC) {
+		return;
+	}
+
+	if (!SensorDeadline_IsPending(pDeadlines,
+				      GATEWAY_SHADOW_DEADLINE_KEY)) {
+		SensorDeadline_Schedule(
+			pDeadlines, GATEWAY_SHADOW_DEADLINE_KEY,
+			gatewayShadowUptime +
+				(CONFIG_SENSOR_GATEWAY_SHADOW_INTERVAL_SECONDS *
+				 MSEC_PER_SEC));
+	}
+}
+
+static void CancelDeadlines(size_t Index)
+{
+	size_t type;
+	for (type = 0; type < SENSOR_DEADLINE_COUNT; type++) {
+		SensorDeadline_Cancel(pDeadlines, DEADLINE_KEY(Index, type));
+	}
+}
+
+static void TimeToLiveHandler(size_t Index)
+{
+	SensorEntry_t *p = &sensorTable[Index];
+	if (!hotTable[Index].inUse || p->whitelisted) {
+		return;
+	}
+
+	uint32_t idle = UptimeSeconds() - hotTable[Index].lastSeen;
+	if (idle >= CONFIG_SENSOR_TTL_SECONDS) {
+		LOG_WRN("Removing '%s' sensor %s from table",
+			log_strdup(p->name), log_strdup(p->addrString));
+		RemoveEntry(p);
+	} else {
+		ScheduleTimeToLive(Index);
+	}
+}
+
+static void SubscriptionHandler(size_t Index)
+{
+	SensorEntry_t *pEntry = &sensorTable[Index];
+	/* Waiting until AD and RSP are valid makes things easier for config.
+	 * When subscribing there must be a delay to allow AWS to configure
+	 * permissions.
+	 */
+	if (!hotTable[Index].validAd || !pEntry->validRsp ||
+	    (pEntry->whitelisted == pEntry->subscribed)) {
+		return;
+	}
+
+	if (pEntry->subscriptionDispatchTime > k_uptime_get()) {
+		ScheduleSubscription(Index);
+		return;
+	}
+
+	/* The claims of other gateways are on the lease shadow. */
+	if (!BatchSubscription(Index, pEntry->whitelisted,
+			       SENSOR_SUBSCRIPTION_TOPIC_FMT_STR) ||
+	    (LeasesEnabled() &&
+	     (!BatchSubscription(Index, pEntry->whitelisted,
+				 SENSOR_LEASE_ACCEPTED_TOPIC_FMT_STR) ||
+	      !BatchSubscription(Index, pEntry->whitelisted,
+				 SENSOR_LEASE_GET_RESULT_TOPIC_FMT_STR)))) {
+		Schedule(Index, SENSOR_DEADLINE_SUBSCRIBE,
+			 SENSOR_DEADLINE_RETRY_MS);
+		return;
+	}
+
+	/* For now, assume the subscription will work. */
+	pEntry->subscribed = pEntry->whitelisted;
+	if (pEntry->subscribed) {
+		/* The get accepted topic is sent in the same packet. */
+		GetAcceptedSubscriptionHandler(Index);
+	}
+}
+
+/* After reset or disconnect read shadow to re-populate event log. */
+static void GetAcceptedSubscriptionHandler(size_t Index)
+{
+	SensorEntry_t *pEntry = &sensorTable[Index];
+	if (!pEntry->subscribed || pEntry->getAcceptedSubscribed ||
+	    pEntry->shadowInitReceived) {
+		return;
+	}
+
+	BatchSubscription(Index, true, SENSOR_GET_ACCEPTED_TOPIC_FMT_STR);
+	/* Try again if the subscription isn't acknowledged. */
+	Schedule(Index, SENSOR_DEADLINE_GET_ACCEPTED, SENSOR_DEADLINE_RETRY_MS);
+}
+
+/* Request sensor shadow until it is received. */
+static void InitShadowHandler(size_t Index)
+{
+	SensorEntry_t *pEntry = &sensorTable[Index];
+	if (!pEntry->getAcceptedSubscribed || pEntry->shadowInitReceived) {
+		return;
+	}
+
+	int64_t next = initShadowUptime + SENSOR_INIT_SHADOW_SPACING_MS;
+	if (initShadowUptime != 0 && next > k_uptime_get()) {
+		SensorDeadline_Schedule(
+			pDeadlines,
+			DEADLINE_KEY(Index, SENSOR_DEADLINE_INIT_SHADOW), next);
+		return;
+	}
+
+	PublishToGetAccepted(pEntry, SENSOR_GET_TOPIC_FMT_STR);
+	initShadowUptime = k_uptime_get();
+	Schedule(Index, SENSOR_DEADLINE_INIT_SHADOW,
+		 SENSOR_INIT_SHADOW_RETRY_MS);
+}
+
+/* Request the lease until it is received.  It is read after every reset
+ * (the claims made while the gateway was off aren't known).
+ */
+static void LeaseReadHandler(size_t Index)
+{
+	SensorEntry_t *pEntry = &sensorTable[Index];
+	if (!LeasesEnabled() || !pEntry->subscribed || pEntry->leaseKnown) {
+		return;
+	}
+
+	PublishToGetAccepted(pEntry, SENSOR_LEASE_GET_TOPIC_FMT_STR);
+	Schedule(Index, SENSOR_DEADLINE_LEASE, SENSOR_INIT_SHADOW_RETRY_MS);
+}
+
+/* The first event is published immediately and opens a window.  Events
+ * that occur while the window is open are published when it closes (and
+ * a new window is opened).
+ */
+static void ShadowWindowHandler(size_t Index)
+{
+	SensorEntry_t *pEntry = &sensorTable[Index];
+	if (pEntry->pendingEvents <= pEntry->heldEvents) {
+		return;
+	}
+
+	ShadowMaker(pEntry);
+	/* If a buffer wasn't available, then the events are still pending. */
+	if (CONFIG_SENSOR_SHADOW_WINDOW_SECONDS != 0) {
+		Schedule(Index, SENSOR_DEADLINE_SHADOW_WINDOW,
+			 CONFIG_SENSOR_SHADOW_WINDOW_SECONDS * MSEC_PER_SEC);
+	}
+}
+
+/* A held temperature is published (the interval or heartbeat expired). */
+static void ReportPolicyHandler(size_t Index)
+{
+	sensorTable[Index].heldEvents = 0;
+	ShadowWindowHandler(Index);
+}
+
+static void GatewayShadowDeadlineHandler(void)
+{
+	if (!GatewayShadowChanged(NULL)) {
+		return;
+	}
+
+	GatewayShadowMaker(false);
+
+	/* Generation may not be allowed yet (or a buffer wasn't available). */
+	if (GatewayShadowChanged(NULL)) {
+		SensorDeadline_Schedule(
+			pDeadlines, GATEWAY_SHADOW_DEADLINE_KEY,
+			k_uptime_get() +
+				(CONFIG_SENSOR_GATEWAY_SHADOW_INTERVAL_SECONDS *
+				 MSEC_PER_SEC));
+	}
+}
+
+/* Topics are collected while the deadlines are processed.  They are sent
+ * to the cloud task (in as few messages as possible) after all of the
+ * expired deadlines have been handled.
+ */
+static bool BatchSubscription(size_t Index, bool Subscribe, const char *pFmt)
+{
+	SubscribeMsg_t **ppMsg =
+		Subscribe ? &pSubscribeBatch : &pUnsubscribeBatch;
+
+	if (*ppMsg != NULL &&
+	    (*ppMsg)->count >= CONFIG_SENSOR_SUBSCRIBE_BATCH_MAX_SIZE) {
+		SendSubscriptionBatch(ppMsg);
+	}
+
+	if (*ppMsg == NULL) {
+		*ppMsg = BufferPool_Take(sizeof(SubscribeMsg_t));
+		if (*ppMsg == NULL) {
+			return false;
+		}
+		(*ppMsg)->header.msgCode = FMC_SUBSCRIBE;
+		(*ppMsg)->header.rxId = FWK_ID_CLOUD;
+		(*ppMsg)->header.txId = FWK_ID_SENSOR_TASK;
+		(*ppMsg)->subscribe = Subscribe;
+		(*ppMsg)->count = 0;
+	}
+
+	SubscribeTopic_t *pTopic = &(*ppMsg)->topics[(*ppMsg)->count];
+	pTopic->tableIndex = Index;
+	pTopic->success = false;
+	snprintk(pTopic->topic, CONFIG_AWS_TOPIC_MAX_SIZE, pFmt,
+		 sensorTable[Index].addrString);
+	(*ppMsg)->count += 1;
+	return true;
+}
+
+static void SendSubscriptionBatch(SubscribeMsg_t **ppMsg)
+{
+	SubscribeMsg_t *pMsg = *ppMsg;
+	if (pMsg != NULL) {
+		*ppMsg = NULL;
+		FRAMEWORK_MSG_SEND(pMsg);
+	}
+}
+
+static void SubscriptionAck(bool Subscribe, SubscribeTopic_t *pTopic)
+{
+	if (pTopic->tableIndex >= tableCapacity) {
+		return;
+	}
+
+	SensorEntry_t *p = &sensorTable[pTopic->tableIndex];
+	if (strstr(pTopic->topic, SENSOR_GET_ACCEPTED_SUB_STR) != NULL) {
+		if (pTopic->success) {
+			p->getAcceptedSubscribed = true;
+			Schedule(pTopic->tableIndex, SENSOR_DEADLINE_INIT_SHADOW,
+				 0);
+		}
+	} else if (strstr(pTopic->topic, SENSOR_LEASE_SUB_STR) != NULL) {
+		/* Lease claims (retried with the delta subscription) */
+		if (pTopic->success && Subscribe) {
+			Schedule(pTopic->tableIndex, SENSOR_DEADLINE_LEASE, 0);
+		} else if (!pTopic->success) {
+			p->subscribed = !Subscribe;
+			Schedule(pTopic->tableIndex, SENSOR_DEADLINE_SUBSCRIBE,
+				 SENSOR_DEADLINE_RETRY_MS);
+		}
+	} else {
+		/* This is a delta subscription ack */
+		if (pTopic->success) {
+			CreateFirstRequest(p);
+		} else { /* Try again (most likely AWS disconnect has occurred) */
+			p->subscribed = !Subscribe;
+			Schedule(pTopic->tableIndex, SENSOR_DEADLINE_SUBSCRIBE,
+				 SENSOR_DEADLINE_RETRY_MS);
+		}
+	}
 }
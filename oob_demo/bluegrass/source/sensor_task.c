@@ -22,12 +22,13 @@ LOG_MODULE_REGISTER(sensor_task);
 #include <bluetooth/bluetooth.h>
 
 #include "FrameworkIncludes.h"
-#include "Bracket.h"
 #include "laird_bluetooth.h"
 #include "bt_scan.h"
 #include "vsp_definitions.h"
 #include "qrtc.h"
+#include "json_framer.h"
 #include "sensor_cmd.h"
+#include "sensor_gatt_cache.h"
 #include "sensor_table.h"
 #include "sensor_task.h"
 
@@ -53,8 +54,10 @@ LOG_MODULE_REGISTER(sensor_task);
 #define SENSOR_TASK_MAX_OUTSTANDING_ADS (SENSOR_TASK_QUEUE_DEPTH / 2)
 #endif
 
-/** At 1 second there are duplicate requests for shadow information. */
-#define SENSOR_TICK_RATE_SECONDS 3
+/** Number of advertisements between processing rate reports */
+#ifndef SENSOR_TASK_AD_STATS_INTERVAL
+#define SENSOR_TASK_AD_STATS_INTERVAL 1000
+#endif
 
 #define ENCRYPTION_TIMEOUT_TICKS K_SECONDS(2)
 #define CONNECTION_TIMEOUT_TICKS K_SECONDS(CONFIG_BT_CREATE_CONN_TIMEOUT + 2)
@@ -64,8 +67,35 @@ LOG_MODULE_REGISTER(sensor_task);
 
 #define SENSOR_PIN_DEFAULT 123456
 
-typedef struct SensorTask {
-	FwkMsgTask_t msgTask;
+#ifndef CONFIG_SENSOR_CONFIG_CONNECTIONS
+#define CONFIG_SENSOR_CONFIG_CONNECTIONS 2
+#endif
+
+#ifndef CONFIG_SENSOR_CONFIG_READBACK
+#define CONFIG_SENSOR_CONFIG_READBACK 0
+#endif
+
+#ifndef CONFIG_SENSOR_WRITE_WINDOW
+#define CONFIG_SENSOR_WRITE_WINDOW 4
+#endif
+
+/* One connection is reserved for the phone. */
+BUILD_ASSERT(CONFIG_SENSOR_CONFIG_CONNECTIONS < CONFIG_BT_MAX_CONN,
+	     "Too many sensor connections");
+
+/* Messages that belong to a connection state machine */
+typedef struct SensorLinkMsg {
+	FwkMsgHeader_t header;
+	uint8_t link;
+	size_t size; /** number of bytes */
+	size_t length; /** of the data */
+	char buffer[];
+} SensorLinkMsg_t;
+
+/* Each sensor that is being configured has its own connection state
+ * machine.  The stack only allows one connection to be created at a time.
+ */
+typedef struct SensorLink {
 	struct bt_conn *conn;
 	struct bt_gatt_discover_params dp;
 	struct bt_gatt_subscribe_params sp;
@@ -76,15 +106,59 @@ typedef struct SensorTask {
 	bool paired;
 	bool resetSent;
 	bool configComplete;
-	BracketObj_t *pBracket;
+	bool readback;
+	bool cachedHandles;
+	bool passkeyEntered; /* false when a bonded sensor is encrypted */
+	bool unpair;
+	JsonFramer_t framer;
+	SensorLinkMsg_t *pRsp; /* response being framed (BT RX thread) */
 	SensorCmdMsg_t *pCmdMsg;
-	bool awsReady;
+	const char *pTx; /* string being written */
+	bool txFree; /* pTx is returned to the buffer pool when written */
+	size_t txLength;
+	size_t txIndex;
+	uint32_t txPending; /* writes queued to the stack */
+	int64_t txStartUptime;
+	struct k_timer timer;
 	struct k_timer resetTimer;
+	int64_t startUptime;
+	int64_t connectedUptime;
+	int64_t discoveredUptime;
+	int64_t writeUptime;
+} SensorLink_t;
+
+/* Configuration throughput.  A rollout starts when a connection is requested
+ * and all links are idle.  It ends when all links are idle again.
+ */
+typedef struct SensorRollout {
+	int64_t startUptime;
+	uint32_t configured;
+	uint32_t failed;
+	uint32_t readbacks;
+	uint32_t busyMs; /* sum of connection durations */
+	uint32_t discoveries;
+	uint32_t cacheHits;
+	uint32_t discoveryMs; /* sum of MTU exchange and discovery durations */
+	uint32_t writes;
+	uint32_t bonded;
+	uint32_t firstWriteMs; /* sum of connection to first write durations */
+} SensorRollout_t;
+
+typedef struct SensorTask {
+	FwkMsgTask_t msgTask;
+	SensorLink_t links[CONFIG_SENSOR_CONFIG_CONNECTIONS];
+	bool creatingConnection;
+	SensorRollout_t rollout;
+	bool awsReady;
 	struct k_timer sensorTick;
+	int64_t tickDeadline;
 	uint32_t fifoTicks;
 	int scanUserId;
 	uint32_t configDisconnects;
 	uint32_t adsProcessed;
+	uint32_t adStatsCount;
+	uint64_t adStatsCycles;
+	int64_t adStatsUptime;
 	atomic_t adsOutstanding; /* incremented in BT RX thread context */
 	atomic_t adsDropped; /* incremented in BT RX thread context */
 } SensorTaskObj_t;
@@ -119,6 +193,9 @@ static DispatchResult_t SensorTickHandler(FwkMsgReceiver_t *pMsgRxer,
 static DispatchResult_t WhitelistRequestMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 						   FwkMsg_t *pMsg);
 
+static DispatchResult_t ReportPolicyMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+					       FwkMsg_t *pMsg);
+
 static DispatchResult_t ConfigRequestMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 						FwkMsg_t *pMsg);
 
@@ -142,6 +219,8 @@ static DispatchResult_t ResponseHandler(FwkMsgReceiver_t *pMsgRxer,
 
 static DispatchResult_t SendResetHandler(FwkMsgReceiver_t *pMsgRxer,
 					 FwkMsg_t *pMsg);
+static DispatchResult_t WriteCompleteMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+						FwkMsg_t *pMsg);
 
 static DispatchResult_t AwsConnectionMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 						FwkMsg_t *pMsg);
@@ -155,24 +234,46 @@ static DispatchResult_t SubscriptionAckMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 static DispatchResult_t SensorShadowInitMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 						   FwkMsg_t *pMsg);
 
+static DispatchResult_t SensorLeaseMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+					      FwkMsg_t *pMsg);
+
+static DispatchResult_t PublishAckMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+					     FwkMsg_t *pMsg);
+
+static DispatchResult_t PublishDroppedMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+						 FwkMsg_t *pMsg);
+static DispatchResult_t EventLogRequestMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+						  FwkMsg_t *pMsg);
+
 static void RegisterConnectionCallbacks(void);
-static int StartDiscovery(void);
-static int ExchangeMtu(void);
-static int RequestDisconnect(SensorTaskObj_t *pObj, const char *str);
-
-static int Discover(void);
-static int Subscribe(void);
-static int WriteString(const char *str);
-static void CreateAndSendResponseMsg(BracketObj_t *p);
-static DispatchResult_t RetryConfigRequest(SensorTaskObj_t *pObj);
-static void AckConfigRequest(SensorTaskObj_t *pObj);
-static void SendSetEpochCommand(void);
+static int StartDiscovery(SensorLink_t *pLink);
+static int ExchangeMtu(SensorLink_t *pLink);
+static int RequestDisconnect(SensorLink_t *pLink, const char *str);
+
+static int Discover(SensorLink_t *pLink);
+static int Subscribe(SensorLink_t *pLink);
+static int WriteString(SensorLink_t *pLink, const char *str, bool FreeStr);
+static int WriteWindow(SensorLink_t *pLink);
+static void FreeTxString(SensorLink_t *pLink);
+static void FrameResponse(SensorLink_t *pLink, const char *pData,
+			  size_t Length);
+static void FreeResponse(SensorLink_t *pLink);
+static void SendLinkMsg(SensorLink_t *pLink, FwkMsgCode_t Code);
+static SensorLink_t *GetLink(FwkMsg_t *pMsg);
+static SensorLink_t *FindLink(struct bt_conn *conn);
+static SensorLink_t *FindFreeLink(void);
+static bool LinksIdle(void);
+static DispatchResult_t RetryConfigRequest(SensorLink_t *pLink);
+static void AckConfigRequest(SensorLink_t *pLink);
+static void SendSetEpochCommand(SensorLink_t *pLink);
+static void RolloutHandler(SensorTaskObj_t *pObj, SensorLink_t *pLink);
+static void LinkTimingHandler(SensorTaskObj_t *pObj, SensorLink_t *pLink);
 
 static void ConnectedCallback(struct bt_conn *conn, uint8_t err);
 static void DisconnectedCallback(struct bt_conn *conn, uint8_t reason);
 
 static int RegisterSecurityCallbacks(void);
-static int EncryptLink(SensorTaskObj_t *pObj);
+static int EncryptLink(SensorLink_t *pLink);
 static void PasskeyDisplayCallback(struct bt_conn *conn, unsigned int passkey);
 static void PasskeyEntryCallback(struct bt_conn *conn);
 static void PasskeyConfirmCallback(struct bt_conn *conn, unsigned int passkey);
@@ -192,12 +293,17 @@ static uint8_t NotificationCallback(struct bt_conn *conn,
 				    struct bt_gatt_subscribe_params *params,
 				    const void *data, uint16_t length);
 
+static void WriteCompleteCallback(struct bt_conn *conn, void *user_data);
+
 static void MtuCallback(struct bt_conn *conn, uint8_t err,
 			struct bt_gatt_exchange_params *params);
 
+static void LinkTimerCallbackIsr(struct k_timer *timer_id);
 static void SendSensorResetTimerCallbackIsr(struct k_timer *timer_id);
 static void SensorTickCallbackIsr(struct k_timer *timer_id);
-static void StartSensorTick(SensorTaskObj_t *pObj);
+static void UpdateSensorTick(SensorTaskObj_t *pObj);
+static void StopSensorTick(SensorTaskObj_t *pObj);
+static void AdStatsHandler(SensorTaskObj_t *pObj, uint32_t Cycles);
 
 #ifdef CONFIG_SCAN_FOR_BT510
 static void SensorTaskAdvHandler(const bt_addr_le_t *addr, int8_t rssi,
@@ -215,6 +321,7 @@ static FwkMsgHandler_t SensorTaskMsgDispatcher(FwkMsgCode_t MsgCode)
 	case FMC_ADV:                      return AdvertisementMsgHandler;
 	case FMC_SENSOR_TICK:              return SensorTickHandler;
 	case FMC_WHITELIST_REQUEST:        return WhitelistRequestMsgHandler;
+	case FMC_REPORT_POLICY:            return ReportPolicyMsgHandler;
 	case FMC_CONFIG_REQUEST:           return ConfigRequestMsgHandler;
 	case FMC_CONNECT_REQUEST:          return ConnectRequestMsgHandler;
 	case FMC_START_DISCOVERY:          return StartDiscoveryMsgHandler;
@@ -223,11 +330,16 @@ static FwkMsgHandler_t SensorTaskMsgDispatcher(FwkMsgCode_t MsgCode)
 	case FMC_DISCOVERY_FAILED:         return DiscoveryMsgHandler;
 	case FMC_RESPONSE:                 return ResponseHandler;
 	case FMC_SEND_RESET:               return SendResetHandler;
+	case FMC_WRITE_COMPLETE:           return WriteCompleteMsgHandler;
 	case FMC_PERIODIC:                 return PeriodicTimerMsgHandler;
 	case FMC_AWS_CONNECTED:            return AwsConnectionMsgHandler;
 	case FMC_AWS_DISCONNECTED:         return AwsConnectionMsgHandler;
 	case FMC_SUBSCRIBE_ACK:            return SubscriptionAckMsgHandler;
 	case FMC_SENSOR_SHADOW_INIT:       return SensorShadowInitMsgHandler;
+	case FMC_SENSOR_PUBLISH_ACK:       return PublishAckMsgHandler;
+	case FMC_SENSOR_PUBLISH_DROPPED:   return PublishDroppedMsgHandler;
+	case FMC_SENSOR_LOG_REQUEST:       return EventLogRequestMsgHandler;
+	case FMC_SENSOR_LEASE:             return SensorLeaseMsgHandler;
 	case FMC_AWS_DECOMMISSION:         return AwsDecommissionMsgHandler;
 	default:                           return NULL;
 	}
@@ -255,10 +367,10 @@ void SensorTask_Initialize(void)
 
 	k_thread_name_set(st.msgTask.pTid, FWK_FNAME);
 
-	st.pBracket =
-		Bracket_Initialize(CONFIG_JSON_BRACKET_BUFFER_SIZE,
-				   k_malloc(CONFIG_JSON_BRACKET_BUFFER_SIZE));
-	st.conn = NULL;
+	size_t i;
+	for (i = 0; i < CONFIG_SENSOR_CONFIG_CONNECTIONS; i++) {
+		st.links[i].conn = NULL;
+	}
 	RegisterConnectionCallbacks();
 	RegisterSecurityCallbacks();
 }
@@ -271,12 +383,21 @@ static void SensorTaskThread(void *pArg1, void *pArg2, void *pArg3)
 	SensorTaskObj_t *pObj = (SensorTaskObj_t *)pArg1;
 
 	SensorTable_Initialize();
+	pObj->adStatsUptime = k_uptime_get();
 
-	k_timer_init(&pObj->resetTimer, SendSensorResetTimerCallbackIsr, NULL);
-	k_timer_user_data_set(&pObj->resetTimer, pObj);
+	size_t i;
+	for (i = 0; i < CONFIG_SENSOR_CONFIG_CONNECTIONS; i++) {
+		SensorLink_t *pLink = &pObj->links[i];
+		k_timer_init(&pLink->timer, LinkTimerCallbackIsr, NULL);
+		k_timer_user_data_set(&pLink->timer, pLink);
+		k_timer_init(&pLink->resetTimer,
+			     SendSensorResetTimerCallbackIsr, NULL);
+		k_timer_user_data_set(&pLink->resetTimer, pLink);
+	}
 
 	k_timer_init(&pObj->sensorTick, SensorTickCallbackIsr, NULL);
 	k_timer_user_data_set(&pObj->sensorTick, pObj);
+	pObj->tickDeadline = SENSOR_DEADLINE_NONE;
 
 #ifdef CONFIG_SCAN_FOR_BT510
 	bt_scan_register(&pObj->scanUserId, SensorTaskAdvHandler);
@@ -285,6 +406,7 @@ static void SensorTaskThread(void *pArg1, void *pArg2, void *pArg3)
 
 	while (true) {
 		Framework_MsgReceiver(&pObj->msgTask.rxer);
+		UpdateSensorTick(pObj);
 		uint32_t numUsed =
 			k_msgq_num_used_get(pObj->msgTask.rxer.pQueue);
 		if (numUsed > SENSOR_TASK_QUEUE_DEPTH / 2) {
@@ -298,11 +420,14 @@ DispatchResult_t AdvertisementMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 					 FwkMsg_t *pMsg)
 {
 	AdvMsg_t *pAdvMsg = (AdvMsg_t *)pMsg;
+	uint32_t start = k_cycle_get_32();
 	SensorTable_AdvertisementHandler(&pAdvMsg->addr, pAdvMsg->rssi,
 					 pAdvMsg->type, &pAdvMsg->ad);
+	uint32_t cycles = k_cycle_get_32() - start;
 
 	SensorTaskObj_t *pObj = FWK_TASK_CONTAINER(SensorTaskObj_t);
 	pObj->adsProcessed += 1;
+	AdStatsHandler(pObj, cycles);
 	atomic_dec(&pObj->adsOutstanding);
 	/* Attempt to limit prints when busy. */
 	if (atomic_get(&pObj->adsOutstanding) == 0) {
@@ -314,6 +439,29 @@ DispatchResult_t AdvertisementMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 	return DISPATCH_OK;
 }
 
+/* Compare the rate that advertisements arrive with the rate that the
+ * sensor table could process them (based on the time spent in the handler).
+ */
+static void AdStatsHandler(SensorTaskObj_t *pObj, uint32_t Cycles)
+{
+	pObj->adStatsCycles += Cycles;
+	pObj->adStatsCount += 1;
+	if (pObj->adStatsCount < SENSOR_TASK_AD_STATS_INTERVAL) {
+		return;
+	}
+
+	uint64_t us = k_cyc_to_us_floor64(pObj->adStatsCycles);
+	int64_t ms = k_uptime_delta(&pObj->adStatsUptime);
+	us = MAX(us, 1);
+	ms = MAX(ms, 1);
+	LOG_INF("Ads received: %u/s processing capacity: %u/s (%u us each)",
+		(uint32_t)((pObj->adStatsCount * MSEC_PER_SEC) / ms),
+		(uint32_t)((pObj->adStatsCount * USEC_PER_SEC) / us),
+		(uint32_t)(us / pObj->adStatsCount));
+	pObj->adStatsCount = 0;
+	pObj->adStatsCycles = 0;
+}
+
 static DispatchResult_t WhitelistRequestMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 						   FwkMsg_t *pMsg)
 {
@@ -322,17 +470,22 @@ static DispatchResult_t WhitelistRequestMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 	return DISPATCH_OK;
 }
 
+static DispatchResult_t ReportPolicyMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+					       FwkMsg_t *pMsg)
+{
+	UNUSED_PARAMETER(pMsgRxer);
+	SensorTable_ProcessReportPolicyMsg((SensorReportPolicyMsg_t *)pMsg);
+	return DISPATCH_OK;
+}
+
 static DispatchResult_t SensorTickHandler(FwkMsgReceiver_t *pMsgRxer,
 					  FwkMsg_t *pMsg)
 {
 	UNUSED_PARAMETER(pMsg);
 	SensorTaskObj_t *pObj = FWK_TASK_CONTAINER(SensorTaskObj_t);
+	pObj->tickDeadline = SENSOR_DEADLINE_NONE;
 	if (pObj->awsReady) {
-		SensorTable_TimeToLiveHandler();
-		SensorTable_SubscriptionHandler(); /* sensor shadow  delta */
-		SensorTable_GetAcceptedSubscriptionHandler();
-		SensorTable_InitShadowHandler();
-		StartSensorTick(pObj);
+		SensorTable_DeadlineHandler();
 	}
 	return DISPATCH_OK;
 }
@@ -340,14 +493,22 @@ static DispatchResult_t SensorTickHandler(FwkMsgReceiver_t *pMsgRxer,
 static DispatchResult_t StartDiscoveryMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 						 FwkMsg_t *pMsg)
 {
-	UNUSED_PARAMETER(pMsg);
 	SensorTaskObj_t *pObj = FWK_TASK_CONTAINER(SensorTaskObj_t);
-	pObj->connected = true;
-	k_timer_stop(&pObj->msgTask.timer);
-	if (ExchangeMtu() == BT_SUCCESS) {
-		StartDiscovery();
+	SensorLink_t *pLink = GetLink(pMsg);
+	if (pLink == NULL) {
+		return DISPATCH_OK;
+	}
+
+	pLink->connected = true;
+	pLink->connectedUptime = k_uptime_get();
+	k_timer_stop(&pLink->timer);
+	/* Another connection can be created while this one is configured. */
+	pObj->creatingConnection = false;
+	bt_scan_restart(pObj->scanUserId);
+	if (ExchangeMtu(pLink) == BT_SUCCESS) {
+		StartDiscovery(pLink);
 	} else {
-		RequestDisconnect(pObj, "Exchange MTU Failed");
+		RequestDisconnect(pLink, "Exchange MTU Failed");
 	}
 	return DISPATCH_OK;
 }
@@ -355,13 +516,33 @@ static DispatchResult_t StartDiscoveryMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 static DispatchResult_t DiscoveryMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 					    FwkMsg_t *pMsg)
 {
-	SensorTaskObj_t *pObj = FWK_TASK_CONTAINER(SensorTaskObj_t);
+	SensorLink_t *pLink = GetLink(pMsg);
+	if (pLink == NULL) {
+		return DISPATCH_OK;
+	}
+
 	if (pMsg->header.msgCode == FMC_DISCOVERY_COMPLETE) {
-		k_timer_start(&pObj->msgTask.timer, ENCRYPTION_TIMEOUT_TICKS,
+		pLink->discoveredUptime = k_uptime_get();
+		if (!pLink->cachedHandles) {
+			SensorGattHandles_t handles = {
+				.write = pLink->writeHandle,
+				.value = pLink->sp.value_handle,
+				.ccc = pLink->sp.ccc_handle
+			};
+			SensorGattCache_Add(&pLink->pCmdMsg->addr,
+					    pLink->pCmdMsg->firmwareVersion,
+					    &handles);
+		}
+		k_timer_start(&pLink->timer, ENCRYPTION_TIMEOUT_TICKS,
 			      K_NO_WAIT);
-		EncryptLink(pObj);
+		EncryptLink(pLink);
+	} else if (pLink->cachedHandles) {
+		LOG_WRN("Cached handles rejected; starting discovery");
+		SensorGattCache_Remove(&pLink->pCmdMsg->addr);
+		pLink->cachedHandles = false;
+		StartDiscovery(pLink);
 	} else {
-		RequestDisconnect(pObj, "Discovery Failure");
+		RequestDisconnect(pLink, "Discovery Failure");
 	}
 	return DISPATCH_OK;
 }
@@ -370,14 +551,23 @@ static DispatchResult_t DiscoveryMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 static DispatchResult_t PeriodicTimerMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 						FwkMsg_t *pMsg)
 {
-	UNUSED_PARAMETER(pMsg);
-	SensorTaskObj_t *pObj = FWK_TASK_CONTAINER(SensorTaskObj_t);
-	if (pObj->paired && pObj->connected) {
-		WriteString(pObj->pCmdMsg->cmd);
-	} else if (!pObj->connected) {
-		RequestDisconnect(pObj, "Connection failed to be established");
-	} else if (!pObj->paired) {
-		RequestDisconnect(pObj, "Encryption failure");
+	SensorLink_t *pLink = GetLink(pMsg);
+	if (pLink == NULL) {
+		return DISPATCH_OK;
+	}
+
+	if (pLink->paired && pLink->connected) {
+		/* The write can be triggered by a security change or
+		 * the encryption timer.
+		 */
+		if (pLink->writeUptime == 0) {
+			pLink->writeUptime = k_uptime_get();
+			WriteString(pLink, pLink->pCmdMsg->cmd, false);
+		}
+	} else if (!pLink->connected) {
+		RequestDisconnect(pLink, "Connection failed to be established");
+	} else if (!pLink->paired) {
+		RequestDisconnect(pLink, "Encryption failure");
 	}
 	return DISPATCH_OK;
 }
@@ -385,42 +575,61 @@ static DispatchResult_t PeriodicTimerMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 static DispatchResult_t ResponseHandler(FwkMsgReceiver_t *pMsgRxer,
 					FwkMsg_t *pMsg)
 {
-	SensorTaskObj_t *pObj = FWK_TASK_CONTAINER(SensorTaskObj_t);
-	FwkBufMsg_t *pRsp = (FwkBufMsg_t *)pMsg;
+	SensorLinkMsg_t *pRsp = (SensorLinkMsg_t *)pMsg;
+	SensorLink_t *pLink = GetLink(pMsg);
+	if (pLink == NULL) {
+		return DISPATCH_OK;
+	}
+
 	bool ok = (strstr(pRsp->buffer, SENSOR_CMD_ACCEPTED_SUB_STR) != NULL);
 	if (ok) {
-		if (pObj->pCmdMsg->setEpochRequest) {
-			pObj->pCmdMsg->setEpochRequest = false;
-			SendSetEpochCommand();
-		} else if (pObj->pCmdMsg->resetRequest) {
-			pObj->pCmdMsg->resetRequest = false;
+		if (pLink->pCmdMsg->setEpochRequest) {
+			pLink->pCmdMsg->setEpochRequest = false;
+			SendSetEpochCommand(pLink);
+		} else if (pLink->pCmdMsg->resetRequest) {
+			pLink->pCmdMsg->resetRequest = false;
 			/* Don't block this task because it also processes adverts */
-			k_timer_start(&pObj->resetTimer,
+			k_timer_start(&pLink->resetTimer,
 				      BT510_WRITE_TO_RESET_DELAY_TICKS,
 				      K_NO_WAIT);
+		} else if (pLink->readback) {
+			pLink->pCmdMsg->readbackComplete = true;
+			RequestDisconnect(pLink, "Config Cycle Complete");
+			SensorTable_CreateShadowFromDumpResponse(
+				pRsp->buffer, pRsp->length,
+				pLink->pCmdMsg->addrString);
+		} else if (CONFIG_SENSOR_CONFIG_READBACK &&
+			   !pLink->pCmdMsg->dumpRequest && !pLink->resetSent) {
+			/* Read the state without connecting again.  A failure
+			 * now doesn't require the config to be written again.
+			 */
+			pLink->configComplete = true;
+			pLink->readback = true;
+			WriteString(pLink, SensorTable_GetQueryCmd(), false);
 		} else {
-			pObj->configComplete = true;
-			if (pObj->pCmdMsg->dumpRequest) {
-				RequestDisconnect(pObj,
+			pLink->configComplete = true;
+			if (pLink->pCmdMsg->dumpRequest) {
+				RequestDisconnect(pLink,
 						  "Config Cycle Complete");
 				SensorTable_CreateShadowFromDumpResponse(
-					pRsp, pObj->pCmdMsg->addrString);
+					pRsp->buffer, pRsp->length,
+					pLink->pCmdMsg->addrString);
 			} else {
 				/* When the first part is complete the sensor table
 				 * is acked.  It will then generate a dump request to read
 				 * all of the sensor configuration.
 				 */
-				RequestDisconnect(pObj,
+				RequestDisconnect(pLink,
 						  "Config Part 1 Complete");
 			}
 		}
 	} else {
-		RequestDisconnect(pObj, "Invalid JSON response");
+		RequestDisconnect(pLink, "Invalid JSON response");
 	}
 	return DISPATCH_OK;
 }
 
-static void SendSetEpochCommand(void)
+static void SendSetEpochCommand(SensorLink_t *pLink)
 {
 	size_t maxSize = strlen(SENSOR_CMD_SET_EPOCH_FMT_STR) +
 			 SENSOR_CMD_MAX_EPOCH_SIZE + 1;
@@ -428,7 +637,7 @@ static void SendSetEpochCommand(void)
 	if (buf != NULL) {
 		uint32_t epoch = Qrtc_GetEpoch();
 		snprintk(buf, maxSize, SENSOR_CMD_SET_EPOCH_FMT_STR, epoch);
-		WriteString(buf);
+		WriteString(pLink, buf, true);
 		LOG_DBG("%u", epoch);
 	}
 }
@@ -436,11 +645,32 @@ static void SendSetEpochCommand(void)
 static DispatchResult_t SendResetHandler(FwkMsgReceiver_t *pMsgRxer,
 					 FwkMsg_t *pMsg)
 {
-	UNUSED_PARAMETER(pMsg);
-	SensorTaskObj_t *pObj = FWK_TASK_CONTAINER(SensorTaskObj_t);
-	if (pObj->connected) {
-		WriteString(SENSOR_CMD_REBOOT);
-		pObj->resetSent = true;
+	SensorLink_t *pLink = GetLink(pMsg);
+	if (pLink != NULL && pLink->connected) {
+		WriteString(pLink, SENSOR_CMD_REBOOT, false);
+		pLink->resetSent = true;
+	}
+	return DISPATCH_OK;
+}
+
+static DispatchResult_t WriteCompleteMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+						FwkMsg_t *pMsg)
+{
+	SensorLink_t *pLink = GetLink(pMsg);
+	if (pLink == NULL || !pLink->connected) {
+		return DISPATCH_OK;
+	}
+
+	if (pLink->txPending > 0) {
+		pLink->txPending -= 1;
+	}
+	if (pLink->txIndex < pLink->txLength) {
+		WriteWindow(pLink);
+	} else if (pLink->txPending == 0 && pLink->txLength > 0) {
+		LOG_DBG("Wrote %u bytes in %u ms", pLink->txLength,
+			(uint32_t)(k_uptime_get() - pLink->txStartUptime));
+		pLink->txLength = 0;
+		pLink->txIndex = 0;
 	}
 	return DISPATCH_OK;
 }
@@ -451,9 +681,9 @@ static DispatchResult_t AwsConnectionMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 	SensorTaskObj_t *pObj = FWK_TASK_CONTAINER(SensorTaskObj_t);
 	if (pMsg->header.msgCode == FMC_AWS_CONNECTED) {
 		pObj->awsReady = true;
-		StartSensorTick(pObj);
 	} else {
 		pObj->awsReady = false;
+		StopSensorTick(pObj);
 		SensorTable_DisableGatewayShadowGeneration();
 		SensorTable_UnsubscribeAll();
 	}
@@ -469,10 +699,35 @@ static DispatchResult_t AwsDecommissionMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 	return DISPATCH_OK;
 }
 
-static void StartSensorTick(SensorTaskObj_t *pObj)
+/* The sensor table work is scheduled by deadline.  The task only wakes
+ * when the next deadline expires.  The timer is only restarted when
+ * the next deadline changes.
+ */
+static void UpdateSensorTick(SensorTaskObj_t *pObj)
+{
+	if (!pObj->awsReady) {
+		return;
+	}
+
+	int64_t next = SensorTable_NextDeadline();
+	if (next == pObj->tickDeadline) {
+		return;
+	}
+
+	pObj->tickDeadline = next;
+	if (next == SENSOR_DEADLINE_NONE) {
+		k_timer_stop(&pObj->sensorTick);
+	} else {
+		int64_t delay = next - k_uptime_get();
+		k_timer_start(&pObj->sensorTick, K_MSEC(MAX(delay, 0)),
+			      K_NO_WAIT);
+	}
+}
+
+static void StopSensorTick(SensorTaskObj_t *pObj)
 {
-	k_timer_start(&pObj->sensorTick, K_SECONDS(SENSOR_TICK_RATE_SECONDS),
-		      K_NO_WAIT);
+	k_timer_stop(&pObj->sensorTick);
+	pObj->tickDeadline = SENSOR_DEADLINE_NONE;
 }
 
 static DispatchResult_t SubscriptionAckMsgHandler(FwkMsgReceiver_t *pMsgRxer,
@@ -495,30 +750,51 @@ static DispatchResult_t ConnectRequestMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 {
 	int err;
 	SensorTaskObj_t *pObj = FWK_TASK_CONTAINER(SensorTaskObj_t);
+	SensorLink_t *pLink = FindFreeLink();
 
-	if (pObj->pCmdMsg == NULL && pObj->conn == NULL) { /* not busy */
+	if (pLink != NULL && !pObj->creatingConnection) { /* not busy */
+		if (LinksIdle()) {
+			memset(&pObj->rollout, 0, sizeof(SensorRollout_t));
+			pObj->rollout.startUptime = k_uptime_get();
+		}
 		bt_scan_stop(pObj->scanUserId);
-		Bracket_Reset(pObj->pBracket);
-		pObj->pCmdMsg = (SensorCmdMsg_t *)pMsg;
-		pObj->connected = false;
-		pObj->paired = false;
-		pObj->resetSent = false;
-		pObj->configComplete = false;
-		err = bt_conn_le_create(&pObj->pCmdMsg->addr,
-					pObj->pCmdMsg->useCodedPhy ?
+		FreeResponse(pLink);
+		pLink->pCmdMsg = (SensorCmdMsg_t *)pMsg;
+		pLink->connected = false;
+		pLink->paired = false;
+		pLink->resetSent = false;
+		pLink->configComplete = false;
+		pLink->readback = false;
+		pLink->pCmdMsg->readbackComplete = false;
+		pLink->cachedHandles = false;
+		pLink->passkeyEntered = false;
+		pLink->unpair = false;
+		pLink->startUptime = k_uptime_get();
+		pLink->connectedUptime = 0;
+		pLink->discoveredUptime = 0;
+		pLink->writeUptime = 0;
+		pLink->pTx = NULL;
+		pLink->txFree = false;
+		pLink->txLength = 0;
+		pLink->txIndex = 0;
+		pLink->txPending = 0;
+		err = bt_conn_le_create(&pLink->pCmdMsg->addr,
+					pLink->pCmdMsg->useCodedPhy ?
 						BT_CONN_CODED_CREATE_CONN :
 						BT_CONN_LE_CREATE_CONN,
-					BT_LE_CONN_PARAM_DEFAULT, &pObj->conn);
+					BT_LE_CONN_PARAM_DEFAULT, &pLink->conn);
 
 		LOG_INF("Connection Request (%u): '%s' (%s) %x-%u",
-			pObj->pCmdMsg->attempts,
-			log_strdup(pObj->pCmdMsg->name),
-			log_strdup(pObj->pCmdMsg->addrString),
-			(uint32_t)POINTER_TO_UINT(pObj->conn),
-			bt_conn_index(pObj->conn));
+			pLink->pCmdMsg->attempts,
+			log_strdup(pLink->pCmdMsg->name),
+			log_strdup(pLink->pCmdMsg->addrString),
+			(uint32_t)POINTER_TO_UINT(pLink->conn),
+			bt_conn_index(pLink->conn));
 
 		if (err) {
-			return RetryConfigRequest(pObj);
+			pLink->conn = NULL;
+			bt_scan_restart(pObj->scanUserId);
+			return RetryConfigRequest(pLink);
 		} else {
 			/* If a connection is requested on the last ad from the sensor,
 			 * then the state machine will get stuck waiting ~15 minutes
@@ -527,12 +803,16 @@ static DispatchResult_t ConnectRequestMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 			 * (state == BT_CONN_CONNECT_SCAN)
 			 * Bug 16483: Zephyr 2.x - Retest connection timeout fix (stack)
 			 */
-			k_timer_start(&pObj->msgTask.timer,
-				      CONNECTION_TIMEOUT_TICKS, K_NO_WAIT);
+			pObj->creatingConnection = true;
+			k_timer_start(&pLink->timer, CONNECTION_TIMEOUT_TICKS,
+				      K_NO_WAIT);
 			return DISPATCH_DO_NOT_FREE;
 		}
 	} else {
-		return RetryConfigRequest(pObj);
+		/* The sensor table will try again on the next advertisement. */
+		SensorCmdMsg_t *pCmdMsg = (SensorCmdMsg_t *)pMsg;
+		FRAMEWORK_ASSERT(pCmdMsg != NULL);
+		return SensorTable_RetryConfigRequest(pCmdMsg);
 	}
 }
 
@@ -540,21 +820,50 @@ static DispatchResult_t DisconnectMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 					     FwkMsg_t *pMsg)
 {
 	SensorTaskObj_t *pObj = FWK_TASK_CONTAINER(SensorTaskObj_t);
-	k_timer_stop(&pObj->msgTask.timer);
-	pObj->connected = false;
-	char *name = log_strdup(pObj->pCmdMsg->name);
-	if (pObj->configComplete) {
+	SensorLink_t *pLink = GetLink(pMsg);
+	if (pLink == NULL || pLink->conn == NULL) {
+		return DISPATCH_OK;
+	}
+
+	k_timer_stop(&pLink->timer);
+	k_timer_stop(&pLink->resetTimer);
+	if (!pLink->connected) {
+		pObj->creatingConnection = false;
+	}
+	pLink->connected = false;
+	LinkTimingHandler(pObj, pLink);
+	char *name = log_strdup(pLink->pCmdMsg->name);
+	if (pLink->configComplete) {
 		LOG_INF("'%s' configured", name);
-		AckConfigRequest(pObj);
+		if (pLink->pCmdMsg->readbackComplete) {
+			pObj->rollout.readbacks += 1;
+		}
+		AckConfigRequest(pLink);
+		pObj->rollout.configured += 1;
 	} else {
 		LOG_ERR("'%s' NOT configured", name);
-		(void)RetryConfigRequest(pObj);
+		/* The handles may be stale (they are discovered next time). */
+		if (pLink->cachedHandles) {
+			SensorGattCache_Remove(&pLink->pCmdMsg->addr);
+		}
+		/* The sensor has lost its keys; pair on the next attempt. */
+		if (pLink->unpair) {
+			LOG_WRN("Removing bond for '%s'", name);
+			(void)bt_unpair(BT_ID_DEFAULT, &pLink->pCmdMsg->addr);
+		}
+		(void)RetryConfigRequest(pLink);
 		pObj->configDisconnects += 1;
+		pObj->rollout.failed += 1;
 	}
 
-	bt_conn_unref(pObj->conn);
-	pObj->conn = NULL;
-	bt_scan_restart(pObj->scanUserId);
+	bt_conn_unref(pLink->conn);
+	pLink->conn = NULL;
+	FreeResponse(pLink);
+	FreeTxString(pLink);
+	if (!pObj->creatingConnection) {
+		bt_scan_restart(pObj->scanUserId);
+	}
+	RolloutHandler(pObj, pLink);
 
 	return DISPATCH_OK;
 }
@@ -567,6 +876,40 @@ static DispatchResult_t SensorShadowInitMsgHandler(FwkMsgReceiver_t *pMsgRxer,
 	return DISPATCH_OK;
 }
 
+static DispatchResult_t SensorLeaseMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+					      FwkMsg_t *pMsg)
+{
+	UNUSED_PARAMETER(pMsgRxer);
+	SensorTable_ProcessLeaseMsg((SensorLeaseMsg_t *)pMsg);
+	return DISPATCH_OK;
+}
+
+static DispatchResult_t PublishAckMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+					     FwkMsg_t *pMsg)
+{
+	UNUSED_PARAMETER(pMsgRxer);
+	SensorTable_PublishAckHandler((SensorPublishAckMsg_t *)pMsg);
+	return DISPATCH_OK;
+}
+
+static DispatchResult_t PublishDroppedMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+						 FwkMsg_t *pMsg)
+{
+	UNUSED_PARAMETER(pMsgRxer);
+	UNUSED_PARAMETER(pMsg);
+	SensorTable_PublishDroppedHandler();
+	return DISPATCH_OK;
+}
+
+static DispatchResult_t EventLogRequestMsgHandler(FwkMsgReceiver_t *pMsgRxer,
+						  FwkMsg_t *pMsg)
+{
+	UNUSED_PARAMETER(pMsgRxer);
+	UNUSED_PARAMETER(pMsg);
+	SensorTable_RequestFullEventLog();
+	return DISPATCH_OK;
+}
+
 static void RegisterConnectionCallbacks(void)
 {
 	static struct bt_conn_cb connectionCallbacks = {
@@ -597,32 +940,29 @@ static int RegisterSecurityCallbacks(void)
 	return status;
 }
 
-static int Discover(void)
+static int Discover(SensorLink_t *pLink)
 {
-	int err = bt_gatt_discover(st.conn, &st.dp);
+	int err = bt_gatt_discover(pLink->conn, &pLink->dp);
 	if (err) {
 		LOG_ERR("Discovery Failed %s", lbt_get_hci_err_string(err));
-		FRAMEWORK_MSG_SEND_TO_SELF(FWK_ID_SENSOR_TASK,
-					   FMC_DISCOVERY_FAILED);
+		SendLinkMsg(pLink, FMC_DISCOVERY_FAILED);
 	}
 	return err;
 }
 
-static int Subscribe(void)
+static int Subscribe(SensorLink_t *pLink)
 {
-	int err = bt_gatt_subscribe(st.conn, &st.sp);
+	int err = bt_gatt_subscribe(pLink->conn, &pLink->sp);
 	if (err && err != -EALREADY) {
 		LOG_ERR("Subscribe Failed %s", lbt_get_hci_err_string(err));
-		FRAMEWORK_MSG_SEND_TO_SELF(FWK_ID_SENSOR_TASK,
-					   FMC_DISCOVERY_FAILED);
+		SendLinkMsg(pLink, FMC_DISCOVERY_FAILED);
 	} else {
-		FRAMEWORK_MSG_SEND_TO_SELF(FWK_ID_SENSOR_TASK,
-					   FMC_DISCOVERY_COMPLETE);
+		SendLinkMsg(pLink, FMC_DISCOVERY_COMPLETE);
 	}
 	return err;
 }
 
-static int WriteString(const char *str)
+static int WriteString(SensorLink_t *pLink, const char *str, bool FreeStr)
 {
 #ifdef CONFIG_VSP_TX_ECHO
 	size_t len = strlen(str);
@@ -634,47 +974,103 @@ static int WriteString(const char *str)
 	printk("\r\n");
 #endif
 
-	size_t remaining = strlen(str);
-	size_t index = 0;
-	int status = 0;
-	ST_LOG_DEV("length: %u", remaining);
-	/* Chunk data to the size that the link supports.
-	 * Zephyr handles flow control
-	 */
-	while ((remaining > 0) && (status == BT_SUCCESS)) {
-		size_t chunk = MIN(st.mtu, remaining);
-		remaining -= chunk;
-		status = bt_gatt_write_without_response(
-			st.conn, st.writeHandle, &str[index], chunk, false);
-		index += chunk;
-	}
-	ST_LOG_DEV("rem: %u status: %d", remaining, status);
+	FreeTxString(pLink);
+	pLink->pTx = str;
+	pLink->txFree = FreeStr;
+	pLink->txLength = strlen(str);
+	pLink->txIndex = 0;
+	pLink->txStartUptime = k_uptime_get();
+	ST_LOG_DEV("length: %u", pLink->txLength);
+	return WriteWindow(pLink);
+}
+
+/* Chunk data to the size that the link supports.  Several writes are
+ * queued so that the controller can send them in the same connection
+ * event.  More are queued as the stack reports that they were sent.
+ */
+static int WriteWindow(SensorLink_t *pLink)
+{
+	int status = BT_SUCCESS;
+	while ((pLink->txIndex < pLink->txLength) &&
+	       (pLink->txPending < CONFIG_SENSOR_WRITE_WINDOW)) {
+		size_t chunk =
+			MIN(pLink->mtu, pLink->txLength - pLink->txIndex);
+		status = bt_gatt_write_without_response_cb(
+			pLink->conn, pLink->writeHandle,
+			&pLink->pTx[pLink->txIndex], chunk, false,
+			WriteCompleteCallback, pLink);
+		if (status != BT_SUCCESS) {
+			break;
+		}
+		pLink->txPending += 1;
+		pLink->txIndex += chunk;
+	}
+	ST_LOG_DEV("index: %u pending: %u status: %d", pLink->txIndex,
+		   pLink->txPending, status);
+
+	/* The stack has a copy of the data once it is queued. */
+	if (pLink->txIndex >= pLink->txLength) {
+		FreeTxString(pLink);
+	}
+
+	/* Out of buffers is retried when a queued write completes. */
+	if (status != BT_SUCCESS &&
+	    !(status == -ENOMEM && pLink->txPending > 0)) {
+		LOG_ERR("Write failed (%d)", status);
+		FreeTxString(pLink);
+		pLink->txLength = 0;
+		pLink->txIndex = 0;
+		RequestDisconnect(pLink, "Write failure");
+	}
 	return status;
 }
 
-static int StartDiscovery(void)
+static void FreeTxString(SensorLink_t *pLink)
 {
+	if (pLink->txFree && pLink->pTx != NULL) {
+		BufferPool_Free((void *)pLink->pTx);
+	}
+	pLink->pTx = NULL;
+	pLink->txFree = false;
+}
+
+static int StartDiscovery(SensorLink_t *pLink)
+{
+	/* The handles don't change unless the firmware is updated. */
+	SensorGattHandles_t handles;
+	if (!pLink->cachedHandles &&
+	    SensorGattCache_Find(&pLink->pCmdMsg->addr,
+				 pLink->pCmdMsg->firmwareVersion, &handles)) {
+		pLink->cachedHandles = true;
+		pLink->writeHandle = handles.write;
+		pLink->sp.notify = NotificationCallback;
+		pLink->sp.value = BT_GATT_CCC_NOTIFY;
+		pLink->sp.value_handle = handles.value;
+		pLink->sp.ccc_handle = handles.ccc;
+		return Subscribe(pLink);
+	}
+
 	/* There isn't any reason to discover the VSP service.
 	 * The callback doesn't give a range of handles for service discovery.
 	 */
-	st.dp.uuid = (struct bt_uuid *)&VSP_RX_UUID;
-	st.dp.func = DiscoveryCallback;
-	st.dp.start_handle = FIRST_VALID_HANDLE;
-	st.dp.end_handle = LAST_VALID_HANDLE;
-	st.dp.type = BT_GATT_DISCOVER_CHARACTERISTIC;
-	return Discover();
+	pLink->dp.uuid = (struct bt_uuid *)&VSP_RX_UUID;
+	pLink->dp.func = DiscoveryCallback;
+	pLink->dp.start_handle = FIRST_VALID_HANDLE;
+	pLink->dp.end_handle = LAST_VALID_HANDLE;
+	pLink->dp.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+	return Discover(pLink);
 }
 
-static int ExchangeMtu(void)
+static int ExchangeMtu(SensorLink_t *pLink)
 {
-	st.mp.func = MtuCallback;
-	int status = bt_gatt_exchange_mtu(st.conn, &st.mp);
+	pLink->mp.func = MtuCallback;
+	int status = bt_gatt_exchange_mtu(pLink->conn, &pLink->mp);
 	return status;
 }
 
-static int RequestDisconnect(SensorTaskObj_t *pObj, const char *str)
+static int RequestDisconnect(SensorLink_t *pLink, const char *str)
 {
-	int status = bt_conn_disconnect(pObj->conn,
+	int status = bt_conn_disconnect(pLink->conn,
 					BT_HCI_ERR_REMOTE_USER_TERM_CONN);
 	LOG_INF("Disconnect Request: %d Reason: %s", status, str);
 	return status;
@@ -683,19 +1079,139 @@ static int RequestDisconnect(SensorTaskObj_t *pObj, const char *str)
 /* Put the request back in to the table (because something failed during
  * attempt to write configuration.
  */
-static DispatchResult_t RetryConfigRequest(SensorTaskObj_t *pObj)
+static DispatchResult_t RetryConfigRequest(SensorLink_t *pLink)
 {
-	FRAMEWORK_ASSERT(pObj->pCmdMsg != NULL);
-	DispatchResult_t result = SensorTable_RetryConfigRequest(pObj->pCmdMsg);
-	pObj->pCmdMsg = NULL;
+	FRAMEWORK_ASSERT(pLink->pCmdMsg != NULL);
+	DispatchResult_t result =
+		SensorTable_RetryConfigRequest(pLink->pCmdMsg);
+	pLink->pCmdMsg = NULL;
 	return result;
 }
 
-static void AckConfigRequest(SensorTaskObj_t *pObj)
+static void AckConfigRequest(SensorLink_t *pLink)
+{
+	FRAMEWORK_ASSERT(pLink->pCmdMsg != NULL);
+	SensorTable_AckConfigRequest(pLink->pCmdMsg);
+	pLink->pCmdMsg = NULL;
+}
+
+static void SendLinkMsg(SensorLink_t *pLink, FwkMsgCode_t Code)
+{
+	SensorLinkMsg_t *pMsg = BufferPool_Take(sizeof(SensorLinkMsg_t));
+	if (pMsg != NULL) {
+		pMsg->header.msgCode = Code;
+		pMsg->header.txId = FWK_ID_SENSOR_TASK;
+		pMsg->header.rxId = FWK_ID_SENSOR_TASK;
+		pMsg->link = pLink - st.links;
+		FRAMEWORK_MSG_SEND(pMsg);
+	}
+}
+
+static SensorLink_t *GetLink(FwkMsg_t *pMsg)
+{
+	SensorLinkMsg_t *pLinkMsg = (SensorLinkMsg_t *)pMsg;
+	if (pLinkMsg->link >= CONFIG_SENSOR_CONFIG_CONNECTIONS) {
+		return NULL;
+	}
+	SensorLink_t *pLink = &st.links[pLinkMsg->link];
+	return (pLink->pCmdMsg != NULL) ? pLink : NULL;
+}
+
+static SensorLink_t *FindLink(struct bt_conn *conn)
+{
+	size_t i;
+	for (i = 0; i < CONFIG_SENSOR_CONFIG_CONNECTIONS; i++) {
+		if (conn != NULL && conn == st.links[i].conn) {
+			return &st.links[i];
+		}
+	}
+	return NULL;
+}
+
+static SensorLink_t *FindFreeLink(void)
+{
+	size_t i;
+	for (i = 0; i < CONFIG_SENSOR_CONFIG_CONNECTIONS; i++) {
+		if (st.links[i].pCmdMsg == NULL && st.links[i].conn == NULL) {
+			return &st.links[i];
+		}
+	}
+	return NULL;
+}
+
+static bool LinksIdle(void)
+{
+	size_t i;
+	for (i = 0; i < CONFIG_SENSOR_CONFIG_CONNECTIONS; i++) {
+		if (st.links[i].conn != NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void RolloutHandler(SensorTaskObj_t *pObj, SensorLink_t *pLink)
+{
+	SensorRollout_t *p = &pObj->rollout;
+	p->busyMs += (uint32_t)(k_uptime_get() - pLink->startUptime);
+	if (!LinksIdle()) {
+		return;
+	}
+
+	uint32_t ms = (uint32_t)(k_uptime_get() - p->startUptime);
+	LOG_INF("Rollout: %u configured (%u read back) %u failed in %u ms "
+		"(%u links, %u%% utilization)",
+		p->configured, p->readbacks, p->failed, ms,
+		CONFIG_SENSOR_CONFIG_CONNECTIONS,
+		(ms == 0) ? 0 :
+			    (uint32_t)((100ULL * p->busyMs) /
+				       (ms * CONFIG_SENSOR_CONFIG_CONNECTIONS)));
+	LOG_INF("Rollout: %u discoveries (%u cached) %u ms average",
+		p->discoveries, p->cacheHits,
+		(p->discoveries == 0) ? 0 : (p->discoveryMs / p->discoveries));
+	LOG_INF("Rollout: %u first writes (%u bonded) %u ms average after "
+		"connection",
+		p->writes, p->bonded,
+		(p->writes == 0) ? 0 : (p->firstWriteMs / p->writes));
+}
+
+/* Connection phases: create connection, MTU exchange and discovery (or
+ * subscribe when handles are cached), encryption (pairing unless the sensor
+ * is bonded), then JSON-RPC.
+ */
+static void LinkTimingHandler(SensorTaskObj_t *pObj, SensorLink_t *pLink)
 {
-	FRAMEWORK_ASSERT(pObj->pCmdMsg != NULL);
-	SensorTable_AckConfigRequest(pObj->pCmdMsg);
-	pObj->pCmdMsg = NULL;
+	if (pLink->discoveredUptime == 0) {
+		return;
+	}
+
+	uint32_t connectMs =
+		(uint32_t)(pLink->connectedUptime - pLink->startUptime);
+	uint32_t discoveryMs =
+		(uint32_t)(pLink->discoveredUptime - pLink->connectedUptime);
+	int64_t secured = (pLink->writeUptime == 0) ? k_uptime_get() :
+						       pLink->writeUptime;
+	uint32_t securityMs = (uint32_t)(secured - pLink->discoveredUptime);
+	uint32_t configMs = (uint32_t)(k_uptime_get() - secured);
+	LOG_INF("Timing '%s': connect %u discovery %u (%s) security %u (%s) "
+		"config %u ms",
+		log_strdup(pLink->pCmdMsg->name), connectMs, discoveryMs,
+		pLink->cachedHandles ? "cached" : "full", securityMs,
+		pLink->passkeyEntered ? "paired" : "bonded", configMs);
+
+	pObj->rollout.discoveries += 1;
+	pObj->rollout.discoveryMs += discoveryMs;
+	if (pLink->cachedHandles) {
+		pObj->rollout.cacheHits += 1;
+	}
+	if (pLink->writeUptime != 0) {
+		pObj->rollout.writes += 1;
+		pObj->rollout.firstWriteMs +=
+			(uint32_t)(pLink->writeUptime - pLink->connectedUptime);
+		if (!pLink->passkeyEntered) {
+			pObj->rollout.bonded += 1;
+		}
+	}
 }
 
 /******************************************************************************/
@@ -713,14 +1229,9 @@ static void ConnectedCallback(struct bt_conn *conn, uint8_t err)
 	 * result in the conn_le_update_timeout firing and an error code of
 	 * UNKNOWN_CONN_ID.
 	 */
-	if (conn == st.conn) {
-		if (err) {
-			FRAMEWORK_MSG_SEND_TO_SELF(FWK_ID_SENSOR_TASK,
-						   FMC_DISCONNECT);
-		} else {
-			FRAMEWORK_MSG_SEND_TO_SELF(FWK_ID_SENSOR_TASK,
-						   FMC_START_DISCOVERY);
-		}
+	SensorLink_t *pLink = FindLink(conn);
+	if (pLink != NULL) {
+		SendLinkMsg(pLink, err ? FMC_DISCONNECT : FMC_START_DISCOVERY);
 	}
 }
 
@@ -728,23 +1239,23 @@ static void DisconnectedCallback(struct bt_conn *conn, uint8_t reason)
 {
 	LOG_DBG("%x-%u %s", (uint32_t)POINTER_TO_UINT(conn),
 		bt_conn_index(conn), lbt_get_hci_err_string(reason));
-	if (conn == st.conn) {
-		FRAMEWORK_MSG_SEND_TO_SELF(FWK_ID_SENSOR_TASK, FMC_DISCONNECT);
+	SensorLink_t *pLink = FindLink(conn);
+	if (pLink != NULL) {
+		SendLinkMsg(pLink, FMC_DISCONNECT);
 	}
 }
 
-static int EncryptLink(SensorTaskObj_t *pObj)
+static int EncryptLink(SensorLink_t *pLink)
 {
-	int status = bt_conn_set_security(pObj->conn, BT_SECURITY_L3);
+	int status = bt_conn_set_security(pLink->conn, BT_SECURITY_L3);
 	LOG_DBG("%d", status);
 	return status;
 }
 
 static void PasskeyDisplayCallback(struct bt_conn *conn, unsigned int passkey)
 {
+	ARG_UNUSED(conn);
 	LOG_DBG("%d", passkey);
-	if (conn == st.conn) {
-	}
 }
 
 static void PasskeyEntryCallback(struct bt_conn *conn)
@@ -752,7 +1263,9 @@ static void PasskeyEntryCallback(struct bt_conn *conn)
 	/* Bug 16696 - Sensor connection only supports default pin */
 	LOG_DBG(".");
 	const unsigned int PIN = SENSOR_PIN_DEFAULT;
-	if (conn == st.conn) {
+	SensorLink_t *pLink = FindLink(conn);
+	if (pLink != NULL) {
+		pLink->passkeyEntered = true;
 		__ASSERT_EVAL((void)bt_conn_auth_passkey_entry(conn, PIN),
 			      int result =
 				      bt_conn_auth_passkey_entry(conn, PIN),
@@ -763,30 +1276,41 @@ static void PasskeyEntryCallback(struct bt_conn *conn)
 static void PasskeyConfirmCallback(struct bt_conn *conn, unsigned int passkey)
 {
 	LOG_DBG(".");
-	if (conn == st.conn) {
+	if (FindLink(conn) != NULL) {
 		(void)bt_conn_auth_passkey_confirm(conn);
 	}
 }
 
 static void SecurityCancelCallback(struct bt_conn *conn)
 {
+	ARG_UNUSED(conn);
 	LOG_DBG(".");
-	if (conn == st.conn) {
-	}
 }
 
 static void SecurityChangedCallback(struct bt_conn *conn, bt_security_t level,
 				    enum bt_security_err err)
 {
 	LOG_DBG("%u", level);
-	if (conn == st.conn) {
+	SensorLink_t *pLink = FindLink(conn);
+	if (pLink == NULL) {
+		return;
+	}
+
+	/* A bonded sensor is encrypted without pairing.  The command is
+	 * written as soon as the link is secure.
+	 */
+	if (err == BT_SECURITY_ERR_SUCCESS && level >= BT_SECURITY_L3) {
+		pLink->paired = true;
+		SendLinkMsg(pLink, FMC_PERIODIC);
+	} else if (err == BT_SECURITY_ERR_PIN_OR_KEY_MISSING) {
+		pLink->unpair = true;
 	}
 }
 
 static void PairingConfirmCallback(struct bt_conn *conn)
 {
 	LOG_DBG(".");
-	if (conn == st.conn) {
+	if (FindLink(conn) != NULL) {
 		(void)bt_conn_auth_pairing_confirm(conn);
 	}
 }
@@ -794,8 +1318,9 @@ static void PairingConfirmCallback(struct bt_conn *conn)
 static void PairingCompleteCallback(struct bt_conn *conn, bool bonded)
 {
 	LOG_DBG("%s bonded", bonded ? "" : "NOT");
-	if (conn == st.conn) {
-		st.paired = true;
+	SensorLink_t *pLink = FindLink(conn);
+	if (pLink != NULL) {
+		pLink->paired = true;
 	}
 }
 
@@ -803,8 +1328,9 @@ static void PairingFailedCallback(struct bt_conn *conn,
 				  enum bt_security_err reason)
 {
 	LOG_DBG(".");
-	if (conn == st.conn) {
-		st.paired = false;
+	SensorLink_t *pLink = FindLink(conn);
+	if (pLink != NULL) {
+		pLink->paired = false;
 	}
 }
 
@@ -812,7 +1338,8 @@ static uint8_t DiscoveryCallback(struct bt_conn *conn,
 				 const struct bt_gatt_attr *attr,
 				 struct bt_gatt_discover_params *params)
 {
-	if (conn != st.conn) {
+	SensorLink_t *pLink = CONTAINER_OF(params, SensorLink_t, dp);
+	if (conn != pLink->conn) {
 		return BT_GATT_ITER_STOP;
 	}
 
@@ -824,24 +1351,25 @@ static uint8_t DiscoveryCallback(struct bt_conn *conn,
 
 	/* The discovery callback is used as a state machine */
 	if (bt_uuid_cmp(params->uuid, &VSP_RX_UUID.uuid) == 0) {
-		st.writeHandle = bt_gatt_attr_value_handle(attr);
-		st.dp.uuid = (struct bt_uuid *)&VSP_TX_UUID;
-		st.dp.type = BT_GATT_DISCOVER_CHARACTERISTIC;
-		Discover();
+		pLink->writeHandle = bt_gatt_attr_value_handle(attr);
+		pLink->dp.uuid = (struct bt_uuid *)&VSP_TX_UUID;
+		pLink->dp.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+		Discover(pLink);
 	} else if (bt_uuid_cmp(params->uuid, &VSP_TX_UUID.uuid) == 0) {
-		st.dp.uuid = (struct bt_uuid *)&VSP_TX_CCC_UUID;
-		st.dp.start_handle = LBT_NEXT_HANDLE_AFTER_CHAR(attr->handle);
-		st.dp.type = BT_GATT_DISCOVER_DESCRIPTOR;
-		st.sp.value_handle = bt_gatt_attr_value_handle(attr);
-		Discover();
+		pLink->dp.uuid = (struct bt_uuid *)&VSP_TX_CCC_UUID;
+		pLink->dp.start_handle =
+			LBT_NEXT_HANDLE_AFTER_CHAR(attr->handle);
+		pLink->dp.type = BT_GATT_DISCOVER_DESCRIPTOR;
+		pLink->sp.value_handle = bt_gatt_attr_value_handle(attr);
+		Discover(pLink);
 	} else {
 		/* Check for the expected UUID when discovery is complete. */
 		FRAMEWORK_DEBUG_ASSERT(
 			bt_uuid_cmp(params->uuid, &VSP_TX_CCC_UUID.uuid) == 0);
-		st.sp.notify = NotificationCallback;
-		st.sp.value = BT_GATT_CCC_NOTIFY;
-		st.sp.ccc_handle = attr->handle;
-		Subscribe();
+		pLink->sp.notify = NotificationCallback;
+		pLink->sp.value = BT_GATT_CCC_NOTIFY;
+		pLink->sp.ccc_handle = attr->handle;
+		Subscribe(pLink);
 	}
 
 	return BT_GATT_ITER_STOP;
@@ -851,7 +1379,8 @@ static uint8_t NotificationCallback(struct bt_conn *conn,
 				    struct bt_gatt_subscribe_params *params,
 				    const void *data, uint16_t length)
 {
-	if (conn != st.conn) {
+	SensorLink_t *pLink = CONTAINER_OF(params, SensorLink_t, sp);
+	if (conn != pLink->conn) {
 		return BT_GATT_ITER_STOP;
 	}
 
@@ -861,17 +1390,11 @@ static uint8_t NotificationCallback(struct bt_conn *conn,
 	}
 
 	char *ptr = (char *)data;
-	size_t i;
-	for (i = 0; i < length; i++) {
-		int result = Bracket_Compute(st.pBracket, ptr[i]);
-		if (result == 0) {
-			ST_LOG_DEV("Bracket Match");
-			CreateAndSendResponseMsg(st.pBracket);
-		}
-	}
+	FrameResponse(pLink, ptr, length);
 
 #ifdef CONFIG_VSP_RX_ECHO
 	/* This data may be a partial string (and won't have a NULL) */
+	size_t i;
 	printk("VSP RX length: %d ", length);
 	for (i = 0; i < length; i++) {
 		printk("%c", ptr[i]);
@@ -882,39 +1405,85 @@ static uint8_t NotificationCallback(struct bt_conn *conn,
 	return BT_GATT_ITER_CONTINUE;
 }
 
-static void CreateAndSendResponseMsg(BracketObj_t *p)
+/* The response is framed directly into the message that is sent to the
+ * sensor task.  A notification can contain the end of one response and the
+ * start of the next.
+ */
+static void FrameResponse(SensorLink_t *pLink, const char *pData,
+			  size_t Length)
 {
 	/* Reserve an extra byte for adding NULL at end of JSON string */
-	size_t bufSize = Bracket_Length(p) + 1;
-	FwkBufMsg_t *pMsg =
-		BufferPool_Take(FWK_BUFFER_MSG_SIZE(FwkBufMsg_t, bufSize));
-	if (pMsg != NULL) {
-		pMsg->header.msgCode = FMC_RESPONSE;
-		pMsg->header.txId = FWK_ID_SENSOR_TASK;
-		pMsg->header.rxId = FWK_ID_SENSOR_TASK;
-		pMsg->size = bufSize;
-		pMsg->length = Bracket_Copy(p, pMsg->buffer);
-		FRAMEWORK_MSG_SEND(pMsg);
+	const size_t BUF_SIZE = CONFIG_JSON_BRACKET_BUFFER_SIZE + 1;
+	while (Length > 0) {
+		if (pLink->pRsp == NULL) {
+			pLink->pRsp = BufferPool_Take(
+				FWK_BUFFER_MSG_SIZE(SensorLinkMsg_t, BUF_SIZE));
+			if (pLink->pRsp == NULL) {
+				return;
+			}
+			JsonFramer_Reset(&pLink->framer, pLink->pRsp->buffer,
+					 CONFIG_JSON_BRACKET_BUFFER_SIZE);
+		}
+
+		size_t used;
+		int result = JsonFramer_Compute(&pLink->framer, pData, Length,
+						&used);
+		pData += used;
+		Length -= used;
+		if (result < 0) {
+			LOG_ERR("JSON response too large");
+		} else if (result > 0) {
+			SensorLinkMsg_t *pMsg = pLink->pRsp;
+			pLink->pRsp = NULL;
+			pMsg->header.msgCode = FMC_RESPONSE;
+			pMsg->header.txId = FWK_ID_SENSOR_TASK;
+			pMsg->header.rxId = FWK_ID_SENSOR_TASK;
+			pMsg->link = pLink - st.links;
+			pMsg->size = BUF_SIZE;
+			pMsg->length = pLink->framer.length;
+			pMsg->buffer[pMsg->length] = 0;
+			FRAMEWORK_MSG_SEND(pMsg);
+		}
+	}
+}
+
+static void FreeResponse(SensorLink_t *pLink)
+{
+	if (pLink->pRsp != NULL) {
+		BufferPool_Free(pLink->pRsp);
+		pLink->pRsp = NULL;
+	}
+}
+
+static void WriteCompleteCallback(struct bt_conn *conn, void *user_data)
+{
+	SensorLink_t *pLink = (SensorLink_t *)user_data;
+	if (conn == pLink->conn) {
+		SendLinkMsg(pLink, FMC_WRITE_COMPLETE);
 	}
-	Bracket_Reset(p);
 }
 
 static void MtuCallback(struct bt_conn *conn, uint8_t err,
 			struct bt_gatt_exchange_params *params)
 {
-	if (conn == st.conn) {
-		st.mtu = BT_MAX_PAYLOAD(bt_gatt_get_mtu(conn));
-		ST_LOG_DEV("%u", st.mtu);
+	SensorLink_t *pLink = CONTAINER_OF(params, SensorLink_t, mp);
+	if (conn == pLink->conn) {
+		pLink->mtu = BT_MAX_PAYLOAD(bt_gatt_get_mtu(conn));
+		ST_LOG_DEV("%u", pLink->mtu);
 	}
 }
 
 /******************************************************************************/
 /* Interrupt Service Routines                                                 */
 /******************************************************************************/
+static void LinkTimerCallbackIsr(struct k_timer *timer_id)
+{
+	SendLinkMsg(k_timer_user_data_get(timer_id), FMC_PERIODIC);
+}
+
 static void SendSensorResetTimerCallbackIsr(struct k_timer *timer_id)
 {
-	UNUSED_PARAMETER(timer_id);
-	FRAMEWORK_MSG_SEND_TO_SELF(FWK_ID_SENSOR_TASK, FMC_SEND_RESET);
+	SendLinkMsg(k_timer_user_data_get(timer_id), FMC_SEND_RESET);
 }
 
 static void SensorTickCallbackIsr(struct k_timer *timer_id)
@@ -0,0 +1,253 @@
+/**
+ * @file sensor_twin.c
+ * @brief
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(sensor_twin);
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <zephyr.h>
+#include <string.h>
+
+#define JSMN_PARENT_LINKS
+#define JSMN_HEADER
+#include "jsmn.h"
+
+#include "sensor_twin.h"
+
+/******************************************************************************/
+/* Local Constant, Macro and Type Definitions                                 */
+/******************************************************************************/
+#ifndef CONFIG_SENSOR_TWIN_MAX_KEYS
+#define CONFIG_SENSOR_TWIN_MAX_KEYS 40
+#endif
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+typedef struct SensorTwinEntry {
+	uint32_t key;
+	uint32_t value;
+} SensorTwinEntry_t;
+
+struct SensorTwin {
+	size_t count;
+	SensorTwinEntry_t entries[];
+};
+
+/* JSON-RPC fields that aren't part of the sensor configuration */
+static const char *IGNORED_KEYS[] = { "jsonrpc", "id", "result" };
+
+/******************************************************************************/
+/* Global                                                                     */
+/******************************************************************************/
+extern struct k_mutex jsmn_mutex;
+extern jsmn_parser jsmn;
+extern jsmntok_t tokens[CONFIG_JSMN_NUMBER_OF_TOKENS];
+
+/******************************************************************************/
+/* Local Function Prototypes                                                  */
+/******************************************************************************/
+static int Parse(const char *pJson);
+static int FindObject(const char *pJson, int Count, const char *pKey,
+		      int Parent);
+static bool Ignored(const char *pJson, jsmntok_t *pKey);
+static uint32_t Hash(uint32_t Hash, const char *pData, size_t Length);
+static uint32_t HashKey(const char *pJson, jsmntok_t *pKey);
+static uint32_t HashValue(const char *pJson, jsmntok_t *pValue);
+static SensorTwinEntry_t *FindEntry(SensorTwin_t *p, uint32_t Key);
+
+/******************************************************************************/
+/* Global Function Definitions                                                */
+/******************************************************************************/
+SensorTwin_t *SensorTwin_Allocate(void)
+{
+	if (CONFIG_SENSOR_TWIN_MAX_KEYS == 0) {
+		return NULL;
+	}
+
+	return k_calloc(1, sizeof(SensorTwin_t) +
+				   (CONFIG_SENSOR_TWIN_MAX_KEYS *
+				    sizeof(SensorTwinEntry_t)));
+}
+
+void SensorTwin_Free(SensorTwin_t *p)
+{
+	k_free(p);
+}
+
+void SensorTwin_Clear(SensorTwin_t *p)
+{
+	if (p != NULL) {
+		p->count = 0;
+	}
+}
+
+int SensorTwin_Update(SensorTwin_t *p, const char *pRsp, char *pOut,
+		      size_t Size)
+{
+	size_t n = 0;
+	k_mutex_lock(&jsmn_mutex, K_FOREVER);
+
+	int count = Parse(pRsp);
+	int object = FindObject(pRsp, count, "result", 0);
+	int i;
+	for (i = object + 1; (i + 1) < count; i++) {
+		if (tokens[i].parent != object || Ignored(pRsp, &tokens[i])) {
+			continue;
+		}
+
+		jsmntok_t *pValue = &tokens[i + 1];
+		uint32_t key = HashKey(pRsp, &tokens[i]);
+		uint32_t value = HashValue(pRsp, pValue);
+		SensorTwinEntry_t *pEntry = FindEntry(p, key);
+		if (pEntry != NULL && pEntry->value == value) {
+			continue;
+		}
+
+		/* A key that doesn't fit is always reported. */
+		if (pEntry == NULL && p->count < CONFIG_SENSOR_TWIN_MAX_KEYS) {
+			pEntry = &p->entries[p->count++];
+			pEntry->key = key;
+		}
+		if (pEntry != NULL) {
+			pEntry->value = value;
+		}
+
+		/* Keys are strings (the quotes aren't part of the token). */
+		int start = tokens[i].start - 1;
+		int end = pValue->end + ((pValue->type == JSMN_STRING) ? 1 : 0);
+		size_t length = end - start + ((n > 0) ? 1 : 0);
+		if ((n + length) >= Size) {
+			n = Size;
+			break;
+		}
+		if (n > 0) {
+			pOut[n++] = ',';
+		}
+		memcpy(&pOut[n], &pRsp[start], end - start);
+		n += end - start;
+		pOut[n] = 0;
+	}
+
+	k_mutex_unlock(&jsmn_mutex);
+	if (count < 1) {
+		return -EINVAL;
+	}
+	return (n < Size) ? n : -ENOMEM;
+}
+
+bool SensorTwin_Matches(SensorTwin_t *p, const char *pCmd)
+{
+	bool match = false;
+	k_mutex_lock(&jsmn_mutex, K_FOREVER);
+
+	int count = Parse(pCmd);
+	int params = FindObject(pCmd, count, "params", 0);
+	if (params > 0 && tokens[params].size > 0) {
+		match = true;
+		int i;
+		for (i = params + 1; (i + 1) < count && match; i++) {
+			if (tokens[i].parent != params) {
+				continue;
+			}
+			SensorTwinEntry_t *pEntry =
+				FindEntry(p, HashKey(pCmd, &tokens[i]));
+			uint32_t value = HashValue(pCmd, &tokens[i + 1]);
+			match = (pEntry != NULL && pEntry->value == value);
+		}
+	}
+
+	k_mutex_unlock(&jsmn_mutex);
+	return match;
+}
+
+/******************************************************************************/
+/* Local Function Definitions                                                 */
+/******************************************************************************/
+static int Parse(const char *pJson)
+{
+	jsmn_init(&jsmn);
+	int count = jsmn_parse(&jsmn, pJson, strlen(pJson), tokens,
+			       CONFIG_JSMN_NUMBER_OF_TOKENS);
+	if (count < 1 || tokens[0].type != JSMN_OBJECT) {
+		return 0;
+	}
+	return count;
+}
+
+/* Returns the index of the object value of pKey, otherwise Parent. */
+static int FindObject(const char *pJson, int Count, const char *pKey,
+		      int Parent)
+{
+	size_t length = strlen(pKey);
+	int i;
+	for (i = Parent + 1; (i + 1) < Count; i++) {
+		if (tokens[i].parent == Parent &&
+		    tokens[i].type == JSMN_STRING &&
+		    (tokens[i].end - tokens[i].start) == length &&
+		    strncmp(&pJson[tokens[i].start], pKey, length) == 0 &&
+		    tokens[i + 1].type == JSMN_OBJECT) {
+			return i + 1;
+		}
+	}
+	return Parent;
+}
+
+static bool Ignored(const char *pJson, jsmntok_t *pKey)
+{
+	size_t length = pKey->end - pKey->start;
+	size_t i;
+	for (i = 0; i < ARRAY_SIZE(IGNORED_KEYS); i++) {
+		if (length == strlen(IGNORED_KEYS[i]) &&
+		    strncmp(&pJson[pKey->start], IGNORED_KEYS[i],
+			    length) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* FNV-1a */
+static uint32_t Hash(uint32_t Hash, const char *pData, size_t Length)
+{
+	size_t i;
+	for (i = 0; i < Length; i++) {
+		Hash ^= (uint8_t)pData[i];
+		Hash *= FNV_PRIME;
+	}
+	return Hash;
+}
+
+static uint32_t HashKey(const char *pJson, jsmntok_t *pKey)
+{
+	return Hash(FNV_OFFSET_BASIS, &pJson[pKey->start],
+		    pKey->end - pKey->start);
+}
+
+/* The type is included so that "1" and 1 are different. */
+static uint32_t HashValue(const char *pJson, jsmntok_t *pValue)
+{
+	char type = (char)pValue->type;
+	uint32_t hash = Hash(FNV_OFFSET_BASIS, &type, 1);
+	return Hash(hash, &pJson[pValue->start], pValue->end - pValue->start);
+}
+
+static SensorTwinEntry_t *FindEntry(SensorTwin_t *p, uint32_t Key)
+{
+	size_t i;
+	for (i = 0; i < p->count; i++) {
+		if (p->entries[i].key == Key) {
+			return &p->entries[i];
+		}
+	}
+	return NULL;
+}
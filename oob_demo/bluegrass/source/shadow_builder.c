@@ -46,6 +46,16 @@ LOG_MODULE_REGISTER(shadow_builder);
 		JSON_APPEND_STRING(str);                                       \
 	} while (0)
 
+#define JSON_APPEND_S32(c)                                                     \
+	do {                                                                   \
+		int32_t s = (c);                                               \
+		if (s < 0) {                                                   \
+			JSON_APPEND_CHAR('-');                                 \
+			s *= -1;                                               \
+		}                                                              \
+		JSON_APPEND_U32((uint32_t)s);                                  \
+	} while (0)
+
 #define JSON_APPEND_HEX8(c)                                                    \
 	do {                                                                   \
 		memset(str, 0, MAXIMUM_LENGTH_OF_TO_STRING_OUTPUT);            \
@@ -146,6 +156,26 @@ void ShadowBuilder_AddPair(JsonMsg_t *pJsonMsg, const char *restrict pKey,
 	JSON_APPEND_CHAR(',');
 }
 
+void ShadowBuilder_AddLease(JsonMsg_t *pJsonMsg, const char *restrict pKey,
+			    const char *restrict pOwner, int32_t Rssi,
+			    uint32_t Expires)
+{
+	FRAMEWORK_ASSERT(pJsonMsg != NULL);
+	FRAMEWORK_ASSERT(pKey != NULL);
+	FRAMEWORK_ASSERT(pOwner != NULL);
+	FRAMEWORK_ASSERT(strlen(pKey) > 0);
+
+	JSON_APPEND_KEY(pKey);
+	JSON_APPEND_CHAR('[');
+	JSON_APPEND_VALUE_STRING(pOwner);
+	JSON_APPEND_CHAR(',');
+	JSON_APPEND_S32(Rssi);
+	JSON_APPEND_CHAR(',');
+	JSON_APPEND_U32(Expires);
+	JSON_APPEND_CHAR(']');
+	JSON_APPEND_CHAR(',');
+}
+
 void ShadowBuilder_AddVersion(JsonMsg_t *pJsonMsg, const char *restrict pKey,
 			      uint8_t Major, uint8_t Minor, uint8_t Build)
 {
@@ -253,6 +283,50 @@ void ShadowBuilder_AddSensorTableArrayEntry(JsonMsg_t *pJsonMsg,
 	JSON_APPEND_CHAR(',');
 }
 
+void ShadowBuilder_AddReportPolicyArrayEntry(JsonMsg_t *pJsonMsg,
+					     const char *restrict pAddrStr,
+					     const SensorReportPolicy_t *p)
+{
+	FRAMEWORK_ASSERT(pJsonMsg != NULL);
+	FRAMEWORK_ASSERT(pAddrStr != NULL);
+	FRAMEWORK_ASSERT(p != NULL);
+
+	JSON_APPEND_CHAR('[');
+	JSON_APPEND_VALUE_STRING(pAddrStr);
+	JSON_APPEND_CHAR(',');
+	JSON_APPEND_U32(p->deadbandCc);
+	JSON_APPEND_CHAR(',');
+	JSON_APPEND_U32(p->deadbandPercent);
+	JSON_APPEND_CHAR(',');
+	JSON_APPEND_U32(p->minIntervalSeconds);
+	JSON_APPEND_CHAR(',');
+	JSON_APPEND_U32(p->heartbeatSeconds);
+	JSON_APPEND_CHAR(']');
+	JSON_APPEND_CHAR(',');
+}
+
+void ShadowBuilder_AddAggregateArrayEntry(JsonMsg_t *pJsonMsg,
+					  const char *restrict pAddrStr,
+					  const SensorAggregate_t *p)
+{
+	FRAMEWORK_ASSERT(pJsonMsg != NULL);
+	FRAMEWORK_ASSERT(pAddrStr != NULL);
+	FRAMEWORK_ASSERT(p != NULL);
+
+	JSON_APPEND_CHAR('[');
+	JSON_APPEND_VALUE_STRING(pAddrStr);
+	JSON_APPEND_CHAR(',');
+	JSON_APPEND_U32(p->count);
+	JSON_APPEND_CHAR(',');
+	JSON_APPEND_S32(p->min);
+	JSON_APPEND_CHAR(',');
+	JSON_APPEND_S32(p->max);
+	JSON_APPEND_CHAR(',');
+	JSON_APPEND_S32(SensorAggregate_Mean(p));
+	JSON_APPEND_CHAR(']');
+	JSON_APPEND_CHAR(',');
+}
+
 void ShadowBuilder_AddEventLogEntry(JsonMsg_t *pJsonMsg, SensorLogEvent_t *p)
 {
 	FRAMEWORK_ASSERT(pJsonMsg != NULL);
@@ -28,6 +28,7 @@ enum FwkIdEnum {
 	/* Application */
 	FWK_ID_SENSOR_TASK = FWK_ID_APP_START,
 	FWK_ID_CLOUD,
+	FWK_ID_CLOUD_ALARM,
 	FWK_ID_COAP_FOTA_TASK,
 
 	/* Reserved for framework (DO NOT DELETE, and it must be LAST) */
@@ -33,6 +33,7 @@ enum FwkMsgCodeEnum {
 	FMC_GATEWAY_OUT,
 	FMC_SENSOR_TICK,
 	FMC_WHITELIST_REQUEST,
+	FMC_REPORT_POLICY,
 	FMC_CONFIG_REQUEST,
 	FMC_CONNECT_REQUEST,
 	FMC_START_DISCOVERY,
@@ -41,9 +42,15 @@ enum FwkMsgCodeEnum {
 	FMC_RESPONSE,
 	FMC_DISCONNECT,
 	FMC_SEND_RESET,
+	FMC_WRITE_COMPLETE,
 	FMC_SUBSCRIBE,
 	FMC_SUBSCRIBE_ACK,
 	FMC_SENSOR_SHADOW_INIT,
+	FMC_SENSOR_PUBLISH_ACK,
+	FMC_SENSOR_PUBLISH_DROPPED,
+	FMC_SENSOR_LOG_REQUEST,
+	FMC_SENSOR_LEASE,
+	FMC_CLOUD_ALARM_PENDING,
 	FMC_AWS_KEEP_ALIVE,
 	FMC_AWS_DECOMMISSION,
 
@@ -23,10 +23,20 @@ extern "C" {
 /******************************************************************************/
 /* Project Specific Message Types                                             */
 /******************************************************************************/
+/* Alarms are sent to the cloud before routine data. */
+enum JSON_MSG_PRIORITY {
+	JSON_MSG_PRIORITY_ROUTINE = 0,
+	JSON_MSG_PRIORITY_ALARM,
+	JSON_MSG_PRIORITY_COUNT
+};
+
 typedef struct JsonMsg {
 	FwkMsgHeader_t header;
 	size_t size; /** number of bytes */
 	size_t length; /** of the data */
+	uint32_t sequence; /** of newest sensor event (0 if ack not needed) */
+	uint8_t priority;
+	uint32_t timestamp; /** uptime (ms) when message was queued */
 	char topic[CONFIG_AWS_TOPIC_MAX_SIZE];
 	char buffer[];
 } JsonMsg_t;
@@ -58,6 +58,8 @@ static const unsigned char aws_root_ca[] =
 
 #define APP_MQTT_BUFFER_SIZE 1024
 
+#define AWS_SUBSCRIBE_LIST_MAX_SIZE 16
+
 #define DEFAULT_MQTT_CLIENTID "pinnacle100_oob"
 #define AWS_MQTT_ID_MAX_SIZE 128
 
@@ -149,6 +151,8 @@ int awsPublishBl654SensorData(float temperature, float humidity,
 			      float pressure);
 int awsPublishPinnacleData(int radioRssi, int radioSinr);
 int awsSubscribe(uint8_t *topic, uint8_t subscribe);
+int awsSubscribeList(uint8_t **topic_list, size_t count, uint8_t subscribe,
+		     bool *success);
 int awsGetShadow(void);
 int awsGetAcceptedSubscribe(void);
 int awsGetAcceptedUnsub(void);
@@ -47,6 +47,13 @@ int nvWriteLwm2mConfig(void *data, uint16_t size);
 int nvStoreAwsEnableCustom(bool Value);
 int nvReadAwsEnableCustom(bool *Value);
 #endif
+#ifdef CONFIG_BLUEGRASS
+int nvStoreSensorTableSize(uint16_t Value);
+int nvReadSensorTableSize(uint16_t *Value);
+int nvStoreSensorSnapshot(void *Data, uint16_t Size);
+int nvReadSensorSnapshot(void *Data, uint16_t Size);
+int nvDeleteSensorSnapshot(void);
+#endif
 
 #ifdef __cplusplus
 }
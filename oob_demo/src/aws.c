@@ -49,6 +49,13 @@ struct topics {
 	uint8_t get_accepted[CONFIG_AWS_TOPIC_MAX_SIZE];
 };
 
+/* The return codes of a SUBACK are copied into the callers list */
+struct subscription_ack {
+	uint16_t message_id;
+	size_t count;
+	bool *success;
+};
+
 /******************************************************************************/
 /* Local Data Definitions                                                     */
 /******************************************************************************/
@@ -57,6 +64,8 @@ static struct k_thread rxThread;
 
 K_SEM_DEFINE(connected_sem, 0, 1);
 K_SEM_DEFINE(send_ack_sem, 0, 1);
+K_SEM_DEFINE(sub_ack_sem, 0, 1);
+K_MUTEX_DEFINE(sub_ack_mutex);
 
 /* Buffers for MQTT client. */
 static uint8_t rx_buffer[APP_MQTT_BUFFER_SIZE];
@@ -92,6 +101,8 @@ static char *root_ca;
 
 static struct topics topics;
 
+static struct subscription_ack sub_ack;
+
 /******************************************************************************/
 /* Local Function Prototypes                                                  */
 /******************************************************************************/
@@ -104,6 +115,8 @@ static void mqtt_evt_handler(struct mqtt_client *const client,
 static int subscription_handler(struct mqtt_client *const client,
 				const struct mqtt_evt *evt);
 static void subscription_flush(struct mqtt_client *const client, size_t length);
+static void subscription_ack(uint16_t message_id,
+			     const struct mqtt_binstr *return_codes);
 static int publish_string(struct mqtt_client *client, enum mqtt_qos qos,
 			  char *data, uint8_t *topic);
 static void client_init(struct mqtt_client *client);
@@ -428,6 +441,59 @@ int awsSubscribe(uint8_t *topic, uint8_t subscribe)
 	return rc;
 }
 
+/* All of the topics are sent in a single packet.  The result for each topic
+ * is taken from the SUBACK (UNSUBACK doesn't contain per-topic results).
+ */
+int awsSubscribeList(uint8_t **topic_list, size_t count, uint8_t subscribe,
+		     bool *success)
+{
+	struct mqtt_topic mt[AWS_SUBSCRIBE_LIST_MAX_SIZE];
+	size_t i;
+	int rc;
+
+	if (count == 0 || count > AWS_SUBSCRIBE_LIST_MAX_SIZE) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < count; i++) {
+		mt[i].topic.utf8 = topic_list[i];
+		mt[i].topic.size = strlen(mt[i].topic.utf8);
+		mt[i].qos = MQTT_QOS_1_AT_LEAST_ONCE;
+		__ASSERT(mt[i].topic.size != 0, "Invalid topic");
+		success[i] = false;
+	}
+	struct mqtt_subscription_list list = {
+		.list = mt,
+		.list_count = count,
+		.message_id = rand16_nonzero_get()
+	};
+
+	k_mutex_lock(&sub_ack_mutex, K_FOREVER);
+	k_sem_reset(&sub_ack_sem);
+	sub_ack.message_id = list.message_id;
+	sub_ack.count = count;
+	sub_ack.success = success;
+	k_mutex_unlock(&sub_ack_mutex);
+
+	rc = subscribe ? mqtt_subscribe(&client_ctx, &list) :
+			 mqtt_unsubscribe(&client_ctx, &list);
+	if (rc == 0 && k_sem_take(&sub_ack_sem, PUBLISH_TIMEOUT_TICKS) != 0) {
+		rc = -EAGAIN;
+	}
+
+	k_mutex_lock(&sub_ack_mutex, K_FOREVER);
+	sub_ack.success = NULL;
+	k_mutex_unlock(&sub_ack_mutex);
+
+	char *s = log_strdup(subscribe ? "Subscribed" : "Unsubscribed");
+	if (rc != 0) {
+		AWS_LOG_ERR("%s status %d to %u topics", s, rc, count);
+	} else {
+		AWS_LOG_DBG("%s to %u topics", s, count);
+	}
+	return rc;
+}
+
 /******************************************************************************/
 /* Local Function Definitions                                                 */
 /******************************************************************************/
@@ -527,6 +593,25 @@ static void mqtt_evt_handler(struct mqtt_client *const client,
 		k_sem_give(&send_ack_sem);
 		break;
 
+	case MQTT_EVT_SUBACK:
+		if (evt->result != 0) {
+			AWS_LOG_ERR("MQTT SUBACK error %d", evt->result);
+			break;
+		}
+
+		subscription_ack(evt->param.suback.message_id,
+				 &evt->param.suback.return_codes);
+		break;
+
+	case MQTT_EVT_UNSUBACK:
+		if (evt->result != 0) {
+			AWS_LOG_ERR("MQTT UNSUBACK error %d", evt->result);
+			break;
+		}
+
+		subscription_ack(evt->param.unsuback.message_id, NULL);
+		break;
+
 	case MQTT_EVT_PUBLISH:
 		if (evt->result != 0) {
 			AWS_LOG_ERR("MQTT PUBLISH error %d", evt->result);
@@ -604,6 +689,27 @@ static void subscription_flush(struct mqtt_client *const client, size_t length)
 	}
 }
 
+static void subscription_ack(uint16_t message_id,
+			     const struct mqtt_binstr *return_codes)
+{
+	size_t i;
+
+	k_mutex_lock(&sub_ack_mutex, K_FOREVER);
+	if (sub_ack.success != NULL && sub_ack.message_id == message_id) {
+		for (i = 0; i < sub_ack.count; i++) {
+			if (return_codes == NULL) {
+				sub_ack.success[i] = true;
+			} else if (i < return_codes->len) {
+				sub_ack.success[i] = (return_codes->data[i] !=
+						      MQTT_SUBACK_FAILURE);
+			}
+		}
+		sub_ack.success = NULL;
+		k_sem_give(&sub_ack_sem);
+	}
+	k_mutex_unlock(&sub_ack_mutex);
+}
+
 static int publish_string(struct mqtt_client *client, enum mqtt_qos qos,
 			  char *data, uint8_t *topic)
 {
@@ -20,6 +20,7 @@ LOG_MODULE_REGISTER(main);
 /* Includes                                                                   */
 /******************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include <zephyr/types.h>
 #include <stddef.h>
 #include <errno.h>
@@ -57,6 +58,11 @@ LOG_MODULE_REGISTER(main);
 #include "bluegrass.h"
 #endif
 
+#ifdef CONFIG_SENSOR_BONDING
+#include <settings/settings.h>
+#include "file_system_utilities.h"
+#endif
+
 #ifdef CONFIG_LWM2M
 #include "lcz_lwm2m_client.h"
 #include "ble_lwm2m_service.h"
@@ -120,6 +126,9 @@ static bool devKeySet;
 #endif
 
 static FwkMsgReceiver_t cloudMsgReceiver;
+#ifdef CONFIG_BLUEGRASS
+static FwkMsgReceiver_t cloudAlarmMsgReceiver;
+#endif
 static bool commissioned;
 static bool appReady = false;
 #if defined(CONFIG_BLUEGRASS) && defined(CONFIG_COAP_FOTA)
@@ -132,6 +141,12 @@ struct lte_status *lteInfo;
 K_MSGQ_DEFINE(cloudQ, FWK_QUEUE_ENTRY_SIZE, CONFIG_CLOUD_QUEUE_SIZE,
 	      FWK_QUEUE_ALIGNMENT);
 
+#ifdef CONFIG_BLUEGRASS
+/* Sensor alarms bypass routine data (and aren't purged). */
+K_MSGQ_DEFINE(cloudAlarmQ, FWK_QUEUE_ENTRY_SIZE, CONFIG_CLOUD_ALARM_QUEUE_SIZE,
+	      FWK_QUEUE_ALIGNMENT);
+#endif
+
 /* Sensor events are not received properly unless filter duplicates is OFF */
 #if defined(CONFIG_SCAN_FOR_BT510_CODED)
 static struct bt_le_scan_param scanParameters =
@@ -163,6 +178,7 @@ static void StartKeepAliveTimer(void);
 static void appStateCommissionDevice(void);
 static void appStateLteConnectedAws(void);
 static void awsMsgHandler(void);
+static void awsReceive(FwkMsg_t **ppMsg);
 static void awsSvcEvent(enum aws_svc_event event);
 static void set_commissioned(void);
 static void appStateWaitFota(void);
@@ -352,6 +368,14 @@ static void initializeCloudMsgReceiver(void)
 	cloudMsgReceiver.rxBlockTicks = K_NO_WAIT; /* unused */
 	cloudMsgReceiver.pMsgDispatcher = NULL; /* unused */
 	Framework_RegisterReceiver(&cloudMsgReceiver);
+
+#ifdef CONFIG_BLUEGRASS
+	cloudAlarmMsgReceiver.id = FWK_ID_CLOUD_ALARM;
+	cloudAlarmMsgReceiver.pQueue = &cloudAlarmQ;
+	cloudAlarmMsgReceiver.rxBlockTicks = K_NO_WAIT; /* unused */
+	cloudAlarmMsgReceiver.pMsgDispatcher = NULL; /* unused */
+	Framework_RegisterReceiver(&cloudAlarmMsgReceiver);
+#endif
 }
 
 static void initializeBle(const char *imei)
@@ -362,12 +386,29 @@ static void initializeBle(const char *imei)
 	int devNameEnd;
 	int imeiEnd;
 
+#ifdef CONFIG_SENSOR_BONDING
+	/* Bonds are stored in the file system.  It must be mounted before
+	 * the stack initializes settings.
+	 */
+	err = fsu_lfs_mount();
+	if (err) {
+		LOG_ERR("Unable to mount file system for bonds (%d)", err);
+	}
+#endif
+
 	err = bt_enable(NULL);
 	if (err) {
 		LOG_ERR("Bluetooth init failed (err %d)", err);
 		return;
 	}
 
+#ifdef CONFIG_SENSOR_BONDING
+	err = settings_load();
+	if (err) {
+		LOG_ERR("Unable to load bonds (%d)", err);
+	}
+#endif
+
 	LOG_INF("Bluetooth initialized");
 
 	/* add digits of IMEI to dev name */
@@ -505,7 +546,7 @@ static void awsMsgHandler(void)
 		 * The keep alive message (RSSI) occurs every ~30 seconds.
 		 */
 		rc = -EINVAL;
-		Framework_Receive(cloudMsgReceiver.pQueue, &pMsg, K_FOREVER);
+		awsReceive(&pMsg);
 		freeMsg = true;
 
 		/* BL654 data is sent to the gateway topic.  If Bluegrass is enabled,
@@ -533,6 +574,11 @@ static void awsMsgHandler(void)
 			/* Message is used to unblock queue. */
 			break;
 
+		case FMC_CLOUD_ALARM_PENDING:
+			/* Message is used to unblock queue. */
+			rc = 0;
+			break;
+
 		case FMC_FOTA_START:
 			start_fota = true;
 			FRAMEWORK_MSG_CREATE_AND_SEND(FWK_ID_RESERVED,
@@ -564,6 +610,19 @@ static void awsMsgHandler(void)
 	}
 }
 
+/* Alarms are sent before routine data.  When an alarm is queued,
+ * a message is also sent to the routine queue to unblock it.
+ */
+static void awsReceive(FwkMsg_t **ppMsg)
+{
+#ifdef CONFIG_BLUEGRASS
+	if (k_msgq_get(cloudAlarmMsgReceiver.pQueue, ppMsg, K_NO_WAIT) == 0) {
+		return;
+	}
+#endif
+	Framework_Receive(cloudMsgReceiver.pQueue, ppMsg, K_FOREVER);
+}
+
 /* The shadow init is only sent once after the very first connect.*/
 static void appStateAwsInitShadow(void)
 {
@@ -883,6 +942,77 @@ static int shell_decommission(const struct shell *shell, size_t argc,
 done:
 	return rc;
 }
+
+static int shell_sensor_table_size_cmd(const struct shell *shell, size_t argc,
+				       char **argv)
+{
+	int rc = 0;
+	uint16_t size = CONFIG_SENSOR_TABLE_SIZE;
+
+	if (argc == 2) {
+		long value = strtol(argv[1], NULL, 10);
+		if (value < 1 || value > CONFIG_SENSOR_TABLE_MAX_SIZE) {
+			shell_error(shell, "Size must be 1 to %u",
+				    CONFIG_SENSOR_TABLE_MAX_SIZE);
+			rc = -EINVAL;
+		} else {
+			size = (uint16_t)value;
+			rc = nvStoreSensorTableSize(size);
+			if (rc >= 0) {
+				shell_print(shell, "Sensor table size %u",
+					    size);
+				shell_print(shell, "Reset to apply");
+			} else {
+				shell_error(shell, "Could not set size [%d]",
+					    rc);
+			}
+		}
+	} else if (argc == 1) {
+		nvReadSensorTableSize(&size);
+		shell_print(shell, "Sensor table size %u", size);
+	} else {
+		shell_error(shell, "Invalid parameter");
+		rc = -EINVAL;
+	}
+
+	return rc;
+}
+
+static int shell_latency_cmd(const struct shell *shell, size_t argc,
+			     char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	static const char *const names[JSON_MSG_PRIORITY_COUNT] = {
+		[JSON_MSG_PRIORITY_ROUTINE] = "routine",
+		[JSON_MSG_PRIORITY_ALARM] = "alarm"
+	};
+	uint8_t i;
+	for (i = 0; i < JSON_MSG_PRIORITY_COUNT; i++) {
+		const BluegrassLatency_t *p = Bluegrass_GetLatency(i);
+		shell_print(shell, "%-8s count: %u avg: %u ms max: %u ms",
+			    names[i], p->count,
+			    (p->count == 0) ? 0 :
+					      (uint32_t)(p->totalMs / p->count),
+			    p->maxMs);
+	}
+	shell_print(shell, "first sensor publish: %u ms after boot",
+		    Bluegrass_GetFirstPublishTime());
+	return 0;
+}
+
+static int shell_event_log_cmd(const struct shell *shell, size_t argc,
+			       char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	FRAMEWORK_MSG_CREATE_AND_SEND(FWK_ID_RESERVED, FWK_ID_SENSOR_TASK,
+				      FMC_SENSOR_LOG_REQUEST);
+	shell_print(shell, "Entire event log will be sent with next update");
+	return 0;
+}
 #endif /* CONFIG_BLUEGRASS */
 
 static int shell_oob_ver_cmd(const struct shell *shell, size_t argc,
@@ -1010,6 +1140,15 @@ SHELL_STATIC_SUBCMD_SET_CREATE(oob_cmds,
 			       SHELL_CMD(reset, NULL,
 					 "Factory reset (decommission) device",
 					 shell_decommission),
+			       SHELL_CMD(eventlog, NULL,
+					 "Send entire sensor event logs",
+					 shell_event_log_cmd),
+			       SHELL_CMD(latency, NULL,
+					 "Sensor publish latency (by priority)",
+					 shell_latency_cmd),
+			       SHELL_CMD(sensors, NULL,
+					 "Sensor table size (used after reset)",
+					 shell_sensor_table_size_cmd),
 #endif /* CONFIG_BLUEGRASS */
 			       SHELL_CMD(ver, NULL, "Firmware version",
 					 shell_oob_ver_cmd),
@@ -1039,7 +1178,8 @@ SHELL_CMD_REGISTER(hl, &hl_cmds, "HL7800 commands", NULL);
 /* Interrupt Service Routines                                                 */
 /******************************************************************************/
 /* The cloud (AWS) queue isn't checked in all states.  Therefore, it needs to
- * be periodically checked so that other tasks don't overfill it
+ * be periodically checked so that other tasks don't overfill it.
+ * Sensor alarms are in a separate queue that isn't purged.
  */
 static void cloud_fifo_monitor_isr(struct k_timer *timer_id)
 {
@@ -1050,6 +1190,11 @@ static void cloud_fifo_monitor_isr(struct k_timer *timer_id)
 		size_t flushed = Framework_Flush(FWK_ID_CLOUD);
 		if (flushed > 0) {
 			LOG_WRN("Flushed %u cloud messages", flushed);
+#ifdef CONFIG_BLUEGRASS
+			FRAMEWORK_MSG_CREATE_AND_SEND(
+				FWK_ID_CLOUD, FWK_ID_SENSOR_TASK,
+				FMC_SENSOR_PUBLISH_DROPPED);
+#endif
 		}
 	}
 }
@@ -41,6 +41,13 @@ enum SETTING_ID {
 #ifdef CONFIG_APP_AWS_CUSTOMIZATION
 	SETTING_ID_AWS_ENABLE_CUSTOM,
 #endif
+#ifdef CONFIG_BLUEGRASS
+	/* Fixed IDs so stored records don't move when other settings are
+	 * conditionally compiled in or out.
+	 */
+	SETTING_ID_SENSOR_TABLE_SIZE = 16,
+	SETTING_ID_SENSOR_SNAPSHOT = 17,
+#endif
 };
 
 /******************************************************************************/
@@ -241,3 +248,32 @@ int nvReadAwsEnableCustom(bool *Value)
 	return nvs_read(&fs, SETTING_ID_AWS_ENABLE_CUSTOM, Value, sizeof(bool));
 }
 #endif /* CONFIG_APP_AWS_CUSTOMIZATION */
+
+#ifdef CONFIG_BLUEGRASS
+int nvStoreSensorTableSize(uint16_t Value)
+{
+	return nvs_write(&fs, SETTING_ID_SENSOR_TABLE_SIZE, &Value,
+			 sizeof(uint16_t));
+}
+
+int nvReadSensorTableSize(uint16_t *Value)
+{
+	return nvs_read(&fs, SETTING_ID_SENSOR_TABLE_SIZE, Value,
+			sizeof(uint16_t));
+}
+
+int nvStoreSensorSnapshot(void *Data, uint16_t Size)
+{
+	return nvs_write(&fs, SETTING_ID_SENSOR_SNAPSHOT, Data, Size);
+}
+
+int nvReadSensorSnapshot(void *Data, uint16_t Size)
+{
+	return nvs_read(&fs, SETTING_ID_SENSOR_SNAPSHOT, Data, Size);
+}
+
+int nvDeleteSensorSnapshot(void)
+{
+	return nvs_delete(&fs, SETTING_ID_SENSOR_SNAPSHOT);
+}
+#endif /* CONFIG_BLUEGRASS */
@@ -0,0 +1,36 @@
+/**
+ * @file host_test.h
+ * @brief Minimal checks for the host tests.  A failed check is printed
+ * and the test continues so that all failures are reported.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __HOST_TEST_H__
+#define __HOST_TEST_H__
+
+#include <stdio.h>
+
+static unsigned int hostTestChecks;
+static unsigned int hostTestFailures;
+
+#define HOST_CHECK(expr)                                                       \
+	do {                                                                   \
+		hostTestChecks += 1;                                           \
+		if (!(expr)) {                                                 \
+			hostTestFailures += 1;                                 \
+			printf("%s:%d: check failed: %s\n", __FILE__,          \
+			       __LINE__, #expr);                               \
+		}                                                              \
+	} while (0)
+
+/* Returns the exit status of the test. */
+static inline int HostTest_Result(const char *pName)
+{
+	printf("%s: %u checks, %u failed\n", pName, hostTestChecks,
+	       hostTestFailures);
+	return (hostTestFailures == 0) ? 0 : 1;
+}
+
+#endif /* __HOST_TEST_H__ */
@@ -0,0 +1,60 @@
+/**
+ * @file FrameworkIncludes.h
+ * @brief Host replacement for the framework and kernel definitions used by
+ * the modules that are built by the host tests.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __HOST_FRAMEWORK_INCLUDES_H__
+#define __HOST_FRAMEWORK_INCLUDES_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUILD_ASSERT(expr, msg) _Static_assert(expr, msg)
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define ROUND_UP(x, align)                                                     \
+	((((x) + ((align)-1)) / (align)) * (align))
+
+typedef struct JsonMsg {
+	size_t length;
+	char buffer[1];
+} JsonMsg_t;
+
+/* Blocks are taken from the heap; the count is enforced. */
+struct k_mem_slab {
+	size_t blockSize;
+	size_t count;
+	size_t used;
+};
+
+#define K_NO_WAIT 0
+
+#define K_MEM_SLAB_DEFINE(name, size, n, align)                                \
+	static struct k_mem_slab name = { .blockSize = (size), .count = (n) }
+
+static inline int k_mem_slab_alloc(struct k_mem_slab *slab, void **mem,
+				   int timeout)
+{
+	(void)timeout;
+	if (slab->used == slab->count) {
+		return -1;
+	}
+	*mem = malloc(slab->blockSize);
+	slab->used += 1;
+	return 0;
+}
+
+static inline void k_mem_slab_free(struct k_mem_slab *slab, void **mem)
+{
+	free(*mem);
+	slab->used -= 1;
+}
+
+#endif /* __HOST_FRAMEWORK_INCLUDES_H__ */
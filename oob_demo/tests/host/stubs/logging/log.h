@@ -0,0 +1,24 @@
+/**
+ * @file log.h
+ * @brief Host replacement for the Zephyr logging header.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __HOST_LOG_H__
+#define __HOST_LOG_H__
+
+#include <stdio.h>
+
+#define LOG_LEVEL_INF 3
+#define LOG_MODULE_REGISTER(...)
+
+#define LOG_DBG(...)
+#define LOG_INF(...)
+#define LOG_WRN(...)
+#define LOG_ERR(fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+
+#define log_strdup(s) (s)
+
+#endif /* __HOST_LOG_H__ */
@@ -0,0 +1,20 @@
+/**
+ * @file shadow_builder.h
+ * @brief Host replacement for the shadow builder.  The tests implement
+ * these functions to capture what a module would send.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __HOST_SHADOW_BUILDER_H__
+#define __HOST_SHADOW_BUILDER_H__
+
+#include "FrameworkIncludes.h"
+#include "sensor_log.h"
+
+void ShadowBuilder_StartArray(JsonMsg_t *pJsonMsg, const char *pKey);
+void ShadowBuilder_EndArray(JsonMsg_t *pJsonMsg);
+void ShadowBuilder_AddEventLogEntry(JsonMsg_t *pJsonMsg, SensorLogEvent_t *p);
+
+#endif /* __HOST_SHADOW_BUILDER_H__ */
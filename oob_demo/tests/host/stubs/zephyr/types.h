@@ -0,0 +1,14 @@
+/**
+ * @file types.h
+ * @brief Host replacement for the Zephyr header.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __HOST_ZEPHYR_TYPES_H__
+#define __HOST_ZEPHYR_TYPES_H__
+
+#include <stdint.h>
+
+#endif /* __HOST_ZEPHYR_TYPES_H__ */
@@ -0,0 +1,206 @@
+/**
+ * @file test_json_framer.c
+ * @brief Host test of the JSON framer.  Objects are fed in every possible
+ * chunk size so that each state can be split across notifications.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "json_framer.h"
+#include "host_test.h"
+
+/******************************************************************************/
+/* Local Constant, Macro and Type Definitions                                 */
+/******************************************************************************/
+#define FRAME_BUFFER_SIZE 128
+
+/******************************************************************************/
+/* Local Data Definitions                                                     */
+/******************************************************************************/
+static char frame[FRAME_BUFFER_SIZE];
+
+/******************************************************************************/
+/* Local Function Prototypes                                                  */
+/******************************************************************************/
+static int Feed(JsonFramer_t *p, const char *pData, size_t Length,
+		size_t Chunk, size_t *pUsed);
+static void CheckFrame(const char *pData, const char *pObject);
+
+static void TestSingleChunk(void);
+static void TestSplit(void);
+static void TestStrings(void);
+static void TestOverflow(void);
+
+/******************************************************************************/
+/* Global Function Definitions                                                */
+/******************************************************************************/
+int main(void)
+{
+	TestSingleChunk();
+	TestSplit();
+	TestStrings();
+	TestOverflow();
+	return HostTest_Result("json_framer");
+}
+
+/******************************************************************************/
+/* Local Function Definitions                                                 */
+/******************************************************************************/
+/* Data is given to the framer in pieces of (at most) Chunk bytes until
+ * the object is complete, an error occurs, or the data runs out.
+ * The total number of bytes used is returned in pUsed.
+ */
+static int Feed(JsonFramer_t *p, const char *pData, size_t Length,
+		size_t Chunk, size_t *pUsed)
+{
+	size_t offset = 0;
+	int result = 0;
+	while (offset < Length && result == 0) {
+		size_t n = Length - offset;
+		if (n > Chunk) {
+			n = Chunk;
+		}
+		size_t used = 0;
+		result = JsonFramer_Compute(p, &pData[offset], n, &used);
+		HOST_CHECK(used <= n);
+		HOST_CHECK(result != 0 || used == n);
+		offset += used;
+	}
+	*pUsed = offset;
+	return result;
+}
+
+/* The object must be framed, for every chunk size, without the data that
+ * surrounds it.
+ */
+static void CheckFrame(const char *pData, const char *pObject)
+{
+	JsonFramer_t framer;
+	size_t length = strlen(pData);
+	size_t objectLength = strlen(pObject);
+	const char *pEnd = strstr(pData, pObject) + objectLength;
+	size_t chunk;
+
+	for (chunk = 1; chunk <= length; chunk++) {
+		size_t used = 0;
+		JsonFramer_Reset(&framer, frame, sizeof(frame));
+		HOST_CHECK(Feed(&framer, pData, length, chunk, &used) == 1);
+		HOST_CHECK(used == (size_t)(pEnd - pData));
+		HOST_CHECK(framer.length == objectLength);
+		HOST_CHECK(memcmp(frame, pObject, objectLength) == 0);
+	}
+}
+
+static void TestSingleChunk(void)
+{
+	JsonFramer_t framer;
+	size_t used = 0;
+
+	JsonFramer_Reset(&framer, frame, sizeof(frame));
+
+	/* Data before an object is discarded. */
+	HOST_CHECK(JsonFramer_Compute(&framer, "abc", 3, &used) == 0);
+	HOST_CHECK(used == 3);
+	HOST_CHECK(framer.length == 0);
+
+	CheckFrame("{}", "{}");
+	CheckFrame("xx{\"a\":1}", "{\"a\":1}");
+
+	/* Processing stops at the end of the object. */
+	CheckFrame("{\"a\":[1,{\"b\":2}]}{\"c\":3}", "{\"a\":[1,{\"b\":2}]}");
+}
+
+static void TestSplit(void)
+{
+	const char *pObject = "{\"jsonrpc\":\"2.0\",\"id\":1,"
+			      "\"result\":[\"sensorName\",\"BT510\"]}";
+	JsonFramer_t framer;
+	size_t used = 0;
+
+	CheckFrame(pObject, pObject);
+
+	/* An object can end exactly at the end of a chunk. */
+	JsonFramer_Reset(&framer, frame, sizeof(frame));
+	HOST_CHECK(JsonFramer_Compute(&framer, "{\"a\":", 5, &used) == 0);
+	HOST_CHECK(used == 5);
+	HOST_CHECK(JsonFramer_Compute(&framer, "2}", 2, &used) == 1);
+	HOST_CHECK(used == 2);
+	HOST_CHECK(framer.length == 7);
+	HOST_CHECK(memcmp(frame, "{\"a\":2}", 7) == 0);
+}
+
+static void TestStrings(void)
+{
+	/* Braces and brackets inside of strings aren't structure. */
+	CheckFrame("{\"a\":\"}{][\"}", "{\"a\":\"}{][\"}");
+	CheckFrame("{\"{\":\"}\",\"b\":[\"]\"]}",
+		   "{\"{\":\"}\",\"b\":[\"]\"]}");
+
+	/* An escaped quote doesn't end a string. */
+	CheckFrame("{\"a\":\"x\\\"}\"}", "{\"a\":\"x\\\"}\"}");
+	CheckFrame("{\"a\":\"\\\"\\\"}\"}", "{\"a\":\"\\\"\\\"}\"}");
+
+	/* An escaped backslash does. */
+	CheckFrame("{\"a\":\"\\\\\"}{}", "{\"a\":\"\\\\\"}");
+}
+
+static void TestOverflow(void)
+{
+	char small[8];
+	JsonFramer_t framer;
+	size_t used = 0;
+	const char *pLarge = "{\"abcdef\":1}";
+	const char *pObject = "{\"a\":1}";
+	const char *pNested = "{\"a\":[{\"b\":1},\"}\"],\"c\":{\"d\":2}}"
+			      "{\"e\":3}";
+	size_t length = strlen(pNested);
+	size_t chunk;
+
+	JsonFramer_Reset(&framer, small, sizeof(small));
+	HOST_CHECK(Feed(&framer, pLarge, strlen(pLarge), strlen(pLarge),
+			&used) == -ENOMEM);
+	HOST_CHECK(framer.length == 0);
+	HOST_CHECK(framer.depth == 0);
+	HOST_CHECK(!framer.inString);
+
+	/* The framer can be used again without a reset. */
+	HOST_CHECK(Feed(&framer, pObject, strlen(pObject), 1, &used) == 1);
+	HOST_CHECK(framer.length == strlen(pObject));
+	HOST_CHECK(memcmp(small, pObject, strlen(pObject)) == 0);
+
+	/* An object split across chunks overflows when the total is too
+	 * large.
+	 */
+	JsonFramer_Reset(&framer, small, sizeof(small));
+	HOST_CHECK(Feed(&framer, pLarge, strlen(pLarge), 3, &used) == -ENOMEM);
+	HOST_CHECK(framer.length == 0);
+
+	/* The rest of an object that is too large is discarded (its inner
+	 * objects aren't framed).
+	 */
+	for (chunk = 1; chunk <= length; chunk++) {
+		size_t offset = 0;
+		JsonFramer_Reset(&framer, small, sizeof(small));
+		HOST_CHECK(Feed(&framer, pNested, length, chunk, &offset) ==
+			   -ENOMEM);
+		HOST_CHECK(Feed(&framer, &pNested[offset], length - offset,
+				chunk, &used) == 1);
+		HOST_CHECK(offset + used == length);
+		HOST_CHECK(framer.length == 7);
+		HOST_CHECK(memcmp(small, "{\"e\":3}", 7) == 0);
+	}
+
+	/* An object that fills the buffer exactly fits. */
+	JsonFramer_Reset(&framer, small, sizeof(small));
+	HOST_CHECK(Feed(&framer, "{\"ab\":1}", 8, 2, &used) == 1);
+	HOST_CHECK(framer.length == sizeof(small));
+}
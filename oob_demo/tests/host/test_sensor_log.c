@@ -0,0 +1,400 @@
+/**
+ * @file test_sensor_log.c
+ * @brief Host test and benchmark of the packed sensor event log.
+ * Random event streams are checked against a reference copy of every event.
+ *
+ * Copyright (c) 2020 Laird Connectivity
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/******************************************************************************/
+/* Includes                                                                   */
+/******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "sensor_log.h"
+#include "shadow_builder.h"
+#include "host_test.h"
+
+/******************************************************************************/
+/* Local Constant, Macro and Type Definitions                                 */
+/******************************************************************************/
+#define REFERENCE_MAX_SIZE 20000
+#define BENCHMARK_EVENTS 1000000
+#define BENCHMARK_READS 100000
+
+/* The log used to be an array of events. */
+#define ARRAY_LOG_BYTES (CONFIG_SENSOR_LOG_MAX_SIZE * sizeof(SensorLogEvent_t))
+
+enum RECORD_TYPE {
+	RECORD_TEMPERATURE = 1,
+	RECORD_MAGNET = 2,
+	RECORD_MOVEMENT = 3,
+	RECORD_ALARM_HIGH_TEMP_1 = 4,
+	RECORD_BATTERY_GOOD = 12,
+	RECORD_ADV_ON_BUTTON = 16
+};
+
+typedef struct Stream {
+	uint32_t epoch;
+	int32_t temperature; /* hundredths of a degree */
+	uint32_t seed;
+} Stream_t;
+
+/******************************************************************************/
+/* Local Data Definitions                                                     */
+/******************************************************************************/
+static SensorLogEvent_t reference[REFERENCE_MAX_SIZE];
+static size_t referenceCount;
+
+static const char *pCapturedKey;
+static SensorLogEvent_t captured[CONFIG_SENSOR_LOG_MAX_SIZE];
+static size_t capturedCount;
+
+/******************************************************************************/
+/* Local Function Prototypes                                                  */
+/******************************************************************************/
+static uint32_t Random(Stream_t *p);
+static SensorLogEvent_t RandomEvent(Stream_t *p);
+static SensorLogEvent_t PeriodicEvent(Stream_t *p, uint32_t Interval);
+static SensorLogEvent_t MixedEvent(Stream_t *p);
+static void Add(SensorLog_t *pLog, SensorLogEvent_t *pEvent);
+static bool Equal(const SensorLogEvent_t *pA, const SensorLogEvent_t *pB);
+static void CheckRecent(SensorLog_t *pLog);
+static void CheckJson(SensorLog_t *pLog);
+static size_t Density(const char *pName, uint32_t Interval);
+static double Seconds(clock_t Start);
+
+static void TestRoundTrip(void);
+static void TestEmpty(void);
+static void TestDensity(void);
+static void Benchmark(void);
+
+/******************************************************************************/
+/* Global Function Definitions                                                */
+/******************************************************************************/
+void ShadowBuilder_StartArray(JsonMsg_t *pJsonMsg, const char *pKey)
+{
+	(void)pJsonMsg;
+	pCapturedKey = pKey;
+	capturedCount = 0;
+}
+
+void ShadowBuilder_EndArray(JsonMsg_t *pJsonMsg)
+{
+	(void)pJsonMsg;
+}
+
+void ShadowBuilder_AddEventLogEntry(JsonMsg_t *pJsonMsg, SensorLogEvent_t *p)
+{
+	(void)pJsonMsg;
+	HOST_CHECK(capturedCount < CONFIG_SENSOR_LOG_MAX_SIZE);
+	if (capturedCount < CONFIG_SENSOR_LOG_MAX_SIZE) {
+		captured[capturedCount++] = *p;
+	}
+}
+
+int main(void)
+{
+	TestEmpty();
+	TestRoundTrip();
+	TestDensity();
+	Benchmark();
+	return HostTest_Result("sensor_log");
+}
+
+/******************************************************************************/
+/* Local Function Definitions                                                 */
+/******************************************************************************/
+static void TestEmpty(void)
+{
+	SensorLog_t *pLog = SensorLog_Allocate(CONFIG_SENSOR_LOG_MAX_SIZE);
+	SensorLogEvent_t event;
+	SensorLogEvent_t events[CONFIG_SENSOR_LOG_MAX_SIZE];
+
+	HOST_CHECK(pLog != NULL);
+	HOST_CHECK(!SensorLog_GetRecent(pLog, 0, &event));
+	HOST_CHECK(SensorLog_GetRecentEvents(pLog, 1, events) == 0);
+	capturedCount = 0;
+	pCapturedKey = NULL;
+	SensorLog_GenerateJson(pLog, NULL);
+	HOST_CHECK(pCapturedKey == NULL);
+
+	/* A NULL log is allowed. */
+	HOST_CHECK(!SensorLog_GetRecent(NULL, 0, &event));
+	HOST_CHECK(SensorLog_GetRecentEvents(NULL, 1, events) == 0);
+	HOST_CHECK(SensorLog_GetNumberOfEntries(NULL) == 0);
+	HOST_CHECK(SensorLog_Allocate(0) == NULL);
+	HOST_CHECK(SensorLog_Allocate(CONFIG_SENSOR_LOG_MAX_SIZE + 1) == NULL);
+	SensorLog_Free(pLog);
+}
+
+/* Epochs go backwards, data jumps, intervals repeat, and there are more
+ * record types than fit in the dictionary.
+ */
+static void TestRoundTrip(void)
+{
+	Stream_t stream = { .epoch = 1600000000, .seed = 1 };
+	SensorLog_t *pLog = SensorLog_Allocate(CONFIG_SENSOR_LOG_MAX_SIZE);
+	referenceCount = 0;
+
+	size_t i;
+	for (i = 0; i < REFERENCE_MAX_SIZE; i++) {
+		SensorLogEvent_t event = RandomEvent(&stream);
+		Add(pLog, &event);
+		HOST_CHECK(SensorLog_GetNumberOfEntries(pLog) > 0);
+		if ((i % 7) == 0) {
+			CheckRecent(pLog);
+			CheckJson(pLog);
+		}
+	}
+	SensorLog_Free(pLog);
+}
+
+static void CheckRecent(SensorLog_t *pLog)
+{
+	size_t count = SensorLog_GetNumberOfEntries(pLog);
+	SensorLogEvent_t events[CONFIG_SENSOR_LOG_MAX_SIZE];
+	size_t n = SensorLog_GetRecentEvents(pLog, CONFIG_SENSOR_LOG_MAX_SIZE,
+					     events);
+	HOST_CHECK(n == MIN(count, CONFIG_SENSOR_LOG_MAX_SIZE));
+
+	size_t age;
+	for (age = 0; age < count; age++) {
+		SensorLogEvent_t event;
+		const SensorLogEvent_t *pExpected =
+			&reference[referenceCount - 1 - age];
+		HOST_CHECK(SensorLog_GetRecent(pLog, age, &event));
+		HOST_CHECK(Equal(&event, pExpected));
+		if (age < n) {
+			HOST_CHECK(Equal(&events[age], pExpected));
+		}
+	}
+	SensorLogEvent_t event;
+	HOST_CHECK(!SensorLog_GetRecent(pLog, count, &event));
+}
+
+static void CheckJson(SensorLog_t *pLog)
+{
+	size_t count = SensorLog_GetNumberOfEntries(pLog);
+	size_t entries = MIN(count, CONFIG_SENSOR_LOG_MAX_SIZE);
+	SensorLog_GenerateJson(pLog, NULL);
+	HOST_CHECK(strcmp(pCapturedKey, "eventLog") == 0);
+	HOST_CHECK(capturedCount == entries);
+
+	size_t i;
+	for (i = 0; i < capturedCount; i++) {
+		HOST_CHECK(Equal(&captured[i],
+				 &reference[referenceCount - entries + i]));
+	}
+
+	/* The oldest of the unsent events are appended first. */
+	size_t unsent = (referenceCount % (3 * CONFIG_SENSOR_LOG_MAX_SIZE)) + 1;
+	size_t first = referenceCount - MIN(unsent, count);
+	size_t sent = SensorLog_GenerateAppendJson(pLog, NULL, unsent);
+	HOST_CHECK(strcmp(pCapturedKey, "eventLogAppend") == 0);
+	HOST_CHECK(sent == MIN(MIN(unsent, count), CONFIG_SENSOR_LOG_MAX_SIZE));
+	HOST_CHECK(capturedCount == sent);
+	for (i = 0; i < capturedCount; i++) {
+		HOST_CHECK(Equal(&captured[i], &reference[first + i]));
+	}
+}
+
+/* The number of events held in the default buffer for typical streams. */
+static void TestDensity(void)
+{
+	size_t periodic[] = { Density("temperature every 60 s", 60),
+			      Density("temperature every 120 s", 120),
+			      Density("temperature every 600 s", 600) };
+	size_t mixed = Density("mixed events", 0);
+
+	/* The buffer is the same size as the array it replaced.  Periodic
+	 * events (the BT510 default) must fit at least three times as many.
+	 */
+	HOST_CHECK(CONFIG_SENSOR_LOG_BUFFER_SIZE == ARRAY_LOG_BYTES);
+	size_t i;
+	for (i = 0; i < sizeof(periodic) / sizeof(periodic[0]); i++) {
+		HOST_CHECK(periodic[i] >= 3 * CONFIG_SENSOR_LOG_MAX_SIZE);
+	}
+	HOST_CHECK((2 * mixed) >= (5 * CONFIG_SENSOR_LOG_MAX_SIZE));
+}
+
+/* An interval of 0 generates mixed events. */
+static size_t Density(const char *pName, uint32_t Interval)
+{
+	Stream_t stream = { .epoch = 1600000000, .temperature = 2000,
+			    .seed = Interval + 1 };
+	SensorLog_t *pLog = SensorLog_Allocate(CONFIG_SENSOR_LOG_MAX_SIZE);
+
+	/* The log is filled several times so that the count is stable. */
+	size_t minimum = SIZE_MAX;
+	size_t i;
+	for (i = 0; i < 2000; i++) {
+		SensorLogEvent_t event;
+		if (Interval == 0) {
+			event = MixedEvent(&stream);
+		} else {
+			event = PeriodicEvent(&stream, Interval);
+		}
+		SensorLog_Add(pLog, &event);
+		if (i >= 1000) {
+			minimum = MIN(minimum,
+				      SensorLog_GetNumberOfEntries(pLog));
+		}
+	}
+	printf("%-26s %3zu events in %u bytes (array held %u, %.1fx)\n",
+	       pName, minimum, CONFIG_SENSOR_LOG_BUFFER_SIZE,
+	       CONFIG_SENSOR_LOG_MAX_SIZE,
+	       (double)minimum / CONFIG_SENSOR_LOG_MAX_SIZE);
+	SensorLog_Free(pLog);
+	return minimum;
+}
+
+/* A shadow update reads the pending events (newest first). */
+static void Benchmark(void)
+{
+	Stream_t stream = { .epoch = 1600000000, .temperature = 2000 };
+	SensorLog_t *pLog = SensorLog_Allocate(CONFIG_SENSOR_LOG_MAX_SIZE);
+	SensorLogEvent_t events[CONFIG_SENSOR_LOG_MAX_SIZE];
+
+	clock_t start = clock();
+	size_t i;
+	for (i = 0; i < BENCHMARK_EVENTS; i++) {
+		SensorLogEvent_t event = MixedEvent(&stream);
+		SensorLog_Add(pLog, &event);
+	}
+	double add = Seconds(start) / BENCHMARK_EVENTS;
+
+	size_t n = CONFIG_SENSOR_LOG_MAX_SIZE;
+	uint32_t sum = 0;
+	start = clock();
+	for (i = 0; i < BENCHMARK_READS; i++) {
+		size_t age;
+		for (age = 0; age < n; age++) {
+			SensorLog_GetRecent(pLog, age, &events[age]);
+		}
+		sum += events[n - 1].epoch;
+	}
+	double byAge = Seconds(start) / BENCHMARK_READS;
+
+	start = clock();
+	for (i = 0; i < BENCHMARK_READS; i++) {
+		SensorLog_GetRecentEvents(pLog, n, events);
+		sum -= events[n - 1].epoch;
+	}
+	double onePass = Seconds(start) / BENCHMARK_READS;
+	HOST_CHECK(sum == 0);
+
+	start = clock();
+	for (i = 0; i < BENCHMARK_READS; i++) {
+		SensorLog_GenerateJson(pLog, NULL);
+	}
+	double json = Seconds(start) / BENCHMARK_READS;
+
+	printf("add %.0f ns, read %zu newest: %.2f us by age, %.2f us "
+	       "in one pass, serialize %.2f us\n",
+	       add * 1e9, n, byAge * 1e6, onePass * 1e6, json * 1e6);
+	SensorLog_Free(pLog);
+}
+
+static void Add(SensorLog_t *pLog, SensorLogEvent_t *pEvent)
+{
+	SensorLog_Add(pLog, pEvent);
+	reference[referenceCount++] = *pEvent;
+}
+
+static bool Equal(const SensorLogEvent_t *pA, const SensorLogEvent_t *pB)
+{
+	return (pA->epoch == pB->epoch && pA->data == pB->data &&
+		pA->recordType == pB->recordType);
+}
+
+static uint32_t Random(Stream_t *p)
+{
+	p->seed = p->seed * 1103515245 + 12345;
+	return (p->seed >> 8);
+}
+
+static SensorLogEvent_t RandomEvent(Stream_t *p)
+{
+	SensorLogEvent_t event;
+	uint32_t r = Random(p);
+	switch (r % 8) {
+	case 0:
+		p->epoch -= Random(p) % 100000;
+		break;
+	case 1:
+		p->epoch += Random(p);
+		break;
+	case 2:
+	case 3:
+		p->epoch += 60;
+		break;
+	default:
+		p->epoch += Random(p) % 300;
+		break;
+	}
+	switch ((r >> 3) % 4) {
+	case 0:
+		event.data = Random(p);
+		break;
+	case 1:
+		event.data = (uint16_t)p->temperature;
+		break;
+	default:
+		event.data = p->temperature + (int32_t)(Random(p) % 255) - 127;
+		break;
+	}
+	p->temperature = event.data;
+	event.epoch = p->epoch;
+	event.recordType = 1 + (Random(p) % 20);
+	return event;
+}
+
+/* The sensor samples on an interval and the temperature drifts. */
+static SensorLogEvent_t PeriodicEvent(Stream_t *p, uint32_t Interval)
+{
+	SensorLogEvent_t event;
+	p->epoch += Interval;
+	p->temperature += (int32_t)(Random(p) % 21) - 10;
+	event.epoch = p->epoch;
+	event.data = (uint16_t)p->temperature;
+	event.recordType = RECORD_TEMPERATURE;
+	return event;
+}
+
+/* Temperature with alarms, movement, magnet and battery events. */
+static SensorLogEvent_t MixedEvent(Stream_t *p)
+{
+	SensorLogEvent_t event;
+	uint32_t r = Random(p) % 16;
+	p->epoch += (r < 12) ? 60 : (Random(p) % 20);
+	if (r < 12) {
+		p->temperature += (int32_t)(Random(p) % 41) - 20;
+		event.data = (uint16_t)p->temperature;
+		event.recordType = RECORD_TEMPERATURE;
+	} else if (r == 12) {
+		event.data = (uint16_t)p->temperature;
+		event.recordType = RECORD_ALARM_HIGH_TEMP_1;
+	} else if (r == 13) {
+		event.data = Random(p) & 1;
+		event.recordType = RECORD_MAGNET;
+	} else if (r == 14) {
+		event.data = 1;
+		event.recordType = RECORD_MOVEMENT;
+	} else {
+		event.data = 3000 + (Random(p) % 100);
+		event.recordType = (Random(p) & 1) ? RECORD_BATTERY_GOOD :
+						     RECORD_ADV_ON_BUTTON;
+	}
+	event.epoch = p->epoch;
+	return event;
+}
+
+static double Seconds(clock_t Start)
+{
+	return (double)(clock() - Start) / CLOCKS_PER_SEC;
+}